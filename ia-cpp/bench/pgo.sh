@@ -0,0 +1,122 @@
+#!/bin/sh
+# Two-stage profile-guided build of ia-cpp, trained on the repository's own
+# load benchmark, with a per-endpoint comparison against a plain LTO build.
+#
+#   bench/pgo.sh [BUILD_ROOT]          (default: build-pgo)
+#
+# Stages, each in its own tree under BUILD_ROOT:
+#   base/  Release + IA_LTO                      (the reference)
+#   gen/   + IA_PGO=GENERATE                     (instrumented)
+#   use/   + IA_PGO=USE with the training profiles (the result)
+# The training run serves the WORKLOAD below with the instrumented binary;
+# the comparison runs the same workload ROUNDS times against base and use,
+# alternating, and reports the median per endpoint.
+#
+# Environment: PGO_PORT (10100), PGO_ROUNDS (3), PGO_REQUESTS (per
+# connection, 5000), PGO_CMAKE_ARGS (extra configure flags, e.g. -DIA_TLS=ON).
+# The servers inherit the environment (MODEL_PATH, etc.), so train with the
+# model you deploy: the inlining decisions follow the profile.
+set -eu
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+ROOT=$(mkdir -p "${1:-build-pgo}" && cd "${1:-build-pgo}" && pwd)
+PORT=${PGO_PORT:-10100}
+ROUNDS=${PGO_ROUNDS:-3}
+REQUESTS=${PGO_REQUESTS:-5000}
+PROFILES=$ROOT/profiles
+JOBS=$(nproc 2>/dev/null || echo 2)
+
+# method path connections requests-per-conn
+WORKLOAD="POST /predict 4 $REQUESTS
+POST /predict 1 $REQUESTS
+GET /health 4 $REQUESTS
+GET /metrics 1 $((REQUESTS / 10))"
+
+build() {
+    dir=$1
+    shift
+    echo "== building $dir" >&2
+    # shellcheck disable=SC2086
+    cmake -S "$SRC" -B "$ROOT/$dir" -DCMAKE_BUILD_TYPE=Release -DIA_LTO=ON \
+          -DIA_BUILD_BENCH=ON ${PGO_CMAKE_ARGS:-} "$@" >/dev/null
+    cmake --build "$ROOT/$dir" -j"$JOBS" --target ia-cpp ia-bench >/dev/null
+}
+
+SERVER_PID=
+start_server() {
+    PORT=$PORT "$1" >/dev/null 2>&1 &
+    SERVER_PID=$!
+    i=0
+    until "$ROOT/base/ia-bench" --port "$PORT" --path /health --method GET \
+            --connections 1 --requests-per-conn 1 --warmup 0 >/dev/null 2>&1; do
+        i=$((i + 1))
+        if [ $i -gt 300 ]; then
+            echo "server $1 did not start" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+stop_server() {
+    kill -TERM "$SERVER_PID" 2>/dev/null || true
+    wait "$SERVER_PID" 2>/dev/null || true
+    SERVER_PID=
+}
+trap 'stop_server' EXIT
+
+# One workload line -> "rps p50 p99"
+run_bench() {
+    "$ROOT/base/ia-bench" --port "$PORT" --method "$1" --path "$2" \
+        --connections "$3" --requests-per-conn "$4" |
+        awk '{ for (i = 1; i <= NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2] } }
+             END { print v["throughput_rps"], v["p50_us"], v["p99_us"] }'
+}
+
+median() {
+    sort -n | awk '{ a[NR] = $1 } END { print a[int((NR + 1) / 2)] }'
+}
+
+build base
+build gen -DIA_PGO=GENERATE -DIA_PGO_DIR="$PROFILES"
+
+echo "== training" >&2
+rm -rf "$PROFILES"
+mkdir -p "$PROFILES"
+start_server "$ROOT/gen/ia-cpp"
+echo "$WORKLOAD" | while read -r method path conns reqs; do
+    run_bench "$method" "$path" "$conns" "$reqs" >/dev/null
+done
+stop_server
+if ls "$PROFILES"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -o "$PROFILES/ia-cpp.profdata" "$PROFILES"/*.profraw
+fi
+
+build use -DIA_PGO=USE -DIA_PGO_DIR="$PROFILES"
+
+echo "== comparing ($ROUNDS rounds)" >&2
+RESULTS=$ROOT/results.txt
+: > "$RESULTS"
+r=1
+while [ $r -le "$ROUNDS" ]; do
+    for variant in base use; do
+        start_server "$ROOT/$variant/ia-cpp"
+        echo "$WORKLOAD" | while read -r method path conns reqs; do
+            echo "$variant $method $path c=$conns $(run_bench "$method" "$path" "$conns" "$reqs")"
+        done >> "$RESULTS"
+        stop_server
+    done
+    r=$((r + 1))
+done
+
+printf '%-22s %12s %12s %8s %10s %10s\n' endpoint base_rps pgo_rps gain base_p99us pgo_p99us
+echo "$WORKLOAD" | while read -r method path conns reqs; do
+    key="$method $path c=$conns"
+    col() { grep "^$1 $key " "$RESULTS" | awk -v c="$2" '{ print $c }' | median; }
+    base_rps=$(col base 5)
+    use_rps=$(col use 5)
+    printf '%-22s %12.0f %12.0f %7.1f%% %10.0f %10.0f\n' "$key" "$base_rps" "$use_rps" \
+        "$(echo "$base_rps $use_rps" | awk '{ print ($2 / $1 - 1) * 100 }')" \
+        "$(col base 7)" "$(col use 7)"
+done
+echo "binaries: $ROOT/base/ia-cpp (LTO) and $ROOT/use/ia-cpp (LTO + PGO)"
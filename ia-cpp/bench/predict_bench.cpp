@@ -0,0 +1,300 @@
+// Closed-loop load generator for the ia-cpp endpoints.
+//
+// Each connection runs on its own thread and issues keep-alive HTTP/1.1
+// requests back to back; per-request latencies are merged at the end and
+// reported as percentiles. Requests are pre-serialized and sent with a single
+// send() on a TCP_NODELAY socket (as curl and browsers do), and responses are
+// framed by Content-Length, so the numbers reflect the server rather than the
+// client library. Usage:
+//
+//   ia-bench [--host H] [--port P] [--path /predict] [--method POST|GET]
+//            [--body '{"x":2}'] [--content-type application/json]
+//            [--connections N] [--requests-per-conn M] [--warmup W]
+//            [--close] [--tls] [--no-resume]
+//
+// --close opens a new connection for every request, which with --tls measures
+// handshake cost: sessions are resumed from the previous connection unless
+// --no-resume forces a full handshake each time. (--tls needs -DIA_TLS=ON.)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef IA_BENCH_TLS
+#include <openssl/ssl.h>
+#endif
+
+namespace {
+
+struct Options {
+  std::string host{"127.0.0.1"};
+  int port = 10000;
+  std::string path{"/predict"};
+  std::string method{"POST"};
+  std::string body{"{\"x\":2}"};
+  std::string content_type{"application/json"};
+  int connections = 4;
+  int requests_per_conn = 5000;
+  int warmup = 200;
+  bool close_each = false;
+  bool tls = false;
+  bool resume = true;
+};
+
+bool parseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto next = [&]() -> const char* {
+      return (i + 1 < argc) ? argv[++i] : nullptr;
+    };
+    const char* v = nullptr;
+    if (a == "--host" && (v = next())) o.host = v;
+    else if (a == "--port" && (v = next())) o.port = std::atoi(v);
+    else if (a == "--path" && (v = next())) o.path = v;
+    else if (a == "--method" && (v = next())) o.method = v;
+    else if (a == "--body" && (v = next())) o.body = v;
+    else if (a == "--content-type" && (v = next())) o.content_type = v;
+    else if (a == "--connections" && (v = next())) o.connections = std::atoi(v);
+    else if (a == "--requests-per-conn" && (v = next())) o.requests_per_conn = std::atoi(v);
+    else if (a == "--warmup" && (v = next())) o.warmup = std::atoi(v);
+    else if (a == "--close") o.close_each = true;
+    else if (a == "--tls") o.tls = true;
+    else if (a == "--no-resume") o.resume = false;
+    else {
+      std::cerr << "unknown or incomplete argument: " << a << std::endl;
+      return false;
+    }
+  }
+#ifndef IA_BENCH_TLS
+  if (o.tls) {
+    std::cerr << "--tls requires building with -DIA_TLS=ON" << std::endl;
+    return false;
+  }
+#endif
+  return o.connections > 0 && o.requests_per_conn > 0;
+}
+
+std::string buildRequest(const Options& o) {
+  std::string r = o.method + " " + o.path + " HTTP/1.1\r\n";
+  r += "Host: " + o.host + "\r\n";
+  if (o.method != "GET") {
+    r += "Content-Type: " + o.content_type + "\r\n";
+    r += "Content-Length: " + std::to_string(o.body.size()) + "\r\n";
+  }
+  r += "\r\n";
+  if (o.method != "GET") r += o.body;
+  return r;
+}
+
+int connectSocket(const Options& o) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(o.port));
+  if (inet_pton(AF_INET, o.host.c_str(), &addr.sin_addr) != 1 ||
+      ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Plain or TLS connection. The TLS session of the last connection is kept so
+// the next one can resume it.
+struct Conn {
+  int fd = -1;
+#ifdef IA_BENCH_TLS
+  SSL* ssl = nullptr;
+#endif
+
+  bool open(const Options& o, void* tls_ctx, void*& session) {
+    fd = connectSocket(o);
+    if (fd < 0) return false;
+#ifdef IA_BENCH_TLS
+    if (tls_ctx) {
+      ssl = SSL_new(static_cast<SSL_CTX*>(tls_ctx));
+      SSL_set_fd(ssl, fd);
+      if (session) SSL_set_session(ssl, static_cast<SSL_SESSION*>(session));
+      if (SSL_connect(ssl) != 1) {
+        close(nullptr);
+        return false;
+      }
+    }
+#else
+    (void)tls_ctx;
+    (void)session;
+#endif
+    return true;
+  }
+
+  void close(void** session) {
+#ifdef IA_BENCH_TLS
+    if (ssl) {
+      if (session) {
+        if (*session) SSL_SESSION_free(static_cast<SSL_SESSION*>(*session));
+        *session = SSL_get1_session(ssl);
+      }
+      SSL_shutdown(ssl);
+      SSL_free(ssl);
+      ssl = nullptr;
+    }
+#else
+    (void)session;
+#endif
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+  }
+
+  ssize_t send(const char* data, size_t len) {
+#ifdef IA_BENCH_TLS
+    if (ssl) return SSL_write(ssl, data, static_cast<int>(len));
+#endif
+    return ::send(fd, data, len, MSG_NOSIGNAL);
+  }
+
+  ssize_t recv(char* data, size_t len) {
+#ifdef IA_BENCH_TLS
+    if (ssl) return SSL_read(ssl, data, static_cast<int>(len));
+#endif
+    return ::recv(fd, data, len, 0);
+  }
+};
+
+// Reads one response; returns its status code, or -1 if the connection
+// failed. `closing` is set when the server asked to close the connection.
+int readResponse(Conn& conn, std::string& buf, bool& closing) {
+  buf.clear();
+  size_t header_end = std::string::npos;
+  size_t content_length = 0;
+  char chunk[4096];
+  for (;;) {
+    if (header_end == std::string::npos) {
+      header_end = buf.find("\r\n\r\n");
+      if (header_end != std::string::npos) {
+        auto head = buf.substr(0, header_end);
+        for (auto& c : head) c = static_cast<char>(std::tolower(c));
+        auto cl = head.find("content-length:");
+        if (cl != std::string::npos) {
+          content_length = std::strtoul(head.c_str() + cl + 15, nullptr, 10);
+        }
+        closing = head.find("connection: close") != std::string::npos;
+        header_end += 4;
+      }
+    }
+    if (header_end != std::string::npos &&
+        buf.size() >= header_end + content_length) {
+      return std::atoi(buf.c_str() + 9);
+    }
+    auto n = conn.recv(chunk, sizeof(chunk));
+    if (n <= 0) return -1;
+    buf.append(chunk, static_cast<size_t>(n));
+  }
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  auto idx = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+  return sorted[idx];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseArgs(argc, argv, o)) return 2;
+
+  const std::string request = buildRequest(o);
+  void* tls_ctx = nullptr;
+#ifdef IA_BENCH_TLS
+  if (o.tls) {
+    auto* ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);  // self-signed certs
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+    tls_ctx = ctx;
+  }
+#endif
+  std::vector<std::vector<double>> latencies(o.connections);
+  std::vector<size_t> errors(o.connections, 0);
+  std::vector<std::thread> threads;
+
+  auto started = std::chrono::steady_clock::now();
+  for (int c = 0; c < o.connections; c++) {
+    threads.emplace_back([&, c] {
+      auto& lat = latencies[c];
+      lat.reserve(o.requests_per_conn);
+      std::string buf;
+      Conn conn;
+      void* session = nullptr;
+      void** keep_session = o.resume ? &session : nullptr;
+
+      for (int i = 0; i < o.warmup + o.requests_per_conn; i++) {
+        // With --close the connect (and TLS handshake) is part of the sample
+        auto t0 = std::chrono::steady_clock::now();
+        if (conn.fd < 0 && !conn.open(o, tls_ctx, session)) {
+          errors[c]++;
+          continue;
+        }
+        bool closing = false;
+        auto sent = conn.send(request.data(), request.size());
+        int status = sent == static_cast<ssize_t>(request.size())
+                         ? readResponse(conn, buf, closing)
+                         : -1;
+        auto t1 = std::chrono::steady_clock::now();
+        if (status < 0 || closing || o.close_each) {
+          conn.close(status < 0 ? nullptr : keep_session);
+        }
+        if (status < 0 || status >= 500) {
+          errors[c]++;
+          continue;
+        }
+        if (i >= o.warmup) {
+          lat.push_back(
+              std::chrono::duration<double, std::micro>(t1 - t0).count());
+        }
+      }
+      conn.close(nullptr);
+#ifdef IA_BENCH_TLS
+      if (session) SSL_SESSION_free(static_cast<SSL_SESSION*>(session));
+#endif
+    });
+  }
+  for (auto& t : threads) t.join();
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+
+  std::vector<double> all;
+  size_t total_errors = 0;
+  for (int c = 0; c < o.connections; c++) {
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    total_errors += errors[c];
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << o.method << " " << o.path << (o.tls ? " tls" : "")
+            << (o.close_each ? (o.resume ? " close+resume" : " close") : "")
+            << " connections=" << o.connections
+            << " requests=" << all.size() << " errors=" << total_errors
+            << "\n";
+  std::cout << "  throughput_rps=" << static_cast<double>(all.size()) / elapsed
+            << "\n";
+  std::cout << "  p50_us=" << percentile(all, 0.50)
+            << " p90_us=" << percentile(all, 0.90)
+            << " p99_us=" << percentile(all, 0.99)
+            << " max_us=" << (all.empty() ? 0.0 : all.back()) << std::endl;
+  return total_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+// Closed-loop load generator for the shared-memory transport, the
+// counterpart of ia-bench for SHM_NAME. Each thread calls
+// ShmClient::predict back to back; latencies are reported the same way as
+// ia-bench so the two outputs can be compared directly. Usage:
+//
+//   ia-shm-bench [--name /ia-cpp] [--x 2] [--threads N]
+//                [--requests-per-conn M] [--warmup W] [--spin-us S]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_client.h"
+
+namespace {
+
+struct Options {
+  std::string name{"/ia-cpp"};
+  float x = 2.0f;
+  int threads = 4;
+  int requests_per_conn = 5000;
+  int warmup = 200;
+  int spin_us = 0;
+};
+
+bool parseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto next = [&]() -> const char* {
+      return (i + 1 < argc) ? argv[++i] : nullptr;
+    };
+    const char* v = nullptr;
+    if (a == "--name" && (v = next())) o.name = v;
+    else if (a == "--x" && (v = next())) o.x = std::strtof(v, nullptr);
+    else if ((a == "--threads" || a == "--connections") && (v = next())) o.threads = std::atoi(v);
+    else if (a == "--requests-per-conn" && (v = next())) o.requests_per_conn = std::atoi(v);
+    else if (a == "--warmup" && (v = next())) o.warmup = std::atoi(v);
+    else if (a == "--spin-us" && (v = next())) o.spin_us = std::atoi(v);
+    else {
+      std::cerr << "unknown or incomplete argument: " << a << std::endl;
+      return false;
+    }
+  }
+  return o.threads > 0 && o.requests_per_conn > 0 && o.spin_us >= 0;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  auto idx = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+  return sorted[idx];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseArgs(argc, argv, o)) return 2;
+
+  std::string error;
+  auto client = ShmClient::connect(o.name, &error);
+  if (!client) {
+    std::cerr << "connect: " << error << std::endl;
+    return 1;
+  }
+
+  std::vector<std::vector<double>> latencies(o.threads);
+  std::vector<size_t> errors(o.threads, 0);
+  std::vector<std::thread> threads;
+
+  auto started = std::chrono::steady_clock::now();
+  for (int c = 0; c < o.threads; c++) {
+    threads.emplace_back([&, c] {
+      auto& lat = latencies[c];
+      lat.reserve(o.requests_per_conn);
+      for (int i = 0; i < o.warmup + o.requests_per_conn; i++) {
+        float y;
+        auto t0 = std::chrono::steady_clock::now();
+        auto status = client->predict(o.x, y, 1000, o.spin_us);
+        auto t1 = std::chrono::steady_clock::now();
+        if (status != ShmClient::Status::kOk) {
+          errors[c]++;
+          continue;
+        }
+        if (i >= o.warmup) {
+          lat.push_back(
+              std::chrono::duration<double, std::micro>(t1 - t0).count());
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+
+  std::vector<double> all;
+  size_t total_errors = 0;
+  for (int c = 0; c < o.threads; c++) {
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    total_errors += errors[c];
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << "shm " << o.name << " threads=" << o.threads
+            << " requests=" << all.size() << " errors=" << total_errors
+            << "\n";
+  std::cout << "  throughput_rps=" << static_cast<double>(all.size()) / elapsed
+            << "\n";
+  std::cout << "  p50_us=" << percentile(all, 0.50)
+            << " p90_us=" << percentile(all, 0.90)
+            << " p99_us=" << percentile(all, 0.99)
+            << " max_us=" << (all.empty() ? 0.0 : all.back()) << std::endl;
+  return total_errors == 0 ? 0 : 1;
+}
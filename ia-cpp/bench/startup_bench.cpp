@@ -0,0 +1,225 @@
+// Cold-start comparison between ia-cpp builds (e.g. the full ORT library
+// against IA_ORT_MINIMAL).
+//
+// Each run fork/execs the server with PORT set and measures, from just
+// before the fork: the first successful connect() (port open) and the first
+// 200 from /health/ready (model loaded; a 404 from builds without that route
+// counts as ready once the port is open). The resident set is read from
+// /proc once ready, then the server gets SIGTERM. Runs alternate between the
+// binaries so drift on the host affects all of them alike. Usage:
+//
+//   ia-startup-bench [--port P] [--runs N] [--timeout-s T] BINARY [BINARY...]
+//
+// The servers inherit the environment and the working directory, so run it
+// from where models/ is.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+struct Options {
+  int port = 10100;
+  int runs = 10;
+  int timeout_s = 60;
+  std::vector<std::string> binaries;
+};
+
+bool parseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto next = [&]() -> const char* {
+      return (i + 1 < argc) ? argv[++i] : nullptr;
+    };
+    const char* v = nullptr;
+    if (a == "--port" && (v = next())) o.port = std::atoi(v);
+    else if (a == "--runs" && (v = next())) o.runs = std::atoi(v);
+    else if (a == "--timeout-s" && (v = next())) o.timeout_s = std::atoi(v);
+    else if (!a.empty() && a[0] != '-') o.binaries.push_back(a);
+    else {
+      std::cerr << "unknown or incomplete argument: " << a << std::endl;
+      return false;
+    }
+  }
+  if (o.binaries.empty()) {
+    std::cerr << "usage: ia-startup-bench [--port P] [--runs N] [--timeout-s T] "
+                 "BINARY [BINARY...]" << std::endl;
+    return false;
+  }
+  return o.runs > 0 && o.timeout_s > 0;
+}
+
+int connectLocal(int port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Status of GET path on a fresh connection, -1 on error
+int getStatus(int port, const char* path) {
+  int fd = connectLocal(port);
+  if (fd < 0) return -1;
+  std::string req = std::string("GET ") + path +
+                    " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  int status = -1;
+  char buf[256];
+  if (::send(fd, req.data(), req.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(req.size())) {
+    ssize_t n = ::recv(fd, buf, sizeof(buf) - 1, 0);
+    if (n > 12) {
+      buf[n] = '\0';
+      status = std::atoi(buf + 9);
+    }
+  }
+  ::close(fd);
+  return status;
+}
+
+long residentKb(pid_t pid) {
+  std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("VmRSS:", 0) == 0) return std::atol(line.c_str() + 6);
+  }
+  return 0;
+}
+
+struct Sample {
+  double port_ms = 0;
+  double ready_ms = 0;
+  long rss_kb = 0;
+  bool ok = false;
+};
+
+Sample runOnce(const std::string& binary, const Options& o) {
+  Sample s;
+  auto t0 = steady::now();
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::setenv("PORT", std::to_string(o.port).c_str(), 1);
+    int devnull = ::open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+      ::dup2(devnull, STDOUT_FILENO);
+      ::dup2(devnull, STDERR_FILENO);
+    }
+    ::execl(binary.c_str(), binary.c_str(), static_cast<char*>(nullptr));
+    ::_exit(127);
+  }
+  if (pid < 0) return s;
+
+  auto deadline = t0 + std::chrono::seconds(o.timeout_s);
+  auto ms = [&t0] {
+    return std::chrono::duration<double, std::milli>(steady::now() - t0).count();
+  };
+  int status = 0;
+  while (steady::now() < deadline && ::waitpid(pid, &status, WNOHANG) == 0) {
+    int fd = connectLocal(o.port);
+    if (fd >= 0) {
+      ::close(fd);
+      s.port_ms = ms();
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  while (s.port_ms > 0 && steady::now() < deadline) {
+    int code = getStatus(o.port, "/health/ready");
+    if (code == 200 || code == 404) {
+      s.ready_ms = ms();
+      s.rss_kb = residentKb(pid);
+      s.ok = true;
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  ::kill(pid, SIGTERM);
+  auto kill_deadline = steady::now() + std::chrono::seconds(5);
+  while (::waitpid(pid, &status, WNOHANG) == 0) {
+    if (steady::now() > kill_deadline) {
+      ::kill(pid, SIGKILL);
+      ::waitpid(pid, &status, 0);
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return s;
+}
+
+double median(std::vector<double> v) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseArgs(argc, argv, o)) return 2;
+
+  if (int fd = connectLocal(o.port); fd >= 0) {
+    ::close(fd);
+    std::cerr << "port " << o.port << " is already in use" << std::endl;
+    return 2;
+  }
+
+  std::vector<std::vector<Sample>> samples(o.binaries.size());
+  for (int r = 0; r < o.runs; r++) {
+    for (size_t b = 0; b < o.binaries.size(); b++) {
+      samples[b].push_back(runOnce(o.binaries[b], o));
+    }
+  }
+
+  int failures = 0;
+  for (size_t b = 0; b < o.binaries.size(); b++) {
+    std::vector<double> port, ready, rss;
+    int failed = 0;
+    for (const auto& s : samples[b]) {
+      if (!s.ok) {
+        failed++;
+        continue;
+      }
+      port.push_back(s.port_ms);
+      ready.push_back(s.ready_ms);
+      rss.push_back(static_cast<double>(s.rss_kb));
+    }
+    struct stat st{};
+    ::stat(o.binaries[b].c_str(), &st);
+    std::cout << o.binaries[b] << " runs=" << o.runs << " failed=" << failed
+              << " binary_bytes=" << st.st_size << "\n";
+    std::cout << "  time_to_port_ms p50=" << median(port)
+              << " max=" << (port.empty() ? 0.0 : *std::max_element(port.begin(), port.end()))
+              << "\n";
+    std::cout << "  time_to_ready_ms p50=" << median(ready)
+              << " max=" << (ready.empty() ? 0.0 : *std::max_element(ready.begin(), ready.end()))
+              << "\n";
+    std::cout << "  rss_ready_kb p50=" << median(rss) << std::endl;
+    failures += failed;
+  }
+  return failures == 0 ? 0 : 1;
+}
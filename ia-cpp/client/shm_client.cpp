@@ -0,0 +1,118 @@
+#include "shm_client.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "shm_layout.h"
+
+namespace {
+
+void set_error(std::string* error, const std::string& message) {
+  if (error) *error = message;
+}
+
+} // namespace
+
+std::unique_ptr<ShmClient> ShmClient::connect(const std::string& name,
+                                              std::string* error) {
+  int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    set_error(error, name + ": " + std::strerror(errno));
+    return nullptr;
+  }
+  void* addr = ::mmap(nullptr, sizeof(shm::Segment), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    set_error(error, name + ": mmap: " + std::strerror(errno));
+    return nullptr;
+  }
+  auto* seg = static_cast<shm::Segment*>(addr);
+  if (seg->magic.load(std::memory_order_acquire) != shm::kMagic ||
+      seg->version != shm::kVersion || seg->slots != shm::kSlots) {
+    ::munmap(addr, sizeof(shm::Segment));
+    set_error(error, name + ": not an ia-cpp segment of version " +
+                         std::to_string(shm::kVersion));
+    return nullptr;
+  }
+  return std::unique_ptr<ShmClient>(new ShmClient(seg));
+}
+
+ShmClient::~ShmClient() { ::munmap(seg_, sizeof(shm::Segment)); }
+
+bool ShmClient::claim_slot(uint32_t& index) {
+  // Start each thread somewhere else so concurrent callers rarely collide
+  static std::atomic<uint32_t> next{0};
+  thread_local uint32_t start = next.fetch_add(37);
+  for (uint32_t i = 0; i < shm::kSlots; i++) {
+    uint32_t candidate = (start + i) & (shm::kSlots - 1);
+    uint32_t expected = shm::kFree;
+    if (seg_->slot[candidate].state.compare_exchange_strong(expected,
+                                                           shm::kClaimed)) {
+      start = candidate;
+      index = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+ShmClient::Status ShmClient::predict(float x, float& y, int timeout_ms,
+                                     int spin_us) {
+  uint32_t index;
+  if (!claim_slot(index)) return Status::kBusy;
+  shm::Slot& slot = seg_->slot[index];
+  slot.owner_pid.store(static_cast<int32_t>(::getpid()));
+  slot.client_waiting.store(0);
+  slot.x = x;
+  slot.state.store(shm::kPending, std::memory_order_release);
+  shm::ring_push(*seg_, index);
+  seg_->doorbell.fetch_add(1);
+  if (seg_->server_waiting.load()) shm::futex_wake(seg_->doorbell, 1);
+
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  const auto spin_until = start + std::chrono::microseconds(spin_us);
+  const auto deadline = start + std::chrono::milliseconds(timeout_ms);
+  while (slot.state.load(std::memory_order_acquire) == shm::kPending &&
+         clock::now() < spin_until) {
+  }
+
+  // Announce the wait before the final check, or the server's completion
+  // could slip in between and never wake us
+  slot.client_waiting.store(1);
+  while (slot.state.load(std::memory_order_acquire) == shm::kPending) {
+    auto left = deadline - clock::now();
+    if (left <= clock::duration::zero()) {
+      uint32_t expected = shm::kPending;
+      if (slot.state.compare_exchange_strong(expected, shm::kAbandoned)) {
+        return Status::kTimeout;  // the server frees the slot later
+      }
+      break;  // completed just now
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+    timespec timeout{static_cast<time_t>(ns / 1000000000),
+                     static_cast<long>(ns % 1000000000)};
+    shm::futex_wait(slot.state, shm::kPending, &timeout);
+  }
+
+  Status status = slot.status == 200 ? Status::kOk : Status::kServerError;
+  y = slot.y;
+  slot.owner_pid.store(0);
+  slot.state.store(shm::kFree, std::memory_order_release);
+  return status;
+}
+
+const char* to_string(ShmClient::Status status) {
+  switch (status) {
+    case ShmClient::Status::kOk: return "ok";
+    case ShmClient::Status::kBusy: return "busy";
+    case ShmClient::Status::kTimeout: return "timeout";
+    case ShmClient::Status::kServerError: return "server error";
+  }
+  return "unknown";
+}
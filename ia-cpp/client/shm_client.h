@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Client library for the ia-cpp shared-memory transport (server side:
+// SHM_NAME, see src/shm_server.h). For scoring callers on the same host:
+// a call is a slot claim, a ring push and a futex wake when the server is
+// parked, with no socket, HTTP parsing or JSON.
+//
+//   auto client = ShmClient::connect("/ia-cpp");
+//   float y;
+//   if (client && client->predict(2.0f, y) == ShmClient::Status::kOk) ...
+//
+// A client can be shared by several threads; each call uses its own slot.
+
+namespace shm {
+struct Segment;
+}
+
+class ShmClient {
+public:
+  enum class Status {
+    kOk,
+    kBusy,         // all slots in use
+    kTimeout,      // no answer within the timeout (server gone or overloaded)
+    kServerError,  // inference failed or the server queue was full
+  };
+
+  // nullptr (with `error` filled in) if the segment does not exist or was
+  // created by an incompatible server version
+  static std::unique_ptr<ShmClient> connect(const std::string& name,
+                                            std::string* error = nullptr);
+  ~ShmClient();
+
+  ShmClient(const ShmClient&) = delete;
+  ShmClient& operator=(const ShmClient&) = delete;
+
+  // With `spin_us` > 0 the caller spins that long before sleeping on the
+  // futex, which saves the wake-up latency when client and server run on
+  // separate cores (and only steals CPU from the server when they do not).
+  Status predict(float x, float& y, int timeout_ms = 1000, int spin_us = 0);
+
+private:
+  explicit ShmClient(shm::Segment* segment) : seg_(segment) {}
+
+  bool claim_slot(uint32_t& index);
+
+  shm::Segment* seg_;
+};
+
+const char* to_string(ShmClient::Status status);
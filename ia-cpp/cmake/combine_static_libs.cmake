@@ -0,0 +1,28 @@
+# Merges the static libraries of an ORT build tree into one archive:
+#   cmake -DAR=ar -DLIB_DIR=<build>/MinSizeRel -DOUTPUT=libx.a -P combine_static_libs.cmake
+#
+# ORT is split into a dozen onnxruntime_* archives plus its dependencies
+# (abseil, flatbuffers, cpuinfo, protobuf-lite...), and the split changes
+# between releases. A single archive links without knowing the list or the
+# order, since ld rescans one archive until nothing new is pulled in.
+file(GLOB_RECURSE libs "${LIB_DIR}/*.a")
+list(FILTER libs EXCLUDE REGEX "(gtest|gmock|_test|test_|protoc)[^/]*\\.a$")
+# protobuf-lite is what ORT links; the full library would define the same symbols
+list(FILTER libs EXCLUDE REGEX "/libprotobufd?\\.a$")
+if(NOT libs)
+    message(FATAL_ERROR "No static libraries under ${LIB_DIR}")
+endif()
+
+set(script "CREATE ${OUTPUT}\n")
+foreach(lib ${libs})
+    string(APPEND script "ADDLIB ${lib}\n")
+endforeach()
+string(APPEND script "SAVE\nEND\n")
+file(WRITE ${OUTPUT}.mri "${script}")
+file(REMOVE ${OUTPUT})
+execute_process(COMMAND ${AR} -M INPUT_FILE ${OUTPUT}.mri RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${AR} -M failed merging ${LIB_DIR}")
+endif()
+list(LENGTH libs count)
+message(STATUS "Merged ${count} static libraries into ${OUTPUT}")
@@ -122,6 +122,10 @@
 #define CPPHTTPLIB_HEADER_MAX_COUNT 100
 #endif
 
+#ifndef CPPHTTPLIB_FLAT_HEADERS_INLINE_COUNT
+#define CPPHTTPLIB_FLAT_HEADERS_INLINE_COUNT 16
+#endif
+
 #ifndef CPPHTTPLIB_REDIRECT_MAX_COUNT
 #define CPPHTTPLIB_REDIRECT_MAX_COUNT 20
 #endif
@@ -264,6 +268,7 @@ using socklen_t = int;
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -576,9 +581,306 @@ enum StatusCode {
   NetworkAuthenticationRequired_511 = 511,
 };
 
+#ifdef CPPHTTPLIB_FLAT_HEADERS
+namespace detail {
+
+/*
+ * Vector with inline storage for the first N elements; only grows onto the
+ * heap past that. Iterators are plain pointers and are invalidated by any
+ * insertion or erasure, like std::vector.
+ */
+template <typename T, size_t N> class small_vector {
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  small_vector() noexcept : data_(inline_data()) {}
+
+  small_vector(const small_vector &rhs) : small_vector() {
+    reserve(rhs.size_);
+    for (const auto &x : rhs) {
+      emplace_back(x);
+    }
+  }
+
+  small_vector(small_vector &&rhs) noexcept : small_vector() {
+    take(std::move(rhs));
+  }
+
+  small_vector &operator=(const small_vector &rhs) {
+    if (this != &rhs) {
+      clear();
+      reserve(rhs.size_);
+      for (const auto &x : rhs) {
+        emplace_back(x);
+      }
+    }
+    return *this;
+  }
+
+  small_vector &operator=(small_vector &&rhs) noexcept {
+    if (this != &rhs) {
+      clear();
+      release_heap();
+      take(std::move(rhs));
+    }
+    return *this;
+  }
+
+  ~small_vector() {
+    clear();
+    release_heap();
+  }
+
+  iterator begin() noexcept { return data_; }
+  iterator end() noexcept { return data_ + size_; }
+  const_iterator begin() const noexcept { return data_; }
+  const_iterator end() const noexcept { return data_ + size_; }
+
+  size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+
+  T &operator[](size_t i) noexcept { return data_[i]; }
+  const T &operator[](size_t i) const noexcept { return data_[i]; }
+
+  template <class... Args> T &emplace_back(Args &&...args) {
+    if (size_ == capacity_) { reserve(capacity_ * 2); }
+    new (data_ + size_) T(std::forward<Args>(args)...);
+    return data_[size_++];
+  }
+
+  iterator insert(size_t pos, T &&val) {
+    emplace_back(std::move(val));
+    std::rotate(data_ + pos, data_ + size_ - 1, data_ + size_);
+    return data_ + pos;
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    auto f = data_ + (first - data_);
+    auto l = data_ + (last - data_);
+    auto new_end = std::move(l, end(), f);
+    for (auto p = new_end; p != end(); ++p) {
+      p->~T();
+    }
+    size_ -= static_cast<size_t>(l - f);
+    return f;
+  }
+
+  void clear() noexcept {
+    for (auto p = begin(); p != end(); ++p) {
+      p->~T();
+    }
+    size_ = 0;
+  }
+
+  void reserve(size_t n) {
+    if (n <= capacity_) { return; }
+    auto p = static_cast<T *>(::operator new(n * sizeof(T)));
+    for (size_t i = 0; i < size_; i++) {
+      new (p + i) T(std::move(data_[i]));
+      data_[i].~T();
+    }
+    release_heap();
+    data_ = p;
+    capacity_ = n;
+  }
+
+private:
+  T *inline_data() noexcept { return reinterpret_cast<T *>(storage_); }
+  bool is_inline() const noexcept {
+    return data_ == reinterpret_cast<const T *>(storage_);
+  }
+
+  void release_heap() noexcept {
+    if (!is_inline()) {
+      ::operator delete(data_);
+      data_ = inline_data();
+      capacity_ = N;
+    }
+  }
+
+  // Requires *this to be empty and inline
+  void take(small_vector &&rhs) noexcept {
+    if (rhs.is_inline()) {
+      for (auto &x : rhs) {
+        new (data_ + size_++) T(std::move(x));
+      }
+      rhs.clear();
+    } else {
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+      capacity_ = rhs.capacity_;
+      rhs.data_ = rhs.inline_data();
+      rhs.size_ = 0;
+      rhs.capacity_ = N;
+    }
+  }
+
+  alignas(T) unsigned char storage_[sizeof(T) * N];
+  T *data_;
+  size_t size_ = 0;
+  size_t capacity_ = N;
+};
+
+/*
+ * Flat, case-insensitive multimap used as `Headers` when
+ * CPPHTTPLIB_FLAT_HEADERS is defined.
+ *
+ * Entries live in a small_vector with inline room for the typical dozen
+ * request headers, so parsing a request needs no node allocations, and
+ * short names/values stay within std::string's SSO buffer. Each entry keeps
+ * its precomputed case-insensitive hash; lookups hash the key once and scan
+ * the hashes linearly, which beats a bucket walk at these sizes. Entries
+ * with equal keys are kept adjacent so equal_range() is a contiguous range,
+ * as with std::unordered_multimap.
+ */
+class flat_headers {
+public:
+  using key_type = std::string;
+  using mapped_type = std::string;
+  using value_type = std::pair<std::string, std::string>;
+  using size_type = size_t;
+  using iterator = value_type *;
+  using const_iterator = const value_type *;
+
+  flat_headers() = default;
+
+  flat_headers(std::initializer_list<value_type> init) {
+    insert(init.begin(), init.end());
+  }
+
+  template <class InputIt> flat_headers(InputIt first, InputIt last) {
+    insert(first, last);
+  }
+
+  iterator begin() noexcept { return entries_.begin(); }
+  iterator end() noexcept { return entries_.end(); }
+  const_iterator begin() const noexcept { return entries_.begin(); }
+  const_iterator end() const noexcept { return entries_.end(); }
+  const_iterator cbegin() const noexcept { return entries_.begin(); }
+  const_iterator cend() const noexcept { return entries_.end(); }
+
+  size_type size() const noexcept { return entries_.size(); }
+  bool empty() const noexcept { return entries_.empty(); }
+
+  void clear() noexcept {
+    entries_.clear();
+    hashes_.clear();
+  }
+
+  iterator insert(value_type &&val) {
+    auto h = hash_of(val.first);
+
+    // Place after the last entry with the same key (or at the end)
+    auto pos = entries_.size();
+    for (size_t i = entries_.size(); i > 0; i--) {
+      if (matches(i - 1, h, val.first)) {
+        pos = i;
+        break;
+      }
+    }
+
+    if (pos == entries_.size()) {
+      hashes_.emplace_back(h);
+      entries_.emplace_back(std::move(val));
+      return entries_.end() - 1;
+    }
+    hashes_.insert(pos, std::move(h));
+    return entries_.insert(pos, std::move(val));
+  }
+
+  iterator insert(const value_type &val) { return insert(value_type(val)); }
+
+  template <class InputIt> void insert(InputIt first, InputIt last) {
+    for (; first != last; ++first) {
+      insert(value_type(*first));
+    }
+  }
+
+  template <class... Args> iterator emplace(Args &&...args) {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  iterator find(const std::string &key) {
+    return entries_.begin() + index_of(key);
+  }
+
+  const_iterator find(const std::string &key) const {
+    return entries_.begin() + index_of(key);
+  }
+
+  size_type count(const std::string &key) const {
+    auto r = equal_range(key);
+    return static_cast<size_type>(r.second - r.first);
+  }
+
+  std::pair<iterator, iterator> equal_range(const std::string &key) {
+    auto r = range_of(key);
+    return {entries_.begin() + r.first, entries_.begin() + r.second};
+  }
+
+  std::pair<const_iterator, const_iterator>
+  equal_range(const std::string &key) const {
+    auto r = range_of(key);
+    return {entries_.begin() + r.first, entries_.begin() + r.second};
+  }
+
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    auto b = static_cast<size_t>(first - entries_.begin());
+    auto e = static_cast<size_t>(last - entries_.begin());
+    hashes_.erase(hashes_.begin() + b, hashes_.begin() + e);
+    return entries_.erase(first, last);
+  }
+
+  size_type erase(const std::string &key) {
+    auto r = equal_range(key);
+    auto n = static_cast<size_type>(r.second - r.first);
+    erase(r.first, r.second);
+    return n;
+  }
+
+private:
+  static size_t hash_of(const std::string &key) {
+    return case_ignore::hash()(key);
+  }
+
+  bool matches(size_t i, size_t h, const std::string &key) const {
+    return hashes_[i] == h && case_ignore::equal(entries_[i].first, key);
+  }
+
+  size_t index_of(const std::string &key) const {
+    auto h = hash_of(key);
+    for (size_t i = 0; i < entries_.size(); i++) {
+      if (matches(i, h, key)) { return i; }
+    }
+    return entries_.size();
+  }
+
+  std::pair<size_t, size_t> range_of(const std::string &key) const {
+    auto h = hash_of(key);
+    auto b = index_of(key);
+    auto e = b;
+    while (e < entries_.size() && matches(e, h, key)) {
+      e++;
+    }
+    return {b, e};
+  }
+
+  small_vector<value_type, CPPHTTPLIB_FLAT_HEADERS_INLINE_COUNT> entries_;
+  small_vector<size_t, CPPHTTPLIB_FLAT_HEADERS_INLINE_COUNT> hashes_;
+};
+
+} // namespace detail
+
+using Headers = detail::flat_headers;
+#else
 using Headers =
     std::unordered_multimap<std::string, std::string, detail::case_ignore::hash,
                             detail::case_ignore::equal_to>;
+#endif
 
 using Params = std::multimap<std::string, std::string>;
 using Match = std::smatch;
@@ -672,6 +974,10 @@ using ContentProviderWithoutLength =
 
 using ContentProviderResourceReleaser = std::function<void(bool success)>;
 
+class Stream;
+
+using UpgradeHandler = std::function<void(Stream &strm)>;
+
 struct FormDataProvider {
   std::string name;
   ContentProviderWithoutLength provider;
@@ -816,6 +1122,11 @@ struct Response {
                         const std::string &content_type);
   void set_file_content(const std::string &path);
 
+  // Switches protocols (101): once the response head is written, `handler`
+  // owns the connection on the worker thread, and the connection is closed
+  // when it returns. Set the Upgrade/Connection headers yourself.
+  void set_upgrade_handler(UpgradeHandler handler);
+
   Response() = default;
   Response(const Response &) = default;
   Response &operator=(const Response &) = default;
@@ -835,6 +1146,7 @@ struct Response {
   bool content_provider_success_ = false;
   std::string file_content_path_;
   std::string file_content_content_type_;
+  UpgradeHandler upgrade_handler_;
 };
 
 class Stream {
@@ -853,6 +1165,14 @@ public:
 
   virtual time_t duration() const = 0;
 
+  // Gathered write of two buffers as if they were concatenated. Returns the
+  // number of bytes written (possibly fewer than size1 + size2) or -1.
+  // Socket streams override this so that a response head and its body leave
+  // in a single syscall; the default only writes the first buffer and lets
+  // the caller loop.
+  virtual ssize_t write_gather(const char *ptr1, size_t size1,
+                               const char *ptr2, size_t size2);
+
   ssize_t write(const char *ptr);
   ssize_t write(const std::string &s);
 };
@@ -1050,6 +1370,21 @@ private:
   std::regex regex_;
 };
 
+/**
+ * Exact string comparison for patterns without regex metacharacters or path
+ * params ("/predict", "/health/live"). Such routes are also indexed by path
+ * in the server's handler table, so dispatching to them is a hash lookup
+ * instead of a scan over every registered matcher.
+ */
+class LiteralMatcher final : public MatcherBase {
+public:
+  LiteralMatcher(const std::string &pattern) : MatcherBase(pattern) {}
+
+  bool match(Request &request) const override;
+};
+
+bool is_literal_pattern(const std::string &pattern);
+
 ssize_t write_headers(Stream &strm, const Headers &headers);
 
 } // namespace detail
@@ -1129,9 +1464,18 @@ public:
   Server &
   set_header_writer(std::function<ssize_t(Stream &, Headers &)> const &writer);
 
+  // Headers that are identical on every response (CORS policy, etc.). They
+  // are serialized once here and copied verbatim into each response head,
+  // bypassing `res.headers`.
+  Server &set_static_headers(const Headers &headers);
+
   Server &set_keep_alive_max_count(size_t count);
   Server &set_keep_alive_timeout(time_t sec);
 
+  // Between keep-alive requests, check the socket without blocking for up to
+  // `usec` before falling back to a sleeping poll (busy-poll mode).
+  Server &set_keep_alive_spin(time_t usec);
+
   Server &set_read_timeout(time_t sec, time_t usec = 0);
   template <class Rep, class Period>
   Server &set_read_timeout(const std::chrono::duration<Rep, Period> &duration);
@@ -1157,6 +1501,15 @@ public:
   void stop();
   void decommission();
 
+  // For transports that do their own socket I/O: runs one request that is
+  // already fully buffered in `strm` and writes the response back to it.
+  // The upgrade handler of a 101 response is moved into `upgrade` rather
+  // than run on `strm`. With `close_connection` the response says so.
+  bool process_buffered_request(Stream &strm, const std::string &remote_addr,
+                                int remote_port, bool &connection_closed,
+                                UpgradeHandler &upgrade,
+                                bool close_connection = false);
+
   std::function<TaskQueue *(void)> new_task_queue;
 
 protected:
@@ -1164,11 +1517,13 @@ protected:
                        int remote_port, const std::string &local_addr,
                        int local_port, bool close_connection,
                        bool &connection_closed,
-                       const std::function<void(Request &)> &setup_request);
+                       const std::function<void(Request &)> &setup_request,
+                       UpgradeHandler *deferred_upgrade = nullptr);
 
   std::atomic<socket_t> svr_sock_{INVALID_SOCKET};
   size_t keep_alive_max_count_ = CPPHTTPLIB_KEEPALIVE_MAX_COUNT;
   time_t keep_alive_timeout_sec_ = CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND;
+  time_t keep_alive_spin_usec_ = 0;
   time_t read_timeout_sec_ = CPPHTTPLIB_SERVER_READ_TIMEOUT_SECOND;
   time_t read_timeout_usec_ = CPPHTTPLIB_SERVER_READ_TIMEOUT_USECOND;
   time_t write_timeout_sec_ = CPPHTTPLIB_SERVER_WRITE_TIMEOUT_SECOND;
@@ -1178,11 +1533,46 @@ protected:
   size_t payload_max_length_ = CPPHTTPLIB_PAYLOAD_MAX_LENGTH;
 
 private:
-  using Handlers =
-      std::vector<std::pair<std::unique_ptr<detail::MatcherBase>, Handler>>;
-  using HandlersForContentReader =
-      std::vector<std::pair<std::unique_ptr<detail::MatcherBase>,
-                            HandlerWithContentReader>>;
+  // Handlers for one method in registration order. Literal patterns are
+  // additionally indexed by path; the first registered match still wins, so
+  // only pattern (regex / path-param) entries registered before the literal
+  // one are tried ahead of it.
+  template <typename H> struct HandlerTable {
+    using Entry = std::pair<std::unique_ptr<detail::MatcherBase>, H>;
+
+    void emplace_back(std::unique_ptr<detail::MatcherBase> matcher,
+                      H handler) {
+      auto index = entries.size();
+      if (detail::is_literal_pattern(matcher->pattern())) {
+        literal_index.emplace(matcher->pattern(), index);
+      } else {
+        pattern_entries.push_back(index);
+      }
+      entries.emplace_back(std::move(matcher), std::move(handler));
+    }
+
+    const Entry *match(Request &req) const {
+      auto limit = entries.size();
+      auto it = literal_index.find(req.path);
+      if (it != literal_index.end()) { limit = it->second; }
+
+      for (auto i : pattern_entries) {
+        if (i >= limit) { break; }
+        if (entries[i].first->match(req)) { return &entries[i]; }
+      }
+      if (limit < entries.size() && entries[limit].first->match(req)) {
+        return &entries[limit];
+      }
+      return nullptr;
+    }
+
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, size_t> literal_index;
+    std::vector<size_t> pattern_entries;
+  };
+
+  using Handlers = HandlerTable<Handler>;
+  using HandlersForContentReader = HandlerTable<HandlerWithContentReader>;
 
   static std::unique_ptr<detail::MatcherBase>
   make_matcher(const std::string &pattern);
@@ -1279,6 +1669,11 @@ private:
   Headers default_headers_;
   std::function<ssize_t(Stream &, Headers &)> header_writer_ =
       detail::write_headers;
+
+  // Pre-serialized "Name: value\r\n" lines, rebuilt only by the setters
+  std::string static_headers_block_;
+  std::string keep_alive_header_line_;
+  void update_keep_alive_header_line();
 };
 
 enum class Error {
@@ -2055,15 +2450,15 @@ inline size_t get_header_value_u64(const Headers &headers,
                                    size_t id, bool &is_invalid_value) {
   is_invalid_value = false;
   auto rng = headers.equal_range(key);
+  if (id >= static_cast<size_t>(std::distance(rng.first, rng.second))) {
+    return def;
+  }
   auto it = rng.first;
   std::advance(it, static_cast<ssize_t>(id));
-  if (it != rng.second) {
-    if (is_numeric(it->second)) {
-      return std::strtoull(it->second.data(), nullptr, 10);
-    } else {
-      is_invalid_value = true;
-    }
+  if (is_numeric(it->second)) {
+    return std::strtoull(it->second.data(), nullptr, 10);
   }
+  is_invalid_value = true;
   return def;
 }
 
@@ -3358,6 +3753,8 @@ public:
   bool wait_writable() const override;
   ssize_t read(char *ptr, size_t size) override;
   ssize_t write(const char *ptr, size_t size) override;
+  ssize_t write_gather(const char *ptr1, size_t size1, const char *ptr2,
+                       size_t size2) override;
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   void get_local_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
@@ -3395,6 +3792,8 @@ public:
   bool wait_writable() const override;
   ssize_t read(char *ptr, size_t size) override;
   ssize_t write(const char *ptr, size_t size) override;
+  ssize_t write_gather(const char *ptr1, size_t size1, const char *ptr2,
+                       size_t size2) override;
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   void get_local_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
@@ -3413,9 +3812,32 @@ private:
 #endif
 
 inline bool keep_alive(const std::atomic<socket_t> &svr_sock, socket_t sock,
-                       time_t keep_alive_timeout_sec) {
+                       time_t keep_alive_timeout_sec,
+                       time_t keep_alive_spin_usec = 0) {
   using namespace std::chrono;
 
+  if (keep_alive_spin_usec > 0) {
+    const auto spin_until =
+        steady_clock::now() + microseconds{keep_alive_spin_usec};
+    do {
+#ifndef _WIN32
+      // A non-blocking peek rather than poll(): with SO_BUSY_POLL it also
+      // polls the device queue once
+      char c;
+      auto n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (n >= 0) { return true; } // data, or EOF for the next read to see
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        return false;
+      }
+#else
+      auto val = select_read(sock, 0, 0);
+      if (val > 0) { return true; }
+      if (val < 0) { return false; }
+#endif
+    } while (steady_clock::now() < spin_until &&
+             svr_sock != INVALID_SOCKET);
+  }
+
   const auto interval_usec =
       CPPHTTPLIB_KEEPALIVE_TIMEOUT_CHECK_INTERVAL_USECOND;
 
@@ -3449,11 +3871,13 @@ template <typename T>
 inline bool
 process_server_socket_core(const std::atomic<socket_t> &svr_sock, socket_t sock,
                            size_t keep_alive_max_count,
-                           time_t keep_alive_timeout_sec, T callback) {
+                           time_t keep_alive_timeout_sec,
+                           time_t keep_alive_spin_usec, T callback) {
   assert(keep_alive_max_count > 0);
   auto ret = false;
   auto count = keep_alive_max_count;
-  while (count > 0 && keep_alive(svr_sock, sock, keep_alive_timeout_sec)) {
+  while (count > 0 && keep_alive(svr_sock, sock, keep_alive_timeout_sec,
+                                 keep_alive_spin_usec)) {
     auto close_connection = count == 1;
     auto connection_closed = false;
     ret = callback(close_connection, connection_closed);
@@ -3467,11 +3891,13 @@ template <typename T>
 inline bool
 process_server_socket(const std::atomic<socket_t> &svr_sock, socket_t sock,
                       size_t keep_alive_max_count,
-                      time_t keep_alive_timeout_sec, time_t read_timeout_sec,
+                      time_t keep_alive_timeout_sec,
+                      time_t keep_alive_spin_usec, time_t read_timeout_sec,
                       time_t read_timeout_usec, time_t write_timeout_sec,
                       time_t write_timeout_usec, T callback) {
   return process_server_socket_core(
       svr_sock, sock, keep_alive_max_count, keep_alive_timeout_sec,
+      keep_alive_spin_usec,
       [&](bool close_connection, bool &connection_closed) {
         SocketStream strm(sock, read_timeout_sec, read_timeout_usec,
                           write_timeout_sec, write_timeout_usec);
@@ -4604,10 +5030,12 @@ inline const char *get_header_value(const Headers &headers,
                                     const std::string &key, const char *def,
                                     size_t id) {
   auto rng = headers.equal_range(key);
+  if (id >= static_cast<size_t>(std::distance(rng.first, rng.second))) {
+    return def;
+  }
   auto it = rng.first;
   std::advance(it, static_cast<ssize_t>(id));
-  if (it != rng.second) { return it->second.c_str(); }
-  return def;
+  return it->second.c_str();
 }
 
 template <typename T>
@@ -5055,6 +5483,22 @@ inline bool write_data(Stream &strm, const char *d, size_t l) {
   return true;
 }
 
+inline bool write_data_gather(Stream &strm, const char *d1, size_t l1,
+                              const char *d2, size_t l2) {
+  size_t offset = 0;
+  while (offset < l1 + l2) {
+    ssize_t length;
+    if (offset < l1) {
+      length = strm.write_gather(d1 + offset, l1 - offset, d2, l2);
+    } else {
+      length = strm.write(d2 + (offset - l1), l2 - (offset - l1));
+    }
+    if (length < 0) { return false; }
+    offset += static_cast<size_t>(length);
+  }
+  return true;
+}
+
 template <typename T>
 inline bool write_content_with_progress(Stream &strm,
                                         const ContentProvider &content_provider,
@@ -6769,10 +7213,12 @@ inline bool Request::has_trailer(const std::string &key) const {
 inline std::string Request::get_trailer_value(const std::string &key,
                                               size_t id) const {
   auto rng = trailers.equal_range(key);
+  if (id >= static_cast<size_t>(std::distance(rng.first, rng.second))) {
+    return std::string();
+  }
   auto it = rng.first;
   std::advance(it, static_cast<ssize_t>(id));
-  if (it != rng.second) { return it->second; }
-  return std::string();
+  return it->second;
 }
 
 inline size_t Request::get_trailer_value_count(const std::string &key) const {
@@ -6890,10 +7336,12 @@ inline bool Response::has_trailer(const std::string &key) const {
 inline std::string Response::get_trailer_value(const std::string &key,
                                                size_t id) const {
   auto rng = trailers.equal_range(key);
+  if (id >= static_cast<size_t>(std::distance(rng.first, rng.second))) {
+    return std::string();
+  }
   auto it = rng.first;
   std::advance(it, static_cast<ssize_t>(id));
-  if (it != rng.second) { return it->second; }
-  return std::string();
+  return it->second;
 }
 
 inline size_t Response::get_trailer_value_count(const std::string &key) const {
@@ -6975,6 +7423,11 @@ inline void Response::set_file_content(const std::string &path) {
   file_content_path_ = path;
 }
 
+inline void Response::set_upgrade_handler(UpgradeHandler handler) {
+  status = StatusCode::SwitchingProtocol_101;
+  upgrade_handler_ = std::move(handler);
+}
+
 // Result implementation
 inline bool Result::has_request_header(const std::string &key) const {
   return request_headers_.find(key) != request_headers_.end();
@@ -7001,6 +7454,12 @@ inline ssize_t Stream::write(const std::string &s) {
   return write(s.data(), s.size());
 }
 
+inline ssize_t Stream::write_gather(const char *ptr1, size_t size1,
+                                    const char *ptr2, size_t size2) {
+  if (size1 == 0) { return write(ptr2, size2); }
+  return write(ptr1, size1);
+}
+
 namespace detail {
 
 inline void calc_actual_timeout(time_t max_timeout_msec, time_t duration_msec,
@@ -7112,6 +7571,29 @@ inline ssize_t SocketStream::write(const char *ptr, size_t size) {
   return send_socket(sock_, ptr, size, CPPHTTPLIB_SEND_FLAGS);
 }
 
+inline ssize_t SocketStream::write_gather(const char *ptr1, size_t size1,
+                                          const char *ptr2, size_t size2) {
+#ifdef _WIN32
+  return Stream::write_gather(ptr1, size1, ptr2, size2);
+#else
+  if (!wait_writable()) { return -1; }
+
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char *>(ptr1);
+  iov[0].iov_len = size1;
+  iov[1].iov_base = const_cast<char *>(ptr2);
+  iov[1].iov_len = size2;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  return handle_EINTR(
+      [&]() { return sendmsg(sock_, &msg, CPPHTTPLIB_SEND_FLAGS); });
+#endif
+}
+
 inline void SocketStream::get_remote_ip_and_port(std::string &ip,
                                                  int &port) const {
   return detail::get_remote_ip_and_port(sock_, ip, port);
@@ -7261,6 +7743,16 @@ inline bool RegexMatcher::match(Request &request) const {
   return std::regex_match(request.path, request.matches, regex_);
 }
 
+inline bool LiteralMatcher::match(Request &request) const {
+  request.path_params.clear();
+  return request.path == pattern();
+}
+
+inline bool is_literal_pattern(const std::string &pattern) {
+  if (pattern.find("/:") != std::string::npos) { return false; }
+  return pattern.find_first_of(".^$|()[]{}*+?\\") == std::string::npos;
+}
+
 } // namespace detail
 
 // HTTP server implementation
@@ -7270,6 +7762,7 @@ inline Server::Server()
 #ifndef _WIN32
   signal(SIGPIPE, SIG_IGN);
 #endif
+  update_keep_alive_header_line();
 }
 
 inline Server::~Server() = default;
@@ -7278,6 +7771,8 @@ inline std::unique_ptr<detail::MatcherBase>
 Server::make_matcher(const std::string &pattern) {
   if (pattern.find("/:") != std::string::npos) {
     return detail::make_unique<detail::PathParamsMatcher>(pattern);
+  } else if (detail::is_literal_pattern(pattern)) {
+    return detail::make_unique<detail::LiteralMatcher>(pattern);
   } else {
     return detail::make_unique<detail::RegexMatcher>(pattern);
   }
@@ -7473,16 +7968,45 @@ inline Server &Server::set_header_writer(
   return *this;
 }
 
+inline Server &Server::set_static_headers(const Headers &headers) {
+  static_headers_block_.clear();
+  for (const auto &x : headers) {
+    if (detail::fields::is_field_name(x.first) &&
+        detail::fields::is_field_value(x.second)) {
+      static_headers_block_ += x.first;
+      static_headers_block_ += ": ";
+      static_headers_block_ += x.second;
+      static_headers_block_ += "\r\n";
+    }
+  }
+  return *this;
+}
+
 inline Server &Server::set_keep_alive_max_count(size_t count) {
   keep_alive_max_count_ = count;
+  update_keep_alive_header_line();
   return *this;
 }
 
 inline Server &Server::set_keep_alive_timeout(time_t sec) {
   keep_alive_timeout_sec_ = sec;
+  update_keep_alive_header_line();
+  return *this;
+}
+
+inline Server &Server::set_keep_alive_spin(time_t usec) {
+  keep_alive_spin_usec_ = usec;
   return *this;
 }
 
+inline void Server::update_keep_alive_header_line() {
+  keep_alive_header_line_ = "Keep-Alive: timeout=";
+  keep_alive_header_line_ += std::to_string(keep_alive_timeout_sec_);
+  keep_alive_header_line_ += ", max=";
+  keep_alive_header_line_ += std::to_string(keep_alive_max_count_);
+  keep_alive_header_line_ += "\r\n";
+}
+
 inline Server &Server::set_read_timeout(time_t sec, time_t usec) {
   read_timeout_sec_ = sec;
   read_timeout_usec_ = usec;
@@ -7631,14 +8155,14 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
   if (need_apply_ranges) { apply_ranges(req, res, content_type, boundary); }
 
   // Prepare additional headers
-  if (close_connection || req.get_header_value("Connection") == "close") {
+  const auto upgrade = res.upgrade_handler_ &&
+                       res.status == StatusCode::SwitchingProtocol_101;
+  auto keep_alive = true;
+  if (upgrade) {
+    keep_alive = false; // 101 carries the handler's "Connection: Upgrade"
+  } else if (close_connection || req.get_header_value("Connection") == "close") {
     res.set_header("Connection", "close");
-  } else {
-    std::string s = "timeout=";
-    s += std::to_string(keep_alive_timeout_sec_);
-    s += ", max=";
-    s += std::to_string(keep_alive_max_count_);
-    res.set_header("Keep-Alive", s);
+    keep_alive = false;
   }
 
   if ((!res.body.empty() || res.content_length_ > 0 || res.content_provider_) &&
@@ -7647,7 +8171,7 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
   }
 
   if (res.body.empty() && !res.content_length_ && !res.content_provider_ &&
-      !res.has_header("Content-Length")) {
+      !upgrade && !res.has_header("Content-Length")) {
     res.set_header("Content-Length", "0");
   }
 
@@ -7658,24 +8182,30 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
   if (post_routing_handler_) { post_routing_handler_(req, res); }
 
   // Response line and headers
-  {
-    detail::BufferStream bstrm;
-    if (!detail::write_response_line(bstrm, res.status)) { return false; }
-    if (!header_writer_(bstrm, res.headers)) { return false; }
-
-    // Flush buffer
-    auto &data = bstrm.get_buffer();
-    detail::write_data(strm, data.data(), data.size());
+  detail::BufferStream bstrm;
+  if (!detail::write_response_line(bstrm, res.status)) { return false; }
+  if (keep_alive) {
+    bstrm.write(keep_alive_header_line_.data(), keep_alive_header_line_.size());
   }
+  if (!static_headers_block_.empty()) {
+    bstrm.write(static_headers_block_.data(), static_headers_block_.size());
+  }
+  if (!header_writer_(bstrm, res.headers)) { return false; }
+  auto &head = bstrm.get_buffer();
 
   // Body
   auto ret = true;
-  if (req.method != "HEAD") {
-    if (!res.body.empty()) {
-      if (!detail::write_data(strm, res.body.data(), res.body.size())) {
-        ret = false;
-      }
-    } else if (res.content_provider_) {
+  if (req.method != "HEAD" && !res.body.empty()) {
+    // Head and body in one gathered write: one syscall, and no Nagle /
+    // delayed-ACK stall between two small segments.
+    if (!detail::write_data_gather(strm, head.data(), head.size(),
+                                   res.body.data(), res.body.size())) {
+      ret = false;
+    }
+  } else {
+    detail::write_data(strm, head.data(), head.size());
+
+    if (req.method != "HEAD" && res.content_provider_) {
       if (write_content_with_provider(strm, req, res, boundary, content_type)) {
         res.content_provider_success_ = true;
       } else {
@@ -8112,20 +8642,15 @@ inline bool Server::routing(Request &req, Response &res, Stream &strm) {
 
 inline bool Server::dispatch_request(Request &req, Response &res,
                                      const Handlers &handlers) const {
-  for (const auto &x : handlers) {
-    const auto &matcher = x.first;
-    const auto &handler = x.second;
-
-    if (matcher->match(req)) {
-      req.matched_route = matcher->pattern();
-      if (!pre_request_handler_ ||
-          pre_request_handler_(req, res) != HandlerResponse::Handled) {
-        handler(req, res);
-      }
-      return true;
-    }
+  auto entry = handlers.match(req);
+  if (!entry) { return false; }
+
+  req.matched_route = entry->first->pattern();
+  if (!pre_request_handler_ ||
+      pre_request_handler_(req, res) != HandlerResponse::Handled) {
+    entry->second(req, res);
   }
-  return false;
+  return true;
 }
 
 inline void Server::apply_ranges(const Request &req, Response &res,
@@ -8245,20 +8770,15 @@ inline void Server::apply_ranges(const Request &req, Response &res,
 inline bool Server::dispatch_request_for_content_reader(
     Request &req, Response &res, ContentReader content_reader,
     const HandlersForContentReader &handlers) const {
-  for (const auto &x : handlers) {
-    const auto &matcher = x.first;
-    const auto &handler = x.second;
-
-    if (matcher->match(req)) {
-      req.matched_route = matcher->pattern();
-      if (!pre_request_handler_ ||
-          pre_request_handler_(req, res) != HandlerResponse::Handled) {
-        handler(req, res, content_reader);
-      }
-      return true;
-    }
+  auto entry = handlers.match(req);
+  if (!entry) { return false; }
+
+  req.matched_route = entry->first->pattern();
+  if (!pre_request_handler_ ||
+      pre_request_handler_(req, res) != HandlerResponse::Handled) {
+    entry->second(req, res, content_reader);
   }
-  return false;
+  return true;
 }
 
 inline bool
@@ -8266,7 +8786,8 @@ Server::process_request(Stream &strm, const std::string &remote_addr,
                         int remote_port, const std::string &local_addr,
                         int local_port, bool close_connection,
                         bool &connection_closed,
-                        const std::function<void(Request &)> &setup_request) {
+                        const std::function<void(Request &)> &setup_request,
+                        UpgradeHandler *deferred_upgrade) {
   std::array<char, 2048> buf{};
 
   detail::stream_line_reader line_reader(strm, buf.data(), buf.size());
@@ -8446,6 +8967,19 @@ Server::process_request(Stream &strm, const std::string &remote_addr,
           });
     }
 
+    // Protocol switch: the handler takes over the connection after the 101
+    if (res.upgrade_handler_ &&
+        res.status == StatusCode::SwitchingProtocol_101) {
+      auto ret = write_response(strm, close_connection, req, res);
+      if (ret && deferred_upgrade) {
+        *deferred_upgrade = std::move(res.upgrade_handler_);
+      } else if (ret) {
+        res.upgrade_handler_(strm);
+      }
+      connection_closed = true;
+      return ret;
+    }
+
     if (detail::range_error(req, res)) {
       res.body.clear();
       res.content_length_ = 0;
@@ -8462,6 +8996,20 @@ Server::process_request(Stream &strm, const std::string &remote_addr,
   }
 }
 
+inline bool Server::process_buffered_request(Stream &strm,
+                                             const std::string &remote_addr,
+                                             int remote_port,
+                                             bool &connection_closed,
+                                             UpgradeHandler &upgrade,
+                                             bool close_connection) {
+  std::string local_addr;
+  int local_port = 0;
+  strm.get_local_ip_and_port(local_addr, local_port);
+  return process_request(strm, remote_addr, remote_port, local_addr,
+                         local_port, close_connection, connection_closed,
+                         nullptr, &upgrade);
+}
+
 inline bool Server::is_valid() const { return true; }
 
 inline bool Server::process_and_close_socket(socket_t sock) {
@@ -8475,7 +9023,7 @@ inline bool Server::process_and_close_socket(socket_t sock) {
 
   auto ret = detail::process_server_socket(
       svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
-      read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
+      keep_alive_spin_usec_, read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
       write_timeout_usec_,
       [&](Stream &strm, bool close_connection, bool &connection_closed) {
         return process_request(strm, remote_addr, remote_port, local_addr,
@@ -10527,10 +11075,12 @@ template <typename T>
 inline bool process_server_socket_ssl(
     const std::atomic<socket_t> &svr_sock, SSL *ssl, socket_t sock,
     size_t keep_alive_max_count, time_t keep_alive_timeout_sec,
-    time_t read_timeout_sec, time_t read_timeout_usec, time_t write_timeout_sec,
+    time_t keep_alive_spin_usec, time_t read_timeout_sec,
+    time_t read_timeout_usec, time_t write_timeout_sec,
     time_t write_timeout_usec, T callback) {
   return process_server_socket_core(
       svr_sock, sock, keep_alive_max_count, keep_alive_timeout_sec,
+      keep_alive_spin_usec,
       [&](bool close_connection, bool &connection_closed) {
         SSLSocketStream strm(sock, ssl, read_timeout_sec, read_timeout_usec,
                              write_timeout_sec, write_timeout_usec);
@@ -10654,6 +11204,18 @@ inline ssize_t SSLSocketStream::write(const char *ptr, size_t size) {
   return -1;
 }
 
+inline ssize_t SSLSocketStream::write_gather(const char *ptr1, size_t size1,
+                                             const char *ptr2, size_t size2) {
+  // Small responses go out as a single TLS record instead of two
+  if (size1 + size2 <= CPPHTTPLIB_SEND_BUFSIZ) {
+    char buf[CPPHTTPLIB_SEND_BUFSIZ];
+    memcpy(buf, ptr1, size1);
+    memcpy(buf + size1, ptr2, size2);
+    return write(buf, size1 + size2);
+  }
+  return Stream::write_gather(ptr1, size1, ptr2, size2);
+}
+
 inline void SSLSocketStream::get_remote_ip_and_port(std::string &ip,
                                                     int &port) const {
   detail::get_remote_ip_and_port(sock_, ip, port);
@@ -10789,7 +11351,7 @@ inline bool SSLServer::process_and_close_socket(socket_t sock) {
 
     ret = detail::process_server_socket_ssl(
         svr_sock_, ssl, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
-        read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
+        keep_alive_spin_usec_, read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
         write_timeout_usec_,
         [&](Stream &strm, bool close_connection, bool &connection_closed) {
           return process_request(strm, remote_addr, remote_port, local_addr,
@@ -0,0 +1,39 @@
+#include "admin.h"
+
+#include <cstdlib>
+
+namespace {
+
+bool equal_constant_time(const std::string& a, const std::string& b) {
+  if (a.size() != b.size()) return false;
+  unsigned char diff = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+  }
+  return diff == 0;
+}
+
+} // namespace
+
+AdminAuth AdminAuth::from_env() {
+  AdminAuth auth;
+  if (const char* token = std::getenv("ADMIN_TOKEN")) auth.token_ = token;
+  return auth;
+}
+
+bool AdminAuth::check(const httplib::Request& req, httplib::Response& res) const {
+  if (!enabled()) {
+    res.status = 404;
+    return false;
+  }
+  const std::string prefix = "Bearer ";
+  const auto& header = req.get_header_value("Authorization");
+  if (header.compare(0, prefix.size(), prefix) != 0 ||
+      !equal_constant_time(header.substr(prefix.size()), token_)) {
+    res.status = 401;
+    res.set_header("WWW-Authenticate", "Bearer");
+    res.set_content("{\"error\":\"unauthorized\"}", "application/json");
+    return false;
+  }
+  return true;
+}
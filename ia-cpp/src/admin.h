@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "httplib.h"
+
+// Access control for the /admin and /debug endpoints.
+//
+// They are off unless ADMIN_TOKEN is set; requests must then carry
+// "Authorization: Bearer <token>". The token is compared in constant time.
+class AdminAuth {
+public:
+  static AdminAuth from_env();
+
+  bool enabled() const { return !token_.empty(); }
+
+  // True when the request may proceed; otherwise fills `res` (404 while
+  // disabled, so the endpoints are not advertised, 401 on a bad token)
+  bool check(const httplib::Request& req, httplib::Response& res) const;
+
+private:
+  std::string token_;
+};
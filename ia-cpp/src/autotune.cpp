@@ -0,0 +1,378 @@
+#include "autotune.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+
+#include "metrics.h"
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+// Set in the environment: the operator's value wins over the tuner's
+bool pinned(const char* name) {
+  const char* v = std::getenv(name);
+  return v && *v;
+}
+
+std::string cache_path(const AutotuneConfig& config, const std::string& key) {
+  return config.dir + "/autotune-" + key + ".json";
+}
+
+nlohmann::json params_json(const TunedParams& p) {
+  return {{"http_threads", p.http_threads},
+          {"ort_intra_threads", p.ort_intra_threads},
+          {"max_batch_size", p.max_batch_size},
+          {"batch_max_delay_us", p.batch_max_delay_us}};
+}
+
+nlohmann::json trial_json(const TuneTrial& t) {
+  return {{"stage", t.stage},
+          {"params", params_json(t.params)},
+          {"throughput_rps", t.throughput_rps},
+          {"p50_us", t.p50_us},
+          {"p99_us", t.p99_us},
+          {"meets_slo", t.meets_slo}};
+}
+
+bool better(const TuneTrial& a, const TuneTrial& b) {
+  if (a.meets_slo != b.meets_slo) return a.meets_slo;
+  if (a.meets_slo) return a.throughput_rps > b.throughput_rps;
+  return a.p99_us < b.p99_us;
+}
+
+// `clients` closed-loop clients, each issuing `request` back to back for
+// `duration`; the first fifth is warm-up and not measured
+TuneTrial measure(size_t clients, std::chrono::milliseconds duration, double slo_p99_us,
+                  const std::function<void(float)>& request) {
+  const auto start = steady::now();
+  const auto measured_from = start + duration / 5;
+  const auto end = start + duration;
+  std::vector<std::vector<double>> latencies(clients);
+  std::vector<std::thread> threads;
+  for (size_t c = 0; c < clients; c++) {
+    threads.emplace_back([&, c] {
+      std::minstd_rand rng(static_cast<unsigned>(c + 1));
+      std::uniform_real_distribution<float> input(-10.0f, 10.0f);
+      for (auto t0 = steady::now(); t0 < end; t0 = steady::now()) {
+        request(input(rng));
+        if (t0 >= measured_from) {
+          latencies[c].push_back(
+              std::chrono::duration<double, std::micro>(steady::now() - t0).count());
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  std::vector<double> all;
+  for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  TuneTrial trial;
+  if (all.empty()) {
+    trial.p50_us = trial.p99_us = std::numeric_limits<double>::infinity();
+    return trial;
+  }
+  std::sort(all.begin(), all.end());
+  double window = std::chrono::duration<double>(steady::now() - measured_from).count();
+  trial.throughput_rps = static_cast<double>(all.size()) / window;
+  trial.p50_us = all[all.size() / 2];
+  trial.p99_us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+  trial.meets_slo = trial.p99_us <= slo_p99_us;
+  return trial;
+}
+
+TuneTrial run_direct(const TuneTarget& target, const TunedParams& p,
+                     const AutotuneConfig& config) {
+  return measure(p.http_threads, config.trial, config.slo_p99_us, target.run_one);
+}
+
+TuneTrial run_batched(const TuneTarget& target, const TunedParams& p, size_t clients,
+                      const AutotuneConfig& config) {
+  metrics::Registry scratch;  // keep the trial out of ia_batcher_*
+  InferenceBatcher batcher(target.run_batch, p.max_batch_size, 0,
+                           std::chrono::microseconds(p.batch_max_delay_us),
+                           std::chrono::microseconds(0), -1, scratch);
+  return measure(clients, config.trial, config.slo_p99_us, [&batcher](float x) {
+    std::promise<void> done;
+    auto answered = done.get_future();
+    if (batcher.submit(x, [&done](InferenceBatcher::Result) { done.set_value(); })) {
+      answered.wait();
+    }
+  });
+}
+
+// Geometric steps from `lo` up to `hi`, plus `hi` and `current`
+template <typename T>
+std::vector<T> ladder(T lo, T hi, T factor, T current) {
+  std::vector<T> values;
+  for (T v = lo; v < hi; v *= factor) values.push_back(v);
+  values.push_back(hi);
+  values.push_back(current);
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return values;
+}
+
+void log_trial(const TuneTrial& t) {
+  std::cout << "[info] Autotune " << t.stage << ": http=" << t.params.http_threads
+            << " intra=" << t.params.ort_intra_threads
+            << " batch=" << t.params.max_batch_size
+            << " delay_us=" << t.params.batch_max_delay_us << " -> "
+            << static_cast<long>(t.throughput_rps) << " rps, p99 "
+            << static_cast<long>(t.p99_us) << " us" << (t.meets_slo ? "" : " (over SLO)")
+            << std::endl;
+}
+
+} // namespace
+
+AutotuneConfig AutotuneConfig::from_env() {
+  AutotuneConfig c;
+  c.enabled = env_long("AUTOTUNE", 0) != 0;
+  c.slo_p99_us = static_cast<double>(env_long("AUTOTUNE_P99_SLO_US", 10000));
+  c.trial = std::chrono::milliseconds(env_long("AUTOTUNE_TRIAL_MS", 500));
+  c.clients = static_cast<size_t>(env_long("AUTOTUNE_CLIENTS", 0));
+  if (const char* dir = std::getenv("AUTOTUNE_DIR"); dir && *dir) c.dir = dir;
+  return c;
+}
+
+TunedParams TunedParams::from_budget(const ResourceBudget& budget) {
+  TunedParams p;
+  p.http_threads = budget.http_threads;
+  p.ort_intra_threads = budget.ort_intra_threads;
+  p.max_batch_size = budget.max_batch_size;
+  p.batch_max_delay_us = budget.batch_max_delay_us;
+  return p;
+}
+
+nlohmann::json TuneReport::to_json() const {
+  auto all = nlohmann::json::array();
+  for (const auto& t : trials) all.push_back(trial_json(t));
+  return {{"best", params_json(best)},
+          {"direct", trial_json(direct)},
+          {"batched", trial_json(batched)},
+          {"slo_p99_us", slo_p99_us},
+          {"seconds", seconds},
+          {"trials", std::move(all)}};
+}
+
+std::string tuning_key(const void* model, size_t size, const ResourceBudget& budget) {
+  // FNV-style mix over 64-bit words in four lanes; not cryptographic, only
+  // needs to tell model versions apart
+  const auto* bytes = static_cast<const unsigned char*>(model);
+  uint64_t lanes[4] = {0xcbf29ce484222325ull ^ size, 0x84222325cbf29ce4ull,
+                       0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int l = 0; l < 4; l++) {
+      uint64_t w;
+      std::memcpy(&w, bytes + i + 8 * l, 8);
+      lanes[l] = (lanes[l] ^ w) * 0x100000001b3ull;
+    }
+  }
+  for (; i < size; i++) lanes[0] = (lanes[0] ^ bytes[i]) * 0x100000001b3ull;
+  uint64_t h = lanes[0];
+  for (int l = 1; l < 4; l++) h = (h ^ (lanes[l] >> 29) ^ lanes[l]) * 0x100000001b3ull;
+
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+  return std::string(hex) + "-" + std::to_string(budget.cpus) + "cpu-" +
+         std::to_string(budget.workers) + "w";
+}
+
+bool load_tuning(const AutotuneConfig& config, const std::string& key, TunedParams& out) {
+  std::ifstream in(cache_path(config, key));
+  if (!in) return false;
+  try {
+    auto doc = nlohmann::json::parse(in);
+    const auto& best = doc.at("best");
+    TunedParams p;
+    p.http_threads = best.at("http_threads").get<size_t>();
+    p.ort_intra_threads = best.at("ort_intra_threads").get<int>();
+    p.max_batch_size = best.at("max_batch_size").get<size_t>();
+    p.batch_max_delay_us = best.at("batch_max_delay_us").get<long>();
+    if (p.http_threads == 0 || p.ort_intra_threads <= 0 || p.max_batch_size == 0 ||
+        p.batch_max_delay_us < 0) {
+      throw std::runtime_error("out of range values");
+    }
+    out = p;
+  } catch (const std::exception& e) {
+    std::cerr << "[warn] Ignoring autotune result " << cache_path(config, key) << ": "
+              << e.what() << std::endl;
+    return false;
+  }
+  metrics::registry()
+      .gauge("ia_autotune_cached", "1 when the knobs came from a saved autotune result")
+      .set(1);
+  return true;
+}
+
+bool save_tuning(const AutotuneConfig& config, const std::string& key,
+                 const TuneReport& report) {
+  std::error_code ec;
+  std::filesystem::create_directories(config.dir, ec);
+  const std::string path = cache_path(config, key);
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    nlohmann::json doc = report.to_json();
+    doc["key"] = key;
+    out << doc.dump(2) << "\n";
+    if (!out) {
+      std::cerr << "[warn] Cannot write autotune result to " << tmp << std::endl;
+      return false;
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::cerr << "[warn] Cannot write autotune result to " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void apply_tuning(const TunedParams& p, ResourceBudget& budget) {
+  if (!pinned("HTTP_THREADS")) budget.http_threads = p.http_threads;
+  if (!pinned("ORT_INTRA_OP_THREADS")) budget.ort_intra_threads = p.ort_intra_threads;
+  if (!pinned("MAX_BATCH_SIZE")) budget.max_batch_size = p.max_batch_size;
+  if (!pinned("BATCH_MAX_DELAY_US")) budget.batch_max_delay_us = p.batch_max_delay_us;
+}
+
+TuneReport run_autotune(const AutotuneConfig& config, const ResourceBudget& budget,
+                        const TuneTargetFactory& factory) {
+  const auto t0 = steady::now();
+  TuneReport report;
+  report.slo_p99_us = config.slo_p99_us;
+  TunedParams current = TunedParams::from_budget(budget);
+  const int share = static_cast<int>(std::max(1u, budget.cpus / budget.workers));
+  const size_t clients = std::max(config.clients ? config.clients : budget.max_batch_size,
+                                  current.http_threads);
+  std::cout << "[info] Autotune: p99 SLO " << config.slo_p99_us << " us, "
+            << config.trial.count() << " ms per trial" << std::endl;
+
+  // Runs one trial per candidate and keeps the winner in `current`
+  auto stage = [&](const char* name, const std::vector<TunedParams>& candidates,
+                   const std::function<bool(const TunedParams&, TuneTrial&)>& run) {
+    TuneTrial best;
+    bool any = false;
+    for (const auto& p : candidates) {
+      TuneTrial trial;
+      if (!run(p, trial)) continue;
+      trial.stage = name;
+      trial.params = p;
+      log_trial(trial);
+      report.trials.push_back(trial);
+      if (!any || better(trial, best)) best = trial;
+      any = true;
+    }
+    if (any) current = best.params;
+    return best;
+  };
+
+  // 1. Intra-op threads: one session per candidate; the winner's stays for
+  // the rest of the sweep
+  TuneTarget target;
+  TuneTrial target_trial;
+  std::vector<TunedParams> candidates;
+  for (int n : pinned("ORT_INTRA_OP_THREADS")
+                   ? std::vector<int>{current.ort_intra_threads}
+                   : ladder(1, share, 2, current.ort_intra_threads)) {
+    TunedParams p = current;
+    p.ort_intra_threads = n;
+    candidates.push_back(p);
+  }
+  report.direct = stage("ort_intra_threads", candidates, [&](const TunedParams& p, TuneTrial& t) {
+    TuneTarget candidate = factory(p.ort_intra_threads);
+    if (!candidate.run_one || !candidate.run_batch) return false;
+    t = run_direct(candidate, p, config);
+    if (!target.run_one || better(t, target_trial)) {
+      target = std::move(candidate);
+      target_trial = t;
+    }
+    return true;
+  });
+  if (!target.run_one) {
+    std::cerr << "[warn] Autotune: no session could be built, nothing tuned" << std::endl;
+    report.best = TunedParams::from_budget(budget);
+    return report;
+  }
+
+  // 2. HTTP threads; at least 4, as in the derived budget, for keep-alive
+  // connections that sit idle between requests
+  candidates.clear();
+  for (size_t n : pinned("HTTP_THREADS")
+                      ? std::vector<size_t>{current.http_threads}
+                      : ladder<size_t>(4, std::min<size_t>(64, std::max(4, 8 * share)), 2,
+                                       current.http_threads)) {
+    TunedParams p = current;
+    p.http_threads = n;
+    candidates.push_back(p);
+  }
+  report.direct = stage("http_threads", candidates, [&](const TunedParams& p, TuneTrial& t) {
+    t = run_direct(target, p, config);
+    return true;
+  });
+
+  // 3. Batch size, up to the memory-derived cap when there is a limit
+  candidates.clear();
+  const size_t batch_cap = budget.memory_limit_bytes ? budget.max_batch_size : 256;
+  for (size_t n : pinned("MAX_BATCH_SIZE")
+                      ? std::vector<size_t>{current.max_batch_size}
+                      : ladder<size_t>(1, std::max(batch_cap, current.max_batch_size), 4,
+                                       current.max_batch_size)) {
+    TunedParams p = current;
+    p.max_batch_size = n;
+    candidates.push_back(p);
+  }
+  auto batched = [&](const TunedParams& p, TuneTrial& t) {
+    t = run_batched(target, p, clients, config);
+    return true;
+  };
+  report.batched = stage("max_batch_size", candidates, batched);
+
+  // 4. Batch wait
+  candidates.clear();
+  std::vector<long> delays{0, 100, 500, 2000, current.batch_max_delay_us};
+  std::sort(delays.begin(), delays.end());
+  delays.erase(std::unique(delays.begin(), delays.end()), delays.end());
+  if (pinned("BATCH_MAX_DELAY_US")) delays = {current.batch_max_delay_us};
+  for (long d : delays) {
+    TunedParams p = current;
+    p.batch_max_delay_us = d;
+    candidates.push_back(p);
+  }
+  report.batched = stage("batch_max_delay_us", candidates, batched);
+
+  report.best = current;
+  report.seconds = std::chrono::duration<double>(steady::now() - t0).count();
+
+  auto& reg = metrics::registry();
+  reg.gauge("ia_autotune_throughput_rps{path=\"direct\"}",
+            "Throughput of the chosen configuration in the last autotune sweep")
+      .set(report.direct.throughput_rps);
+  reg.gauge("ia_autotune_throughput_rps{path=\"batched\"}",
+            "Throughput of the chosen configuration in the last autotune sweep")
+      .set(report.batched.throughput_rps);
+  reg.gauge("ia_autotune_p99_seconds{path=\"direct\"}",
+            "p99 of the chosen configuration in the last autotune sweep")
+      .set(report.direct.p99_us / 1e6);
+  reg.gauge("ia_autotune_p99_seconds{path=\"batched\"}",
+            "p99 of the chosen configuration in the last autotune sweep")
+      .set(report.batched.p99_us / 1e6);
+  reg.gauge("ia_autotune_sweep_seconds", "Duration of the last autotune sweep")
+      .set(report.seconds);
+  reg.gauge("ia_autotune_cached", "1 when the knobs came from a saved autotune result")
+      .set(0);
+
+  std::cout << "[info] Autotune done in " << report.seconds << " s: "
+            << params_json(report.best).dump() << std::endl;
+  return report;
+}
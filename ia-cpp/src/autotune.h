@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "batcher.h"
+#include "resources.h"
+
+// Autotuning of the serving knobs under a p99 SLO.
+//
+// The derived budget (resources.h) is a guess from the core count; the best
+// split between HTTP threads and ORT intra-op threads, and the batch size
+// and wait of the batcher, depend on the model. The autotuner measures them
+// with synthetic closed-loop load against real sessions of the loaded model:
+//
+//   1. ort_intra_threads   /predict path: one client per HTTP thread, each
+//   2. http_threads        calling Run() on its own thread
+//   3. max_batch_size      batcher path (WebSocket, h2c, shared memory):
+//   4. batch_max_delay_us  AUTOTUNE_CLIENTS requests in flight (default: the
+//                          derived batch size) through an InferenceBatcher
+//
+// One knob at a time (coordinate descent), each stage starting from the
+// best so far, so a sweep is a dozen short trials rather than the full grid.
+// Within a stage the winner is the highest throughput whose p99 meets the
+// SLO, or the lowest p99 if none does. Knobs pinned in the environment
+// (HTTP_THREADS, ...) are not swept and never overridden.
+//
+// Results are kept as JSON in AUTOTUNE_DIR, keyed on a hash of the model
+// bytes, the usable cores and the worker count, and reused on later boots.
+struct AutotuneConfig {
+  bool enabled = false;                         // AUTOTUNE=1
+  double slo_p99_us = 10000;                    // AUTOTUNE_P99_SLO_US
+  std::chrono::milliseconds trial{500};         // AUTOTUNE_TRIAL_MS
+  size_t clients = 0;                           // AUTOTUNE_CLIENTS; 0 = max_batch_size
+  std::string dir = "/tmp/ia-cpp-autotune";     // AUTOTUNE_DIR
+
+  static AutotuneConfig from_env();
+};
+
+struct TunedParams {
+  size_t http_threads = 4;
+  int ort_intra_threads = 1;
+  size_t max_batch_size = 32;
+  long batch_max_delay_us = 0;
+
+  static TunedParams from_budget(const ResourceBudget& budget);
+};
+
+struct TuneTrial {
+  std::string stage;  // knob being swept
+  TunedParams params;
+  double throughput_rps = 0;
+  double p50_us = 0;
+  double p99_us = 0;
+  bool meets_slo = false;
+};
+
+struct TuneReport {
+  TunedParams best;
+  TuneTrial direct;   // best trial on the /predict path
+  TuneTrial batched;  // best trial on the batcher path
+  std::vector<TuneTrial> trials;
+  double slo_p99_us = 0;
+  double seconds = 0;
+
+  nlohmann::json to_json() const;
+};
+
+// What a sweep runs against: sessions built with a given intra-op count
+struct TuneTarget {
+  std::function<void(float x)> run_one;   // one Run() on the calling thread
+  InferenceBatcher::BatchFn run_batch;
+};
+// Empty functions when the session cannot be built
+using TuneTargetFactory = std::function<TuneTarget(int intra_threads)>;
+
+// "<model hash>-<cpus>cpu-<workers>w"
+std::string tuning_key(const void* model, size_t size, const ResourceBudget& budget);
+
+// Cached result for `key`, if any
+bool load_tuning(const AutotuneConfig& config, const std::string& key, TunedParams& out);
+bool save_tuning(const AutotuneConfig& config, const std::string& key,
+                 const TuneReport& report);
+
+// Copies the tuned knobs into the budget, except those pinned in the
+// environment
+void apply_tuning(const TunedParams& params, ResourceBudget& budget);
+
+// Runs the sweep (seconds to a minute, depending on AUTOTUNE_TRIAL_MS and
+// the core count) and exports ia_autotune_* gauges for the result
+TuneReport run_autotune(const AutotuneConfig& config, const ResourceBudget& budget,
+                        const TuneTargetFactory& factory);
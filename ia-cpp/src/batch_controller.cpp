@@ -0,0 +1,173 @@
+#include "batch_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "resources.h"
+
+namespace {
+
+constexpr auto kWindow = std::chrono::milliseconds(100);
+constexpr auto kMaxWindow = std::chrono::seconds(1);
+constexpr uint64_t kMinSamples = 32;
+
+size_t cost_bucket(size_t size) {
+  size_t b = 0;
+  while (size > 1 && b + 1 < 11) {
+    size >>= 1;
+    b++;
+  }
+  return b;
+}
+
+std::string bucket_label(size_t b) {
+  if (b == 0) return "1";
+  if (b == 10) return "1024+";
+  return std::to_string(size_t(1) << b) + "-" + std::to_string((size_t(2) << b) - 1);
+}
+
+} // namespace
+
+AdaptiveBatchConfig AdaptiveBatchConfig::from_env() {
+  AdaptiveBatchConfig c;
+  c.enabled = env_long("BATCH_ADAPTIVE", 0) != 0;
+  c.p99_target = std::chrono::microseconds(env_long("BATCH_P99_TARGET_US", 5000));
+  return c;
+}
+
+BatchController::BatchController(const AdaptiveBatchConfig& config,
+                                 metrics::Registry& registry)
+    : config_(config),
+      window_start_(std::chrono::steady_clock::now()),
+      max_batch_gauge_(registry.gauge("ia_batcher_adaptive_max_batch",
+                                      "Batch size limit chosen by the adaptive controller")),
+      wait_gauge_(registry.gauge("ia_batcher_adaptive_wait_seconds",
+                                 "Batch wait chosen by the adaptive controller")),
+      rate_gauge_(registry.gauge("ia_batcher_arrival_rate",
+                                 "Inputs per second arriving at the batcher (EWMA)")),
+      p99_gauge_(registry.gauge("ia_batcher_latency_p99_seconds",
+                                "p99 of queue plus run time in the last controller window")),
+      increases_(registry.counter("ia_batcher_adaptive_decisions_total{action=\"increase\"}",
+                                  "Batch size limit changes by the adaptive controller")),
+      decreases_(registry.counter("ia_batcher_adaptive_decisions_total{action=\"decrease\"}",
+                                  "Batch size limit changes by the adaptive controller")) {
+  for (size_t b = 0; b < kCostBuckets; b++) {
+    cost_gauges_[b] = &registry.gauge(
+        "ia_batcher_run_seconds{size=\"" + bucket_label(b) + "\"}",
+        "Run time of one batch by batch size (EWMA)");
+  }
+}
+
+size_t BatchController::max_batch(size_t ceiling) const {
+  return max_batch_ == 0 ? ceiling : std::min(max_batch_, ceiling);
+}
+
+std::chrono::microseconds BatchController::wait(std::chrono::microseconds ceiling) const {
+  if (ceiling.count() <= 0) ceiling = config_.p99_target / 2;
+  return std::min(ceiling, std::chrono::microseconds(static_cast<int64_t>(wait_us_)));
+}
+
+void BatchController::on_batch(size_t size, std::chrono::nanoseconds run, bool full) {
+  double us = std::chrono::duration<double, std::micro>(run).count();
+  double& cost = cost_us_[cost_bucket(size)];
+  cost = metrics::ewma(cost, us);
+  batches_++;
+  if (full) full_batches_++;
+}
+
+void BatchController::on_latency(std::chrono::nanoseconds latency) {
+  double us = std::chrono::duration<double, std::micro>(latency).count();
+  auto b = static_cast<size_t>(4 * std::log2(1 + us));
+  latency_[std::min(b, kLatencyBuckets - 1)]++;
+  samples_++;
+}
+
+double BatchController::run_cost_us(size_t size) const {
+  // Nearest measured bucket at or below `size`, scaled linearly (so an
+  // unmeasured size shows no batching benefit until it has run)
+  for (size_t b = cost_bucket(size) + 1; b-- > 0;) {
+    if (cost_us_[b] > 0) {
+      return cost_us_[b] * static_cast<double>(size) / static_cast<double>(size_t(1) << b);
+    }
+  }
+  return 0;
+}
+
+double BatchController::window_p99_us() const {
+  uint64_t rank = samples_ - samples_ / 100;  // samples at or below the p99
+  uint64_t seen = 0;
+  for (size_t b = 0; b < kLatencyBuckets; b++) {
+    seen += latency_[b];
+    if (seen >= rank) return std::exp2((b + 1) / 4.0) - 1;  // bucket's upper edge
+  }
+  return std::exp2(kLatencyBuckets / 4.0);
+}
+
+void BatchController::maybe_update(std::chrono::steady_clock::time_point now, size_t ceiling,
+                                   std::chrono::microseconds wait_ceiling) {
+  auto elapsed = now - window_start_;
+  if (elapsed < kWindow || (samples_ < kMinSamples && elapsed < kMaxWindow)) return;
+
+  double secs = std::chrono::duration<double>(elapsed).count();
+  double rate = static_cast<double>(arrivals_) / secs;
+  // An idle gap ends the window late: take its rate as it is
+  constexpr double a = metrics::kEwmaAlpha;
+  arrival_rate_ = elapsed >= kMaxWindow ? rate : (1 - a) * arrival_rate_ + a * rate;
+
+  const double target = static_cast<double>(config_.p99_target.count());
+  const double p99 = samples_ > 0 ? window_p99_us() : 0;
+  size_t limit = max_batch(ceiling);
+
+  // Most batches hit the limit: inputs are queueing behind it, and bigger
+  // batches are what raises throughput (shrinking them would only deepen
+  // the backlog)
+  const bool backlogged = batches_ > 0 && full_batches_ * 2 > batches_;
+  const double batch_us = run_cost_us(limit);
+  auto increase = [&] {
+    if (limit >= ceiling) return;
+    limit = std::min(ceiling, limit + std::max<size_t>(1, ceiling / 16));
+    increases_.inc();
+  };
+
+  if (p99 > target) {
+    // No waiting while over the target
+    wait_us_ = 0;
+    if (backlogged) {
+      increase();
+    } else if (batch_us > target / 2 && limit > 1) {
+      // Not a backlog: one batch's own run time is eating the budget, and
+      // inputs that arrive meanwhile wait for it. Multiplicative decrease.
+      limit = std::max<size_t>(1, limit / 2);
+      decreases_.inc();
+    }
+  } else {
+    if (backlogged && p99 < 0.8 * target) increase();
+    // Wait only when Run() is busy and bigger batches are cheaper per input
+    double single_us = run_cost_us(1);
+    double full_us = run_cost_us(limit);
+    double utilization = arrival_rate_ * single_us / 1e6;
+    bool cheaper = limit > 1 && full_us / static_cast<double>(limit) < 0.8 * single_us;
+    if (utilization >= 0.5 && cheaper && arrival_rate_ > 0) {
+      double fill_us = static_cast<double>(limit - 1) / arrival_rate_ * 1e6;
+      double headroom_us = target / 2 - full_us;
+      wait_us_ = std::max(0.0, std::min(fill_us, headroom_us));
+    } else {
+      wait_us_ = 0;
+    }
+  }
+  max_batch_ = limit;
+
+  max_batch_gauge_.set(static_cast<double>(limit));
+  wait_gauge_.set(static_cast<double>(wait(wait_ceiling).count()) / 1e6);
+  rate_gauge_.set(arrival_rate_);
+  p99_gauge_.set(p99 / 1e6);
+  for (size_t b = 0; b < kCostBuckets; b++) cost_gauges_[b]->set(cost_us_[b] / 1e6);
+
+  window_start_ = now;
+  arrivals_ = 0;
+  batches_ = 0;
+  full_batches_ = 0;
+  samples_ = 0;
+  latency_.fill(0);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "metrics.h"
+
+// Adaptive batch limits for the InferenceBatcher (BATCH_ADAPTIVE=1).
+//
+// A fixed wait adds latency for nothing at low load and leaves batches too
+// small at high load. The controller retunes both limits from what the
+// batcher observes, every 100 ms (or once enough inputs went through):
+//
+//   max batch  AIMD on the p99 of queue + run time in the last window.
+//              Grown by a step while most batches are full (inputs queue
+//              behind the limit, and bigger batches are what adds
+//              throughput), unless p99 is between 80% and 100% of
+//              BATCH_P99_TARGET_US. Halved when p99 is over the target
+//              without a backlog and a full batch alone takes more than
+//              half of it.
+//   wait       model-based: only when the arrival rate keeps Run() busy
+//              (utilization >= 50% at batch size 1) and the measured cost
+//              per input drops with the batch size; then the time it takes
+//              for a full batch to arrive, within half the target minus
+//              the batch's own run time. Otherwise 0 (greedy).
+//
+// The batcher's own limits (MAX_BATCH_SIZE, BATCH_MAX_DELAY_US, autotune)
+// become the ceilings; without a delay ceiling the wait is capped at half
+// the target. Only the batcher thread calls into the controller.
+struct AdaptiveBatchConfig {
+  bool enabled = false;                        // BATCH_ADAPTIVE=1
+  std::chrono::microseconds p99_target{5000};  // BATCH_P99_TARGET_US
+
+  static AdaptiveBatchConfig from_env();
+};
+
+class BatchController {
+public:
+  BatchController(const AdaptiveBatchConfig& config, metrics::Registry& registry);
+
+  // Limits for the next batch, within the ceilings (a zero wait ceiling
+  // means half the p99 target)
+  size_t max_batch(size_t ceiling) const;
+  std::chrono::microseconds wait(std::chrono::microseconds ceiling) const;
+
+  // Inputs queued since the last call
+  void on_arrivals(size_t n) { arrivals_ += n; }
+
+  // One batch ran: its size, the fn() time, and whether it hit the limit
+  void on_batch(size_t size, std::chrono::nanoseconds run, bool full);
+  // Time one input spent queued plus running
+  void on_latency(std::chrono::nanoseconds latency);
+
+  // Retunes once the window is long enough; `ceiling` as for max_batch()
+  void maybe_update(std::chrono::steady_clock::time_point now, size_t ceiling,
+                    std::chrono::microseconds wait_ceiling);
+
+private:
+  static constexpr size_t kCostBuckets = 11;     // batch sizes 1, 2-3, ..., 1024+
+  static constexpr size_t kLatencyBuckets = 96;  // quarter octaves of 1 us
+
+  double run_cost_us(size_t size) const;
+  double window_p99_us() const;
+
+  const AdaptiveBatchConfig config_;
+
+  // Decisions
+  size_t max_batch_ = 0;  // 0 = not started, use the ceiling
+  double wait_us_ = 0;
+
+  // Window
+  std::chrono::steady_clock::time_point window_start_;
+  size_t arrivals_ = 0;
+  size_t batches_ = 0;
+  size_t full_batches_ = 0;
+  uint64_t samples_ = 0;
+  std::array<uint64_t, kLatencyBuckets> latency_{};
+
+  // Across windows (EWMA)
+  double arrival_rate_ = 0;  // inputs per second
+  std::array<double, kCostBuckets> cost_us_{};
+
+  metrics::Gauge& max_batch_gauge_;
+  metrics::Gauge& wait_gauge_;
+  metrics::Gauge& rate_gauge_;
+  metrics::Gauge& p99_gauge_;
+  metrics::Counter& increases_;
+  metrics::Counter& decreases_;
+  std::array<metrics::Gauge*, kCostBuckets> cost_gauges_{};
+};
@@ -0,0 +1,191 @@
+#include "batcher.h"
+
+#include "busy_poll.h"
+
+#include <iostream>
+#include <memory>
+
+InferenceBatcher::InferenceBatcher(BatchFn fn, size_t max_batch,
+                                   size_t max_queued,
+                                   std::chrono::microseconds max_delay,
+                                   std::chrono::microseconds spin, int cpu,
+                                   metrics::Registry& registry)
+    : fn_(std::move(fn)),
+      max_batch_(max_batch > 0 ? max_batch : 1),
+      max_queued_(max_queued),
+      max_delay_us_(max_delay.count()),
+      spin_(spin),
+      registry_(registry),
+      batches_(registry.counter("ia_batcher_batches_total",
+                                           "Batches run by the inference batcher")),
+      items_(registry.counter("ia_batcher_items_total",
+                                         "Inputs run by the inference batcher")),
+      rejected_(registry.counter(
+          "ia_batcher_rejected_total", "Inputs rejected because the queue was full")),
+      queue_depth_(registry.gauge(
+          "ia_batcher_queue_depth", "Inputs waiting for the inference batcher")),
+      parks_(registry.counter(
+          "ia_busy_poll_parks_total{stage=\"batcher\"}",
+          "Times a spinning thread ran out of its spin window and slept")) {
+  worker_ = std::thread([this, cpu] {
+    if (cpu >= 0) pin_current_thread(cpu);
+    run();
+  });
+}
+
+InferenceBatcher::~InferenceBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  worker_.join();
+}
+
+void InferenceBatcher::set_limits(size_t max_batch,
+                                  std::chrono::microseconds max_delay) {
+  max_batch_.store(max_batch > 0 ? max_batch : 1, std::memory_order_relaxed);
+  max_delay_us_.store(max_delay.count(), std::memory_order_relaxed);
+}
+
+bool InferenceBatcher::submit(float x, Callback done) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || (max_queued_ > 0 && queue_.size() >= max_queued_)) {
+      rejected_.inc();
+      return false;
+    }
+    queue_.push_back(Item{x, std::move(done), std::chrono::steady_clock::now()});
+    arrivals_++;
+    queued_.store(queue_.size(), std::memory_order_release);
+    queue_depth_.set(static_cast<double>(queue_.size()));
+  }
+  cond_.notify_one();
+  return true;
+}
+
+bool InferenceBatcher::submit_group(const std::vector<float>& xs,
+                                    GroupCallback done) {
+  if (xs.empty()) return false;
+
+  // Results are only written on the batcher thread, so no locking needed
+  struct Group {
+    std::vector<Result> results;
+    size_t remaining;
+    GroupCallback done;
+  };
+  auto group = std::make_shared<Group>();
+  group->results.resize(xs.size());
+  group->remaining = xs.size();
+  group->done = std::move(done);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || (max_queued_ > 0 && queue_.size() + xs.size() > max_queued_)) {
+      rejected_.inc(xs.size());
+      return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < xs.size(); i++) {
+      queue_.push_back(Item{xs[i], [group, i](Result result) {
+                              group->results[i] = std::move(result);
+                              if (--group->remaining == 0) {
+                                group->done(std::move(group->results));
+                              }
+                            },
+                            now});
+    }
+    arrivals_ += xs.size();
+    queued_.store(queue_.size(), std::memory_order_release);
+    queue_depth_.set(static_cast<double>(queue_.size()));
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void InferenceBatcher::enable_adaptive(const AdaptiveBatchConfig& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!controller_) controller_ = std::make_unique<BatchController>(config, registry_);
+}
+
+void InferenceBatcher::run() {
+  std::vector<Item> batch;
+  std::vector<float> xs;
+  std::vector<Result> out;
+  batch.reserve(max_batch());
+  BatchController* controller = nullptr;
+  size_t ceiling = 0;
+  std::chrono::microseconds wait_ceiling{0};
+  bool full = false;
+
+  for (;;) {
+    if (spin_.count() > 0) {
+      auto until = std::chrono::steady_clock::now() + spin_;
+      unsigned n = 0;
+      while (queued_.load(std::memory_order_acquire) == 0 &&
+             !stop_.load(std::memory_order_relaxed)) {
+        cpu_relax();
+        if (++n % 64 == 0 && std::chrono::steady_clock::now() >= until) break;
+      }
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (spin_.count() > 0 && queue_.empty() && !stop_) parks_.inc();
+      cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // stopping and drained
+
+      // Adaptive mode: the controller's limits, under ours
+      controller = controller_.get();
+      size_t max_batch = this->max_batch();
+      auto max_delay = this->max_delay();
+      if (controller) {
+        controller->on_arrivals(arrivals_);
+        arrivals_ = 0;
+        wait_ceiling = max_delay;
+        ceiling = max_batch;
+        max_batch = controller->max_batch(ceiling);
+        max_delay = controller->wait(wait_ceiling);
+      }
+      if (max_delay.count() > 0 && queue_.size() < max_batch) {
+        auto deadline = std::chrono::steady_clock::now() + max_delay;
+        cond_.wait_until(lock, deadline, [this, max_batch] {
+          return stop_ || queue_.size() >= max_batch;
+        });
+      }
+
+      while (!queue_.empty() && batch.size() < max_batch) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      full = batch.size() >= max_batch;
+      queued_.store(queue_.size(), std::memory_order_release);
+      queue_depth_.set(static_cast<double>(queue_.size()));
+    }
+
+    xs.clear();
+    out.clear();
+    for (const auto& item : batch) xs.push_back(item.x);
+    const auto started = std::chrono::steady_clock::now();
+    try {
+      fn_(xs, out);
+    } catch (const std::exception& e) {
+      std::cerr << "[warn] Batch inference failed: " << e.what() << std::endl;
+    }
+    out.resize(batch.size(), Result{{"error", "Internal server error"}});
+
+    if (controller) {
+      const auto finished = std::chrono::steady_clock::now();
+      controller->on_batch(batch.size(), finished - started, full);
+      for (const auto& item : batch) controller->on_latency(finished - item.queued_at);
+      controller->maybe_update(finished, ceiling, wait_ceiling);
+    }
+
+    batches_.inc();
+    items_.inc(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i].done(std::move(out[i]));
+    }
+    batch.clear();
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "batch_controller.h"
+#include "metrics.h"
+
+// Inference batching stage shared by the multiplexed frontends.
+//
+// Callers submit one input at a time with a completion callback; a single
+// worker drains the queue into batches of up to `max_batch` inputs and runs
+// them through the batch function in one go. Batching is greedy: the worker
+// takes whatever is queued when it wakes up, and only lingers for more inputs
+// when `max_delay` is non-zero, so an idle service adds no latency while a
+// busy one naturally forms larger batches.
+//
+// With a non-zero `spin` (busy-poll mode) the idle worker spins that long on
+// the queue before it sleeps on the condition variable, so an input that
+// arrives meanwhile is picked up without a wakeup; `cpu` pins the worker.
+//
+// The batch limits can be changed while running (set_limits), and a private
+// `registry` keeps a batcher's counters out of /metrics (autotune trials).
+// With enable_adaptive() those limits become ceilings and a BatchController
+// picks the batch size and wait below them from live latency feedback.
+class InferenceBatcher {
+public:
+  using Result = nlohmann::json;
+  // Fills `out` with one result per input, in order
+  using BatchFn =
+      std::function<void(const std::vector<float>& xs, std::vector<Result>& out)>;
+  // Runs on the batcher thread; must not block
+  using Callback = std::function<void(Result result)>;
+  using GroupCallback = std::function<void(std::vector<Result> results)>;
+
+  InferenceBatcher(BatchFn fn, size_t max_batch, size_t max_queued,
+                   std::chrono::microseconds max_delay,
+                   std::chrono::microseconds spin = std::chrono::microseconds(0),
+                   int cpu = -1, metrics::Registry& registry = metrics::registry());
+  ~InferenceBatcher();
+
+  InferenceBatcher(const InferenceBatcher&) = delete;
+  InferenceBatcher& operator=(const InferenceBatcher&) = delete;
+
+  // False (and `done` is not called) when the queue is full
+  bool submit(float x, Callback done);
+
+  // Queues several inputs back to back, so they land in the same batch when
+  // they fit; `done` gets all results, in input order, once the last one is
+  // ready. Same failure semantics as submit().
+  bool submit_group(const std::vector<float>& xs, GroupCallback done);
+
+  size_t max_batch() const { return max_batch_.load(std::memory_order_relaxed); }
+  std::chrono::microseconds max_delay() const {
+    return std::chrono::microseconds(max_delay_us_.load(std::memory_order_relaxed));
+  }
+
+  // Takes effect from the next batch
+  void set_limits(size_t max_batch, std::chrono::microseconds max_delay);
+
+  // Hands the limits to a BatchController; call before submitting
+  void enable_adaptive(const AdaptiveBatchConfig& config);
+
+private:
+  struct Item {
+    float x;
+    Callback done;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+
+  void run();
+
+  BatchFn fn_;
+  std::atomic<size_t> max_batch_;
+  const size_t max_queued_;
+  std::atomic<int64_t> max_delay_us_;
+  const std::chrono::microseconds spin_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<Item> queue_;
+  std::atomic<size_t> queued_{0};  // queue_.size(), readable without the lock
+  std::atomic<bool> stop_{false};
+  std::thread worker_;
+
+  // Adaptive mode; only the worker uses the controller, and arrivals_ is
+  // guarded by mutex_
+  std::unique_ptr<BatchController> controller_;
+  size_t arrivals_ = 0;
+  metrics::Registry& registry_;
+
+  metrics::Counter& batches_;
+  metrics::Counter& items_;
+  metrics::Counter& rejected_;
+  metrics::Gauge& queue_depth_;
+  metrics::Counter& parks_;
+};
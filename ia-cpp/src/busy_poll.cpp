@@ -0,0 +1,230 @@
+#include "busy_poll.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  // Linux 5.11
+#endif
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+// "2-5,8" -> {2, 3, 4, 5, 8}; empty on a malformed list
+std::vector<int> parse_cpu_list(const std::string& list) {
+  std::vector<int> cpus;
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    char* end = nullptr;
+    long first = std::strtol(item.c_str(), &end, 10);
+    long last = first;
+    if (end && *end == '-') last = std::strtol(end + 1, &end, 10);
+    if (item.empty() || !end || *end != '\0' || first < 0 || last < first ||
+        last >= CPU_SETSIZE) {
+      return {};
+    }
+    for (long c = first; c <= last; c++) cpus.push_back(static_cast<int>(c));
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::vector<int> affinity_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &set)) cpus.push_back(c);
+    }
+  }
+  return cpus;
+}
+
+// Compact form of a sorted core list: {2, 3, 4, 8} -> "2-4,8"
+std::string format_cpu_list(const std::vector<int>& cpus) {
+  std::string out;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+    if (!out.empty()) out += ',';
+    out += std::to_string(cpus[i]);
+    if (j > i) out += '-' + std::to_string(cpus[j]);
+    i = j + 1;
+  }
+  return out;
+}
+
+} // namespace
+
+BusyPollConfig BusyPollConfig::from_env() {
+  BusyPollConfig c;
+  c.enabled = env_long("BUSY_POLL", 0) != 0;
+  if (!c.enabled) return c;
+
+  const char* list = std::getenv("BUSY_POLL_CPUS");
+  if (list && *list) {
+    c.cpus = parse_cpu_list(list);
+    if (c.cpus.empty()) {
+      std::cerr << "[warn] Ignoring malformed BUSY_POLL_CPUS '" << list << "'"
+                << std::endl;
+    }
+  }
+  if (c.cpus.empty()) c.cpus = affinity_cpus();
+
+  c.spin = std::chrono::microseconds(
+      env_long("BUSY_POLL_SPIN_US", static_cast<long>(c.spin.count())));
+  c.socket_busy_poll_us = static_cast<int>(
+      env_long("BUSY_POLL_SOCKET_US", c.socket_busy_poll_us));
+  return c;
+}
+
+BusyPollConfig BusyPollConfig::for_worker(int worker, unsigned workers) const {
+  BusyPollConfig c = *this;
+  if (cpus.empty() || workers <= 1) return c;
+
+  // More workers than cores: each gets one, shared round-robin
+  size_t share = std::max<size_t>(1, cpus.size() / workers);
+  size_t first = (static_cast<size_t>(worker) * share) % cpus.size();
+  c.cpus.assign(cpus.begin() + first,
+                cpus.begin() + std::min(cpus.size(), first + share));
+  return c;
+}
+
+int BusyPollConfig::cpu(size_t index) const {
+  if (cpus.empty()) return -1;
+  return cpus[index % cpus.size()];
+}
+
+std::string BusyPollConfig::describe() const {
+  std::string out = "cpus=" + (cpus.empty() ? "any" : format_cpu_list(cpus));
+  out += " spin=" + std::to_string(spin.count()) + "us";
+  out += " so_busy_poll=" + std::to_string(socket_busy_poll_us) + "us";
+  return out;
+}
+
+void apply_busy_poll(const BusyPollConfig& config, ResourceBudget& budget) {
+  if (!config.enabled) return;
+
+  if (env_long("ORT_INTRA_OP_THREADS", 0) == 0) {
+    budget.ort_intra_threads = 1;
+  }
+
+  size_t cores = config.cpus.empty() ? budget.cpus : config.cpus.size();
+  size_t spinning = budget.http_threads + 1 +
+                    static_cast<size_t>(budget.ort_intra_threads - 1);
+  if (spinning > cores) {
+    std::cout << "[info] Busy-poll mode: " << spinning
+              << " spinning threads share " << cores
+              << " cores; HTTP_THREADS=" << std::max<size_t>(1, cores - 1)
+              << " gives each its own core if clients keep at most that "
+                 "many connections open" << std::endl;
+  }
+}
+
+bool pin_current_thread(int cpu) {
+  if (cpu < 0) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0) {
+    std::cerr << "[warn] Cannot pin thread to core " << cpu << ": "
+              << std::strerror(rc) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool set_socket_busy_poll(int sock, int usec) {
+  if (usec <= 0) return true;
+  if (::setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+    return false;
+  }
+  // Keeps the NIC queue in polling mode while we busy-poll (needs
+  // napi_defer_hard_irqs on the device to have an effect)
+  int on = 1;
+  ::setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+  return true;
+}
+
+SpinThreadPool::SpinThreadPool(size_t threads, size_t max_queued,
+                               const BusyPollConfig& config)
+    : max_queued_(max_queued),
+      spin_(config.spin),
+      parks_(metrics::registry().counter(
+          "ia_busy_poll_parks_total{stage=\"http\"}",
+          "Times a spinning thread ran out of its spin window and slept")) {
+  for (size_t i = 0; i < threads; i++) {
+    int cpu = config.cpu(i);
+    threads_.emplace_back([this, cpu] { run(cpu); });
+  }
+}
+
+bool SpinThreadPool::enqueue(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_queued_ > 0 && jobs_.size() >= max_queued_) return false;
+    jobs_.push_back(std::move(fn));
+    pending_.store(jobs_.size(), std::memory_order_release);
+  }
+  // Only a syscall when some worker is parked
+  cond_.notify_one();
+  return true;
+}
+
+void SpinThreadPool::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cond_.notify_all();
+  for (auto& t : threads_) t.join();
+}
+
+void SpinThreadPool::run(int cpu) {
+  pin_current_thread(cpu);
+
+  for (;;) {
+    if (spin_.count() > 0) {
+      auto until = steady::now() + spin_;
+      unsigned n = 0;
+      while (pending_.load(std::memory_order_acquire) == 0 &&
+             !shutdown_.load(std::memory_order_relaxed)) {
+        cpu_relax();
+        // Reading the clock costs more than a pause
+        if (++n % 64 == 0 && steady::now() >= until) break;
+      }
+    }
+
+    std::function<void()> fn;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (jobs_.empty() && !shutdown_) {
+        parks_.inc();
+        cond_.wait(lock, [this] { return !jobs_.empty() || shutdown_; });
+      }
+      if (jobs_.empty()) break;  // shutting down and drained
+      fn = std::move(jobs_.front());
+      jobs_.pop_front();
+      pending_.store(jobs_.size(), std::memory_order_release);
+    }
+    fn();
+  }
+
+#if defined(CPPHTTPLIB_OPENSSL_SUPPORT) && !defined(OPENSSL_IS_BORINGSSL) && \
+    !defined(LIBRESSL_VERSION_NUMBER)
+  OPENSSL_thread_stop();
+#endif
+}
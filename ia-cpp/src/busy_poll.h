@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+#include "metrics.h"
+#include "resources.h"
+
+// Busy-poll low-latency mode (BUSY_POLL=1) for dedicated hosts.
+//
+// With the default pool a request goes through several sleeping threads:
+// the accept thread hands the socket to a worker parked on a condition
+// variable, the worker sleeps in poll() between keep-alive requests and the
+// batcher sleeps until something is queued. Every wakeup is a trip through
+// the scheduler, tens of µs and more when the core has gone idle. In this
+// mode those threads spin for a while before parking, each pinned to a core
+// of its own, and sockets get SO_BUSY_POLL so a read polls the NIC queue
+// instead of waiting for the interrupt.
+//
+// The price is CPU: a spinning thread keeps its core at 100% for `spin`
+// after each piece of work, so under steady traffic the pinned cores never
+// idle. Meant for hosts (or isolcpus/cpuset partitions) given to the service.
+struct BusyPollConfig {
+  bool enabled = false;
+  std::vector<int> cpus;                // cores for spinning threads; empty = not pinned
+  std::chrono::microseconds spin{200};  // how long an idle thread spins before parking
+  int socket_busy_poll_us = 50;         // SO_BUSY_POLL; 0 = not set
+
+  // BUSY_POLL, BUSY_POLL_CPUS ("2-5,8"; default: the affinity mask),
+  // BUSY_POLL_SPIN_US and BUSY_POLL_SOCKET_US
+  static BusyPollConfig from_env();
+
+  // The cores of one prefork worker: `cpus` split evenly between workers
+  BusyPollConfig for_worker(int worker, unsigned workers) const;
+
+  // Core for the index-th spinning thread of the process, wrapping around
+  // when there are more threads than cores; -1 when not pinned. HTTP pool
+  // threads come first, then the batcher, then ORT's intra-op threads.
+  int cpu(size_t index) const;
+
+  std::string describe() const;
+};
+
+// Busy mode runs a single ORT intra-op thread unless ORT_INTRA_OP_THREADS is
+// set: inference stays on the calling thread, with no hand-off to a pool.
+// The HTTP pool keeps its size, since each keep-alive connection holds a
+// thread; logs how the spinning threads map onto the cores.
+void apply_busy_poll(const BusyPollConfig& config, ResourceBudget& budget);
+
+bool pin_current_thread(int cpu);
+
+// SO_BUSY_POLL and SO_PREFER_BUSY_POLL; accepted sockets inherit them from
+// the listener. Raising SO_BUSY_POLL needs CAP_NET_ADMIN.
+bool set_socket_busy_poll(int sock, int usec);
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// httplib task queue for busy mode. Same contract as httplib::ThreadPool,
+// but an idle worker spins on the job count for `spin` before it parks on
+// the condition variable, so a connection accepted while it spins is picked
+// up without a wakeup. Worker i is pinned to config.cpu(i).
+class SpinThreadPool final : public httplib::TaskQueue {
+public:
+  SpinThreadPool(size_t threads, size_t max_queued, const BusyPollConfig& config);
+  ~SpinThreadPool() override = default;
+
+  SpinThreadPool(const SpinThreadPool&) = delete;
+  SpinThreadPool& operator=(const SpinThreadPool&) = delete;
+
+  bool enqueue(std::function<void()> fn) override;
+  void shutdown() override;
+
+private:
+  void run(int cpu);
+
+  const size_t max_queued_;
+  const std::chrono::microseconds spin_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()>> jobs_;
+  std::atomic<size_t> pending_{0};  // jobs_.size(), readable without the lock
+  std::atomic<bool> shutdown_{false};
+  std::vector<std::thread> threads_;
+
+  metrics::Counter& parks_;
+};
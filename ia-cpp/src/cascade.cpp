@@ -0,0 +1,160 @@
+#include "cascade.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+bool parse_float(const std::string& s, float& out) {
+  char* end = nullptr;
+  out = std::strtof(s.c_str(), &end);
+  return !s.empty() && *end == '\0' && std::isfinite(out);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+bool CascadeRule::escalate(float y, float uncertainty) const {
+  if (std::isnan(y)) return true;
+  switch (kind) {
+    case Kind::band:        return y >= lo && y <= hi;
+    case Kind::outside:     return y < lo || y > hi;
+    case Kind::uncertainty: return !(uncertainty <= hi);  // NaN escalates too
+  }
+  return true;
+}
+
+std::string CascadeRule::describe() const {
+  std::ostringstream out;
+  switch (kind) {
+    case Kind::band:        out << "band:" << lo << ":" << hi; break;
+    case Kind::outside:     out << "outside:" << lo << ":" << hi; break;
+    case Kind::uncertainty: out << "uncertainty:" << hi; break;
+  }
+  return out.str();
+}
+
+bool CascadeRule::parse(const std::string& spec, CascadeRule& out, std::string& error) {
+  std::vector<std::string> parts;
+  std::stringstream in(spec);
+  std::string part;
+  while (std::getline(in, part, ':')) parts.push_back(part);
+
+  CascadeRule rule;
+  if (parts.size() == 3 && (parts[0] == "band" || parts[0] == "outside")) {
+    rule.kind = parts[0] == "band" ? Kind::band : Kind::outside;
+    if (!parse_float(parts[1], rule.lo) || !parse_float(parts[2], rule.hi) ||
+        rule.lo > rule.hi) {
+      error = "expected " + parts[0] + ":LO:HI with LO <= HI";
+      return false;
+    }
+  } else if (parts.size() == 2 && parts[0] == "uncertainty") {
+    rule.kind = Kind::uncertainty;
+    if (!parse_float(parts[1], rule.hi)) {
+      error = "expected uncertainty:THRESHOLD";
+      return false;
+    }
+  } else {
+    error = "expected band:LO:HI, outside:LO:HI or uncertainty:THRESHOLD";
+    return false;
+  }
+  out = rule;
+  return true;
+}
+
+CascadeConfig CascadeConfig::from_env() {
+  CascadeConfig c;
+  const char* fast = std::getenv("CASCADE_FAST_MODEL");
+  if (!fast || !*fast) return c;
+
+  const char* spec = std::getenv("CASCADE_RULE");
+  std::string error = "not set";
+  if (!spec || !CascadeRule::parse(spec, c.rule, error)) {
+    std::cerr << "[warn] CASCADE_RULE " << error << ", cascade disabled" << std::endl;
+    return c;
+  }
+  c.fast_model = fast;
+  return c;
+}
+
+Cascade::Cascade(const CascadeConfig& config, FastFn fast, FullFn full,
+                 metrics::Registry& registry)
+    : rule_(config.rule),
+      fast_(std::move(fast)),
+      full_(std::move(full)),
+      inputs_(registry.counter("ia_cascade_inputs_total", "Inputs through the model cascade")),
+      escalations_(registry.counter("ia_cascade_escalations_total",
+                                    "Cascade inputs escalated to the full model")),
+      fast_failures_(registry.counter("ia_cascade_fast_failures_total",
+                                      "Cascade runs where the cheap model failed (all escalated)")),
+      full_failures_(registry.counter("ia_cascade_full_failures_total",
+                                      "Cascade runs where the full model failed (escalated inputs failed)")),
+      ratio_gauge_(registry.gauge("ia_cascade_escalation_ratio",
+                                  "Share of the last 1024 cascade inputs that were escalated")),
+      fast_gauge_(registry.gauge("ia_cascade_stage_run_seconds{stage=\"fast\"}",
+                                 "Run time of one cascade stage (EWMA)")),
+      full_gauge_(registry.gauge("ia_cascade_stage_run_seconds{stage=\"full\"}",
+                                 "Run time of one cascade stage (EWMA)")) {}
+
+void Cascade::count(size_t n, size_t escalated) {
+  inputs_.inc(n);
+  escalations_.inc(escalated);
+  std::lock_guard<std::mutex> lock(window_mutex_);
+  window_inputs_ += n;
+  window_escalated_ += escalated;
+  if (window_inputs_ >= kWindow) {
+    ratio_gauge_.set(static_cast<double>(window_escalated_) /
+                     static_cast<double>(window_inputs_));
+    window_inputs_ = 0;
+    window_escalated_ = 0;
+  }
+}
+
+bool Cascade::run(const float* xs, size_t n, float* ys, Outcome* outcome) {
+  thread_local std::vector<float> us;
+  thread_local std::vector<float> hard_xs;
+  thread_local std::vector<float> hard_ys;
+  thread_local std::vector<size_t> hard_index;
+
+  auto t0 = std::chrono::steady_clock::now();
+  float* u = nullptr;
+  if (rule_.needs_uncertainty()) {
+    us.resize(n);
+    u = us.data();
+  }
+  bool fast_ok = fast_(xs, n, ys, u);
+  fast_gauge_.ewma(seconds_since(t0));
+  if (!fast_ok) fast_failures_.inc();
+
+  hard_xs.clear();
+  hard_index.clear();
+  for (size_t i = 0; i < n; i++) {
+    const bool escalate = !fast_ok || rule_.escalate(ys[i], u ? u[i] : 0.0f);
+    outcome[i] = escalate ? Outcome::full : Outcome::fast;
+    if (escalate) {
+      hard_xs.push_back(xs[i]);
+      hard_index.push_back(i);
+    }
+  }
+  count(n, hard_xs.size());
+  if (hard_xs.empty()) return true;
+
+  t0 = std::chrono::steady_clock::now();
+  hard_ys.resize(hard_xs.size());
+  if (!full_(hard_xs.data(), hard_xs.size(), hard_ys.data())) {
+    // The inputs the cheap model answered still stand
+    full_failures_.inc();
+    for (size_t i : hard_index) outcome[i] = Outcome::failed;
+    return false;
+  }
+  full_gauge_.ewma(seconds_since(t0));
+  for (size_t j = 0; j < hard_index.size(); j++) ys[hard_index[j]] = hard_ys[j];
+  return true;
+}
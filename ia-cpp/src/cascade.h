@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "metrics.h"
+
+// Model cascade (CASCADE_FAST_MODEL).
+//
+// Every input runs through a cheap model first; only the inputs the rule
+// flags as uncertain go on to the full model (MODEL_PATH, or the ensemble),
+// whose answer replaces the cheap one. Easy inputs cost one cheap Run(), and
+// escalated inputs get exactly the answer the full model alone would give.
+//
+// CASCADE_RULE, on the cheap model's output y:
+//
+//   band:LO:HI      escalate when LO <= y <= HI (a score near the decision
+//                   threshold, e.g. band:0.3:0.7 for a probability)
+//   outside:LO:HI   escalate when y < LO or y > HI (outside the range the
+//                   cheap model is trusted on)
+//   uncertainty:T   escalate when the cheap model's second output (its own
+//                   uncertainty estimate) is above T
+//
+// A NaN output always escalates, and so does the whole batch when the cheap
+// model fails. Over a batch, the escalated inputs go to the full model
+// together in one run; if that run fails, only those inputs fail.
+struct CascadeRule {
+  enum class Kind { band, outside, uncertainty };
+
+  Kind kind = Kind::band;
+  float lo = 0;
+  float hi = 0;  // uncertainty: the threshold
+
+  bool needs_uncertainty() const { return kind == Kind::uncertainty; }
+  bool escalate(float y, float uncertainty) const;
+  std::string describe() const;
+
+  // False with `error` set when `spec` is malformed
+  static bool parse(const std::string& spec, CascadeRule& out, std::string& error);
+};
+
+struct CascadeConfig {
+  std::string fast_model;  // CASCADE_FAST_MODEL; empty = no cascade
+  CascadeRule rule;        // CASCADE_RULE
+
+  bool enabled() const { return !fast_model.empty(); }
+
+  // Disabled, with a warning, when the rule is missing or malformed
+  static CascadeConfig from_env();
+};
+
+class Cascade {
+public:
+  // Which stage answered an input
+  enum class Outcome : uint8_t { fast, full, failed };
+
+  // Cheap model on n inputs: n outputs in ys and, when `us` is not null, n
+  // uncertainties in us. False if it failed.
+  using FastFn = std::function<bool(const float* xs, size_t n, float* ys, float* us)>;
+  // Full model on n inputs; false if it failed
+  using FullFn = std::function<bool(const float* xs, size_t n, float* ys)>;
+
+  Cascade(const CascadeConfig& config, FastFn fast, FullFn full,
+          metrics::Registry& registry = metrics::registry());
+
+  // ys[i] from the cheap or the full model; outcome[i] says which, or that
+  // the input was escalated and the full model failed (ys[i] is then not
+  // an answer). False if any input failed.
+  bool run(const float* xs, size_t n, float* ys, Outcome* outcome);
+
+  const CascadeRule& rule() const { return rule_; }
+
+private:
+  void count(size_t n, size_t escalated);
+
+  const CascadeRule rule_;
+  const FastFn fast_;
+  const FullFn full_;
+
+  // Escalation ratio over the last kWindow inputs
+  static constexpr uint64_t kWindow = 1024;
+  std::mutex window_mutex_;
+  uint64_t window_inputs_ = 0;
+  uint64_t window_escalated_ = 0;
+
+  metrics::Counter& inputs_;
+  metrics::Counter& escalations_;
+  metrics::Counter& fast_failures_;
+  metrics::Counter& full_failures_;
+  metrics::Gauge& ratio_gauge_;
+  metrics::Gauge& fast_gauge_;
+  metrics::Gauge& full_gauge_;
+};
@@ -0,0 +1,105 @@
+#include "cors.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#include "resources.h"
+
+namespace {
+
+std::string trim_origin(std::string s) {
+  auto b = s.find_first_not_of(" \t");
+  auto e = s.find_last_not_of(" \t/");
+  return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+bool is_text_plain(const std::string& content_type) {
+  return content_type.compare(0, 10, "text/plain") == 0;
+}
+
+} // namespace
+
+CorsPolicy::CorsPolicy()
+    : preflights_(metrics::registry().counter(
+          "ia_cors_preflight_total", "CORS preflight (OPTIONS) requests")),
+      rejected_(metrics::registry().counter(
+          "ia_cors_rejected_total", "Preflights from origins not allowed")),
+      simple_requests_(metrics::registry().counter(
+          "ia_cors_simple_requests_total",
+          "Cross-origin text/plain POSTs that skipped the preflight")) {}
+
+CorsPolicy CorsPolicy::from_env() {
+  CorsPolicy policy;
+  policy.max_age_sec_ = env_long("CORS_MAX_AGE", policy.max_age_sec_);
+
+  const char* allow_origin = std::getenv("ALLOW_ORIGIN");
+  if (allow_origin && *allow_origin) {
+    std::istringstream list(allow_origin);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+      item = trim_origin(item);
+      if (item == "*") {
+        policy.allow_any_ = true;
+      } else if (!item.empty()) {
+        policy.origins_.insert(item);
+      }
+    }
+  } else if (!std::getenv("RENDER")) {
+    // In development, use wildcard; on Render nothing unless configured
+    policy.allow_any_ = true;
+  }
+  return policy;
+}
+
+httplib::Headers CorsPolicy::static_headers() const {
+  httplib::Headers headers;
+  if (allow_any_) {
+    headers.emplace("Access-Control-Allow-Origin", "*");
+  } else if (!origins_.empty()) {
+    // The allowed origin is echoed per request, so caches must key on it
+    headers.emplace("Vary", "Origin");
+  }
+  return headers;
+}
+
+bool CorsPolicy::is_allowed(const std::string& origin) const {
+  return allow_any_ || origins_.count(origin) > 0;
+}
+
+void CorsPolicy::apply(const httplib::Request& req,
+                       httplib::Response& res) const {
+  if (!req.has_header("Origin")) return;
+  const auto origin = req.get_header_value("Origin");
+
+  if (!allow_any_ && origins_.count(origin)) {
+    res.set_header("Access-Control-Allow-Origin", origin);
+  }
+  if (req.method == "POST" && is_text_plain(req.get_header_value("Content-Type"))) {
+    simple_requests_.inc();
+  }
+}
+
+void CorsPolicy::preflight(const httplib::Request& req,
+                           httplib::Response& res) const {
+  preflights_.inc();
+  res.status = 204;
+
+  if (!is_allowed(req.get_header_value("Origin"))) {
+    rejected_.inc();
+    return;
+  }
+  res.set_header("Access-Control-Allow-Methods", "POST, OPTIONS");
+  res.set_header("Access-Control-Allow-Headers", "Content-Type");
+  res.set_header("Access-Control-Max-Age", std::to_string(max_age_sec_));
+  res.set_header("Vary", "Access-Control-Request-Method, Access-Control-Request-Headers");
+}
+
+std::string CorsPolicy::describe() const {
+  if (!allow_any_ && origins_.empty()) return "none";
+  std::string out = allow_any_ ? "*" : "";
+  for (const auto& o : origins_) {
+    if (!out.empty()) out += ", ";
+    out += o;
+  }
+  return out + " (max-age " + std::to_string(max_age_sec_) + "s)";
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+
+#include "httplib.h"
+#include "metrics.h"
+
+// CORS policy for the browser frontend.
+//
+// ALLOW_ORIGIN accepts "*" or a comma-separated list of origins, matched
+// through a hash set built once at startup. Preflights are answered with a
+// long Access-Control-Max-Age (CORS_MAX_AGE) so browsers reuse them, and
+// POST /predict accepts `text/plain` bodies: a text/plain POST is a CORS
+// "simple request", so clients that send one never trigger a preflight.
+class CorsPolicy {
+public:
+  static CorsPolicy from_env();
+
+  // Headers identical on every response, for Server::set_static_headers
+  httplib::Headers static_headers() const;
+
+  // Per-response part (echoed origin); install as post-routing handler
+  void apply(const httplib::Request& req, httplib::Response& res) const;
+
+  // OPTIONS handler body
+  void preflight(const httplib::Request& req, httplib::Response& res) const;
+
+  bool is_allowed(const std::string& origin) const;
+  std::string describe() const;
+
+private:
+  CorsPolicy();
+
+  bool allow_any_ = false;
+  std::unordered_set<std::string> origins_;
+  long max_age_sec_ = 86400;
+
+  metrics::Counter& preflights_;
+  metrics::Counter& rejected_;
+  metrics::Counter& simple_requests_;
+};
@@ -0,0 +1,555 @@
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+namespace {
+
+constexpr int kMaxDepth = 64;
+constexpr size_t kRingSize = 4096;  // ~2 MiB; drained every 20 ms
+
+// Bounded MPSC ring (Vyukov): producers are signal handlers on any thread,
+// the consumer is the capturing request thread. A slot is free for the
+// producer at position p when seq == p and readable when seq == p + 1.
+struct Slot {
+  std::atomic<uint64_t> seq;
+  int depth;
+  void* pcs[kMaxDepth];  // leaf first
+};
+
+struct Ring {
+  Slot slots[kRingSize];
+  std::atomic<uint64_t> head{0};
+  uint64_t tail = 0;  // consumer only
+  std::atomic<uint64_t> dropped{0};
+
+  Ring() {
+    for (size_t i = 0; i < kRingSize; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+};
+
+std::atomic<Ring*> g_ring{nullptr};
+std::atomic<int> g_in_handler{0};
+std::atomic<bool> g_capturing{false};
+
+void* context_pc(void* context) {
+  auto* uc = static_cast<ucontext_t*>(context);
+#if defined(__x86_64__)
+  return reinterpret_cast<void*>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+  return reinterpret_cast<void*>(uc->uc_mcontext.pc);
+#else
+  (void)uc;
+  return nullptr;
+#endif
+}
+
+// Async-signal-safe: atomics and backtrace() only. backtrace() is primed
+// before the timer starts (its first call loads libgcc_s), and with glibc
+// 2.35+ the unwinder finds objects without taking the loader lock.
+void on_sigprof(int, siginfo_t*, void* context) {
+  int saved_errno = errno;
+  // seq_cst pairs with the teardown in capture_cpu_profile: either this
+  // load sees the ring cleared, or the capture thread sees the handler
+  // counted and waits for it before freeing the ring
+  g_in_handler.fetch_add(1, std::memory_order_seq_cst);
+  Ring* ring = g_ring.load(std::memory_order_seq_cst);
+  if (ring) {
+    Slot* slot = nullptr;
+    uint64_t pos = ring->head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& s = ring->slots[pos % kRingSize];
+      uint64_t seq = s.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<int64_t>(seq - pos);
+      if (diff == 0) {
+        if (ring->head.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          slot = &s;
+          break;
+        }
+      } else if (diff < 0) {
+        break;  // full
+      } else {
+        pos = ring->head.load(std::memory_order_relaxed);
+      }
+    }
+
+    if (!slot) {
+      ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      // The first frames are this handler and the sigreturn trampoline;
+      // the stack proper starts at the interrupted instruction
+      void* frames[kMaxDepth + 4];
+      int n = backtrace(frames, kMaxDepth + 4);
+      void* pc = context_pc(context);
+      int first = -1;
+      for (int i = 0; i < n && i < 4; i++) {
+        if (frames[i] == pc) {
+          first = i;
+          break;
+        }
+      }
+      if (first < 0) {
+        // Could not unwind through the signal frame: keep the leaf only
+        slot->pcs[0] = pc;
+        slot->depth = pc ? 1 : 0;
+      } else {
+        int depth = std::min(n - first, kMaxDepth);
+        for (int i = 0; i < depth; i++) slot->pcs[i] = frames[first + i];
+        slot->depth = depth;
+      }
+      slot->seq.store(pos + 1, std::memory_order_release);
+    }
+  }
+  g_in_handler.fetch_sub(1, std::memory_order_seq_cst);
+  errno = saved_errno;
+}
+
+using Stack = std::vector<uintptr_t>;
+
+struct StackHash {
+  size_t operator()(const Stack& s) const {
+    size_t h = 1469598103934665603ull;
+    for (auto pc : s) h = (h ^ pc) * 1099511628211ull;
+    return h;
+  }
+};
+
+using StackCounts = std::unordered_map<Stack, uint64_t, StackHash>;
+
+void drain(Ring& ring, StackCounts& counts, size_t& samples) {
+  for (;;) {
+    Slot& s = ring.slots[ring.tail % kRingSize];
+    if (s.seq.load(std::memory_order_acquire) != ring.tail + 1) return;
+    if (s.depth > 0) {
+      Stack stack(s.depth);
+      for (int i = 0; i < s.depth; i++) {
+        stack[i] = reinterpret_cast<uintptr_t>(s.pcs[i]);
+      }
+      counts[std::move(stack)]++;
+      samples++;
+    }
+    s.seq.store(ring.tail + kRingSize, std::memory_order_release);
+    ring.tail++;
+  }
+}
+
+// Function symbols of one ELF file: .symtab when the file is not stripped
+// (our executable, so static functions and lambdas resolve too), otherwise
+// .dynsym (exported symbols, e.g. ORT's API).
+class ElfSymbols {
+public:
+  explicit ElfSymbols(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Elf64_Ehdr))) {
+      ::close(fd);
+      return;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return;
+    load(static_cast<const uint8_t*>(map), size);
+    ::munmap(map, size);
+  }
+
+  bool relocatable() const { return relocatable_; }
+
+  // Mangled name of the function containing `addr` (file address)
+  const std::string* lookup(uintptr_t addr) const {
+    auto it = std::upper_bound(
+        symbols_.begin(), symbols_.end(), addr,
+        [](uintptr_t a, const Symbol& s) { return a < s.start; });
+    if (it == symbols_.begin()) return nullptr;
+    --it;
+    return addr < it->end ? &it->name : nullptr;
+  }
+
+private:
+  struct Symbol {
+    uintptr_t start;
+    uintptr_t end;
+    std::string name;
+  };
+
+  void load(const uint8_t* data, size_t size) {
+    auto* eh = reinterpret_cast<const Elf64_Ehdr*>(data);
+    if (std::memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_shoff == 0 ||
+        eh->e_shoff + uint64_t(eh->e_shnum) * sizeof(Elf64_Shdr) > size) {
+      return;
+    }
+    relocatable_ = eh->e_type == ET_DYN;
+    auto* sh = reinterpret_cast<const Elf64_Shdr*>(data + eh->e_shoff);
+
+    for (uint32_t want : {uint32_t(SHT_SYMTAB), uint32_t(SHT_DYNSYM)}) {
+      for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != want || sh[i].sh_link >= eh->e_shnum) continue;
+        const auto& strtab = sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > size ||
+            strtab.sh_offset + strtab.sh_size > size) {
+          continue;
+        }
+        auto* syms = reinterpret_cast<const Elf64_Sym*>(data + sh[i].sh_offset);
+        size_t count = sh[i].sh_size / sizeof(Elf64_Sym);
+        const char* names = reinterpret_cast<const char*>(data + strtab.sh_offset);
+        for (size_t k = 0; k < count; k++) {
+          const auto& sym = syms[k];
+          if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_value == 0 ||
+              sym.st_name >= strtab.sh_size) {
+            continue;
+          }
+          symbols_.push_back(Symbol{sym.st_value, sym.st_value + sym.st_size,
+                                    names + sym.st_name});
+        }
+      }
+      if (!symbols_.empty()) break;  // .symtab is a superset of .dynsym
+    }
+
+    std::sort(symbols_.begin(), symbols_.end(),
+              [](const Symbol& a, const Symbol& b) { return a.start < b.start; });
+    // Size-less symbols (hand-written assembly) run up to the next one
+    for (size_t i = 0; i < symbols_.size(); i++) {
+      if (symbols_[i].end == symbols_[i].start) {
+        symbols_[i].end = i + 1 < symbols_.size() ? symbols_[i + 1].start
+                                                  : symbols_[i].start + 1;
+      }
+    }
+  }
+
+  std::vector<Symbol> symbols_;
+  bool relocatable_ = false;
+};
+
+std::string demangle(const std::string& name) {
+  int status = 0;
+  std::unique_ptr<char, void (*)(void*)> out(
+      abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status), std::free);
+  return status == 0 && out ? out.get() : name;
+}
+
+class Symbolizer {
+public:
+  std::string name(uintptr_t addr) {
+    auto cached = names_.find(addr);
+    if (cached != names_.end()) return cached->second;
+
+    std::string result;
+    Dl_info info{};
+    if (dladdr(reinterpret_cast<void*>(addr), &info) && info.dli_fname) {
+      std::string module = info.dli_fname;
+      auto& elf = modules_[module];
+      if (!elf) elf = std::make_unique<ElfSymbols>(module);
+      auto base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+      const std::string* sym = elf->lookup(elf->relocatable() ? addr - base : addr);
+      if (sym) {
+        result = demangle(*sym);
+      } else if (info.dli_sname) {
+        result = demangle(info.dli_sname);
+      } else {
+        auto slash = module.rfind('/');
+        std::ostringstream out;
+        out << module.substr(slash == std::string::npos ? 0 : slash + 1) << "+0x"
+            << std::hex << (addr - base);
+        result = out.str();
+      }
+    } else {
+      std::ostringstream out;
+      out << "0x" << std::hex << addr;
+      result = out.str();
+    }
+    names_.emplace(addr, result);
+    return result;
+  }
+
+private:
+  std::unordered_map<uintptr_t, std::string> names_;
+  std::map<std::string, std::unique_ptr<ElfSymbols>> modules_;
+};
+
+// Return addresses point after the call; step back into it so the caller's
+// line (and function, when the call is its last instruction) is reported
+uintptr_t frame_address(const Stack& stack, size_t i) {
+  return i == 0 ? stack[i] : stack[i] - 1;
+}
+
+std::string render_collapsed(const StackCounts& counts, Symbolizer& symbols) {
+  std::vector<std::pair<std::string, uint64_t>> lines;
+  std::unordered_map<std::string, uint64_t> merged;  // stacks equal by name
+  for (const auto& [stack, count] : counts) {
+    std::string line;
+    for (size_t i = stack.size(); i-- > 0;) {
+      std::string frame = symbols.name(frame_address(stack, i));
+      std::replace(frame.begin(), frame.end(), ';', ':');
+      if (!line.empty()) line += ';';
+      line += frame;
+    }
+    merged[line] += count;
+  }
+  lines.assign(merged.begin(), merged.end());
+  std::sort(lines.begin(), lines.end(),
+            [](const auto& a, const auto& b) { return a.second > b.second; });
+  std::string out;
+  for (const auto& [line, count] : lines) {
+    out += line;
+    out += ' ';
+    out += std::to_string(count);
+    out += '\n';
+  }
+  return out;
+}
+
+// Minimal protobuf encoder for profile.proto
+class ProtoWriter {
+public:
+  void varint(uint64_t v) {
+    while (v >= 0x80) {
+      out_ += static_cast<char>(v | 0x80);
+      v >>= 7;
+    }
+    out_ += static_cast<char>(v);
+  }
+  void uint(int field, uint64_t v) {
+    if (v == 0) return;
+    varint(uint64_t(field) << 3);
+    varint(v);
+  }
+  void bytes(int field, const std::string& s) {
+    varint((uint64_t(field) << 3) | 2);
+    varint(s.size());
+    out_ += s;
+  }
+  void packed(int field, const std::vector<uint64_t>& values) {
+    ProtoWriter p;
+    for (auto v : values) p.varint(v);
+    bytes(field, p.out_);
+  }
+  const std::string& str() const { return out_; }
+
+private:
+  std::string out_;
+};
+
+struct Mapping {
+  uintptr_t start, limit, offset;
+  std::string path;
+};
+
+std::vector<Mapping> executable_mappings() {
+  std::vector<Mapping> maps;
+  std::ifstream in("/proc/self/maps");
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ss(line);
+    std::string range, perms, offset, dev, inode, path;
+    ss >> range >> perms >> offset >> dev >> inode >> path;
+    if (perms.size() < 3 || perms[2] != 'x' || path.empty() || path[0] != '/') {
+      continue;
+    }
+    auto dash = range.find('-');
+    maps.push_back(Mapping{std::stoull(range.substr(0, dash), nullptr, 16),
+                           std::stoull(range.substr(dash + 1), nullptr, 16),
+                           std::stoull(offset, nullptr, 16), path});
+  }
+  return maps;
+}
+
+std::string render_pprof(const StackCounts& counts, Symbolizer& symbols,
+                         int hz, std::chrono::nanoseconds duration,
+                         std::chrono::system_clock::time_point started) {
+  std::vector<std::string> strings{""};
+  std::unordered_map<std::string, uint64_t> string_ids{{"", 0}};
+  auto intern = [&](const std::string& s) {
+    auto [it, added] = string_ids.emplace(s, strings.size());
+    if (added) strings.push_back(s);
+    return it->second;
+  };
+
+  const auto maps = executable_mappings();
+  std::unordered_map<uintptr_t, uint64_t> location_ids;
+  std::unordered_map<std::string, uint64_t> function_ids;
+  ProtoWriter locations, functions, samples;
+  const uint64_t period_ns = 1000000000ull / static_cast<uint64_t>(hz);
+
+  for (const auto& [stack, count] : counts) {
+    std::vector<uint64_t> ids;
+    for (size_t i = 0; i < stack.size(); i++) {
+      uintptr_t addr = frame_address(stack, i);
+      auto [it, added] = location_ids.emplace(addr, location_ids.size() + 1);
+      ids.push_back(it->second);
+      if (!added) continue;
+
+      std::string name = symbols.name(addr);
+      auto [fn, new_fn] = function_ids.emplace(name, function_ids.size() + 1);
+      if (new_fn) {
+        ProtoWriter f;
+        f.uint(1, fn->second);
+        f.uint(2, intern(name));
+        f.uint(3, intern(name));
+        functions.bytes(5, f.str());
+      }
+      ProtoWriter loc, line;
+      loc.uint(1, it->second);
+      for (size_t m = 0; m < maps.size(); m++) {
+        if (addr >= maps[m].start && addr < maps[m].limit) {
+          loc.uint(2, m + 1);
+          break;
+        }
+      }
+      loc.uint(3, addr);
+      line.uint(1, fn->second);
+      loc.bytes(4, line.str());
+      locations.bytes(4, loc.str());
+    }
+    ProtoWriter sample;
+    sample.packed(1, ids);
+    sample.packed(2, {count, count * period_ns});
+    samples.bytes(2, sample.str());
+  }
+
+  ProtoWriter profile;
+  auto value_type = [&](const char* type, const char* unit) {
+    ProtoWriter vt;
+    vt.uint(1, intern(type));
+    vt.uint(2, intern(unit));
+    return vt.str();
+  };
+  profile.bytes(1, value_type("samples", "count"));
+  profile.bytes(1, value_type("cpu", "nanoseconds"));
+  const std::string period_type = value_type("cpu", "nanoseconds");
+  std::string body = profile.str() + samples.str();
+  ProtoWriter tail;
+  for (size_t m = 0; m < maps.size(); m++) {
+    ProtoWriter mapping;
+    mapping.uint(1, m + 1);
+    mapping.uint(2, maps[m].start);
+    mapping.uint(3, maps[m].limit);
+    mapping.uint(4, maps[m].offset);
+    mapping.uint(5, intern(maps[m].path));
+    mapping.uint(7, 1);  // has_functions
+    tail.bytes(3, mapping.str());
+  }
+  body += tail.str() + locations.str() + functions.str();
+
+  // string_table after everything has been interned
+  ProtoWriter rest;
+  for (const auto& s : strings) rest.bytes(6, s);
+  rest.uint(9, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         started.time_since_epoch())
+                                         .count()));
+  rest.uint(10, static_cast<uint64_t>(duration.count()));
+  rest.bytes(11, period_type);
+  rest.uint(12, period_ns);
+  return body + rest.str();
+}
+
+} // namespace
+
+bool capture_cpu_profile(const CpuProfileOptions& options, CpuProfile& out,
+                         std::string& error) {
+  static metrics::Counter& samples_total = metrics::registry().counter(
+      "ia_cpu_profiler_samples_total", "Stack samples taken by /debug/profile");
+  static metrics::Counter& dropped_total = metrics::registry().counter(
+      "ia_cpu_profiler_dropped_total", "Stack samples lost because the ring was full");
+
+  if (g_capturing.exchange(true)) {
+    error = "a CPU profile is already being captured";
+    return false;
+  }
+  const int hz = std::min(std::max(options.hz, 1), 1000);
+
+  // Prime the unwinder outside the signal handler
+  void* prime[2];
+  backtrace(prime, 2);
+
+  auto ring = std::make_unique<Ring>();
+  g_ring.store(ring.get(), std::memory_order_release);
+
+  // The handler stays installed after the capture: a SIGPROF still pending
+  // when the timer is stopped would otherwise kill the process
+  struct sigaction sa{};
+  sa.sa_sigaction = on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  itimerval timer{};
+  // tv_usec must stay below one second, so hz=1 goes in tv_sec
+  const long period_us = 1000000 / hz;
+  timer.it_interval.tv_sec = period_us / 1000000;
+  timer.it_interval.tv_usec = period_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (sigaction(SIGPROF, &sa, nullptr) != 0 ||
+      setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    error = std::string("cannot start the profiling timer: ") + std::strerror(errno);
+    g_ring.store(nullptr, std::memory_order_release);
+    g_capturing.store(false);
+    return false;
+  }
+
+  StackCounts counts;
+  size_t samples = 0;
+  auto started = std::chrono::steady_clock::now();
+  auto started_wall = std::chrono::system_clock::now();
+  auto deadline = started + options.duration;
+  while (std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    drain(*ring, counts, samples);
+  }
+
+  itimerval off{};
+  setitimer(ITIMER_PROF, &off, nullptr);
+  // Store-then-load on both sides (see on_sigprof): needs seq_cst, not
+  // acquire/release, or a handler could still be writing to a freed ring
+  g_ring.store(nullptr, std::memory_order_seq_cst);
+  while (g_in_handler.load(std::memory_order_seq_cst) > 0) {
+    std::this_thread::yield();
+  }
+  drain(*ring, counts, samples);
+  auto elapsed = std::chrono::steady_clock::now() - started;
+
+  out.samples = samples;
+  out.dropped = ring->dropped.load(std::memory_order_relaxed);
+  samples_total.inc(out.samples);
+  dropped_total.inc(out.dropped);
+  ring.reset();
+
+  Symbolizer symbols;
+  if (options.pprof) {
+    out.body = render_pprof(counts, symbols, hz,
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed),
+                            started_wall);
+    out.content_type = "application/octet-stream";
+  } else {
+    out.body = render_collapsed(counts, symbols);
+    out.content_type = "text/plain";
+  }
+  g_capturing.store(false);
+  return true;
+}
@@ -0,0 +1,292 @@
+#include "ensemble.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Four floats per vector: one SSE/NEON register, in the baseline ISA
+constexpr size_t kLanes = 4;
+typedef float vf __attribute__((vector_size(kLanes * sizeof(float))));
+typedef int32_t vi __attribute__((vector_size(kLanes * sizeof(int32_t))));
+
+inline vf load(const float* p) {
+  vf v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+// Runs `block` (member k -> its lanes) over every full vector of inputs,
+// then over a zero-padded copy of the tail
+template <typename Block>
+void for_each_lanes(const float* outs, size_t n, float* ys, Block block) {
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    vf y = block([&](size_t k) { return load(outs + k * n + i); });
+    std::memcpy(ys + i, &y, sizeof y);
+  }
+  if (i == n) return;
+  const size_t rest = n - i;
+  vf y = block([&](size_t k) {
+    vf v{};
+    std::memcpy(&v, outs + k * n + i, rest * sizeof(float));
+    return v;
+  });
+  std::memcpy(ys + i, &y, rest * sizeof(float));
+}
+
+// Nearest integer, halves away from zero
+inline vf round_lanes(vf v) {
+  vf half = 0.5f + __builtin_convertvector(v < 0, vf);  // -1 where negative
+  return __builtin_convertvector(__builtin_convertvector(v + half, vi), vf);
+}
+
+inline vf select(vi mask, vf a, vf b) {
+  return (vf)(((vi)a & mask) | ((vi)b & ~mask));
+}
+
+std::string trim(const std::string& s) {
+  size_t b = s.find_first_not_of(" \t");
+  size_t e = s.find_last_not_of(" \t");
+  return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+}
+
+std::vector<std::string> split(const char* v) {
+  std::vector<std::string> items;
+  if (!v) return items;
+  std::stringstream in(v);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    item = trim(item);
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+} // namespace
+
+const char* reducer_name(EnsembleReducer reducer) {
+  switch (reducer) {
+    case EnsembleReducer::mean:     return "mean";
+    case EnsembleReducer::weighted: return "weighted";
+    case EnsembleReducer::vote:     return "vote";
+  }
+  return "mean";
+}
+
+EnsembleConfig EnsembleConfig::from_env() {
+  EnsembleConfig c;
+  c.models = split(std::getenv("ENSEMBLE_MODELS"));
+  if (!c.enabled()) return c;
+  if (c.models.size() > kMaxModels) {
+    std::cerr << "[warn] ENSEMBLE_MODELS has more than " << kMaxModels
+              << " models, using the first " << kMaxModels << std::endl;
+    c.models.resize(kMaxModels);
+  }
+
+  if (const char* v = std::getenv("ENSEMBLE_REDUCER"); v && *v) {
+    std::string name = v;
+    if (name == "weighted") {
+      c.reducer = EnsembleReducer::weighted;
+    } else if (name == "vote") {
+      c.reducer = EnsembleReducer::vote;
+    } else if (name != "mean") {
+      std::cerr << "[warn] Unknown ENSEMBLE_REDUCER '" << name << "', using mean" << std::endl;
+    }
+  }
+
+  bool valid = true;
+  for (const std::string& item : split(std::getenv("ENSEMBLE_WEIGHTS"))) {
+    char* end = nullptr;
+    float w = std::strtof(item.c_str(), &end);
+    if (*end || !(w > 0)) valid = false;
+    c.weights.push_back(w);
+  }
+  if (!c.weights.empty() && (!valid || c.weights.size() != c.models.size())) {
+    std::cerr << "[warn] ENSEMBLE_WEIGHTS needs one positive weight per model, "
+                 "using equal weights" << std::endl;
+    c.weights.clear();
+  }
+  if (c.weights.empty() && c.reducer == EnsembleReducer::weighted) {
+    std::cerr << "[warn] ENSEMBLE_REDUCER=weighted without ENSEMBLE_WEIGHTS is a plain mean"
+              << std::endl;
+  }
+  return c;
+}
+
+std::vector<std::string> EnsembleConfig::member_names() const {
+  std::vector<std::string> names;
+  for (const std::string& path : models) {
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    if (size_t dot = name.find_last_of('.'); dot != std::string::npos && dot > 0) {
+      name.resize(dot);
+    }
+    std::string unique = name;
+    for (int i = 2; std::find(names.begin(), names.end(), unique) != names.end(); i++) {
+      unique = name + "-" + std::to_string(i);
+    }
+    names.push_back(unique);
+  }
+  return names;
+}
+
+void reduce_mean(const float* outs, size_t members, size_t n, float* ys) {
+  const float scale = 1.0f / static_cast<float>(members);
+  for_each_lanes(outs, n, ys, [&](auto member) {
+    vf sum = member(0);
+    for (size_t k = 1; k < members; k++) sum += member(k);
+    return sum * scale;
+  });
+}
+
+void reduce_weighted(const float* outs, const float* weights, size_t members, size_t n,
+                     float* ys) {
+  float total = 0;
+  for (size_t k = 0; k < members; k++) total += weights[k];
+  const float scale = 1.0f / total;
+  for_each_lanes(outs, n, ys, [&](auto member) {
+    vf sum = member(0) * weights[0];
+    for (size_t k = 1; k < members; k++) sum += member(k) * weights[k];
+    return sum * scale;
+  });
+}
+
+void reduce_vote(const float* outs, const float* weights, size_t members, size_t n,
+                 float* ys) {
+  for_each_lanes(outs, n, ys, [&](auto member) {
+    // Members are few: every label scores the weight of the members that
+    // agree with it, and the best score wins
+    vf labels[EnsembleConfig::kMaxModels];
+    for (size_t k = 0; k < members; k++) labels[k] = round_lanes(member(k));
+    vf best{}, best_score{};
+    for (size_t a = 0; a < members; a++) {
+      vf score{};
+      for (size_t b = 0; b < members; b++) {
+        score -= weights[b] * __builtin_convertvector(labels[b] == labels[a], vf);
+      }
+      if (a == 0) {
+        best = labels[0];
+        best_score = score;
+        continue;
+      }
+      vi better = (score > best_score) | ((score == best_score) & (labels[a] < best));
+      best = select(better, labels[a], best);
+      best_score = select(better, score, best_score);
+    }
+    return best;
+  });
+}
+
+Ensemble::Ensemble(const EnsembleConfig& config, MemberFn fn, metrics::Registry& registry)
+    : fn_(std::move(fn)),
+      reducer_(config.reducer),
+      weights_(config.weights.empty() ? std::vector<float>(config.models.size(), 1.0f)
+                                      : config.weights),
+      runs_(registry.counter("ia_ensemble_runs_total", "Ensemble predictions (fan-outs)")),
+      failures_(registry.counter("ia_ensemble_failures_total",
+                                 "Ensemble fan-outs with a failed member")),
+      run_gauge_(registry.gauge("ia_ensemble_run_seconds",
+                                "Run time of a whole ensemble fan-out (EWMA)")),
+      overhead_gauge_(registry.gauge(
+          "ia_ensemble_overhead_seconds",
+          "Fan-out time beyond its slowest member: queueing, handoff and reduce (EWMA)")) {
+  for (const std::string& name : config.member_names()) {
+    member_gauges_.push_back(&registry.gauge("ia_ensemble_member_run_seconds{member=\"" +
+                                                 name + "\"}",
+                                             "Run time of one ensemble member (EWMA)"));
+  }
+  for (size_t i = 1; i < members(); i++) threads_.emplace_back([this] { worker(); });
+}
+
+Ensemble::~Ensemble() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_.notify_all();
+  for (auto& t : threads_) t.join();
+}
+
+void Ensemble::worker() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (stop_) return;
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+    run_member(*task.call, task.member);
+  }
+}
+
+void Ensemble::run_member(Call& call, size_t k) {
+  auto t0 = std::chrono::steady_clock::now();
+  bool ok = fn_(k, call.xs, call.n, call.outs + k * call.n);
+  auto t = std::chrono::steady_clock::now() - t0;
+  member_gauges_[k]->ewma(std::chrono::duration<double>(t).count());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!ok) call.failed = true;
+  call.slowest = std::max(call.slowest, t);
+  if (--call.pending == 0) call.done.notify_one();
+}
+
+bool Ensemble::run(const float* xs, size_t n, float* ys) {
+  auto t0 = std::chrono::steady_clock::now();
+  const size_t k_count = members();
+  thread_local std::vector<float> outs;
+  outs.resize(k_count * n);
+
+  Call call{xs, n, outs.data(), k_count, false, {}, {}};
+  if (k_count > 1) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t k = 1; k < k_count; k++) tasks_.push_back(Task{&call, k});
+    }
+    for (size_t k = 1; k < k_count; k++) work_.notify_one();
+  }
+  run_member(call, 0);
+
+  // Members no pool thread has taken yet run here
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto own = std::find_if(tasks_.begin(), tasks_.end(),
+                            [&](const Task& task) { return task.call == &call; });
+    if (own == tasks_.end()) {
+      call.done.wait(lock, [&] { return call.pending == 0; });
+      break;
+    }
+    size_t k = own->member;
+    tasks_.erase(own);
+    lock.unlock();
+    run_member(call, k);
+  }
+
+  runs_.inc();
+  if (call.failed) {
+    failures_.inc();
+    return false;
+  }
+  switch (reducer_) {
+    case EnsembleReducer::mean:
+      reduce_mean(outs.data(), k_count, n, ys);
+      break;
+    case EnsembleReducer::weighted:
+      reduce_weighted(outs.data(), weights_.data(), k_count, n, ys);
+      break;
+    case EnsembleReducer::vote:
+      reduce_vote(outs.data(), weights_.data(), k_count, n, ys);
+      break;
+  }
+
+  auto total = std::chrono::steady_clock::now() - t0;
+  run_gauge_.ewma(std::chrono::duration<double>(total).count());
+  overhead_gauge_.ewma(std::chrono::duration<double>(total - call.slowest).count());
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+// Ensemble of several models per prediction (ENSEMBLE_MODELS).
+//
+// Each input goes to every member and the member outputs are combined by a
+// reducer:
+//
+//   mean      plain average
+//   weighted  sum(w_k * y_k) / sum(w_k), weights from ENSEMBLE_WEIGHTS
+//   vote      outputs rounded to class labels; the label with the most
+//             weight wins (ties go to the lowest label)
+//
+// Members run concurrently, so an ensemble costs about its slowest member
+// rather than the sum: the calling thread runs member 0 and a pool of K-1
+// member threads the rest. Requests that find the pool busy run their own
+// queued members on the calling thread instead of waiting for it, so with
+// many requests in flight the ensemble degrades to sequential per request
+// and never queues behind other requests.
+//
+// The reducers work on whole batches, several inputs per vector register
+// (GCC/Clang vector extensions; SSE, AVX or NEON depending on the target).
+enum class EnsembleReducer { mean, weighted, vote };
+
+struct EnsembleConfig {
+  static constexpr size_t kMaxModels = 64;
+
+  std::vector<std::string> models;  // ENSEMBLE_MODELS, comma-separated paths (<= 64)
+  std::vector<float> weights;       // ENSEMBLE_WEIGHTS; empty = all 1
+  EnsembleReducer reducer = EnsembleReducer::mean;  // ENSEMBLE_REDUCER
+
+  bool enabled() const { return !models.empty(); }
+  // Member names for logs, readiness and metrics: file stems, made unique
+  std::vector<std::string> member_names() const;
+
+  static EnsembleConfig from_env();
+};
+
+const char* reducer_name(EnsembleReducer reducer);
+
+// Reducers over member outputs laid out member after member:
+// outs[k * n + i] is member k's output for input i
+void reduce_mean(const float* outs, size_t members, size_t n, float* ys);
+void reduce_weighted(const float* outs, const float* weights, size_t members, size_t n,
+                     float* ys);
+void reduce_vote(const float* outs, const float* weights, size_t members, size_t n,
+                 float* ys);
+
+class Ensemble {
+public:
+  // Runs member `k` on `n` inputs and writes its `n` outputs; false if the
+  // member failed. Called concurrently for different members.
+  using MemberFn = std::function<bool(size_t k, const float* xs, size_t n, float* ys)>;
+
+  Ensemble(const EnsembleConfig& config, MemberFn fn,
+           metrics::Registry& registry = metrics::registry());
+  ~Ensemble();
+
+  Ensemble(const Ensemble&) = delete;
+  Ensemble& operator=(const Ensemble&) = delete;
+
+  // Every member on xs[0..n), reduced into ys[0..n). False (ys untouched)
+  // if any member failed.
+  bool run(const float* xs, size_t n, float* ys);
+
+  size_t members() const { return weights_.size(); }
+  EnsembleReducer reducer() const { return reducer_; }
+
+private:
+  // One fan-out in flight
+  struct Call {
+    const float* xs;
+    size_t n;
+    float* outs;
+    size_t pending;  // members not finished yet; this and below under mutex_
+    bool failed = false;
+    std::chrono::nanoseconds slowest{0};
+    std::condition_variable done;
+  };
+  struct Task {
+    Call* call;
+    size_t member;
+  };
+
+  void worker();
+  void run_member(Call& call, size_t k);
+
+  const MemberFn fn_;
+  const EnsembleReducer reducer_;
+  const std::vector<float> weights_;
+
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::deque<Task> tasks_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+
+  metrics::Counter& runs_;
+  metrics::Counter& failures_;
+  metrics::Gauge& run_gauge_;
+  metrics::Gauge& overhead_gauge_;
+  std::vector<metrics::Gauge*> member_gauges_;
+};
@@ -0,0 +1,291 @@
+#include "feature_table.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "resources.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'I', 'A', 'F', 'E', 'A', 'T', '0', '1'};
+constexpr uint32_t kVersion = 1;
+constexpr uint64_t kValuesAlign = 64;
+
+uint64_t fnv1a(std::string_view key) {
+  uint64_t h = 1469598103934665603ull;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// `count` elements of `elem` bytes from `offset` stay inside `size` bytes
+bool fits(uint64_t offset, uint64_t count, uint64_t elem, uint64_t size) {
+  return offset <= size && count <= (size - offset) / elem;
+}
+
+uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+} // namespace
+
+std::shared_ptr<const FeatureTable> FeatureTable::open(const std::string& path,
+                                                       std::string& error) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = std::strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FeatureFileHeader))) {
+    ::close(fd);
+    error = "file too short for a feature table";
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    error = std::string("mmap: ") + std::strerror(errno);
+    return nullptr;
+  }
+  ::madvise(data, size, MADV_WILLNEED);
+
+  std::shared_ptr<FeatureTable> table(new FeatureTable());
+  table->data_ = data;
+  table->size_ = size;
+
+  const auto* base = static_cast<const char*>(data);
+  const auto* h = reinterpret_cast<const FeatureFileHeader*>(base);
+  if (std::memcmp(h->magic, kMagic, sizeof kMagic) != 0) {
+    error = "not a feature table (bad magic)";
+    return nullptr;
+  }
+  if (h->version != kVersion) {
+    error = "unsupported feature table version " + std::to_string(h->version);
+    return nullptr;
+  }
+  const bool valid =
+      h->dim > 0 && h->buckets > h->rows && (h->buckets & (h->buckets - 1)) == 0 &&
+      h->index_offset % alignof(FeatureIndexSlot) == 0 &&
+      h->keys_offset % alignof(FeatureKeyRef) == 0 && h->values_offset % alignof(float) == 0 &&
+      fits(h->index_offset, h->buckets, sizeof(FeatureIndexSlot), size) &&
+      fits(h->keys_offset, h->rows, sizeof(FeatureKeyRef), size) &&
+      h->key_bytes_offset <= size && h->rows <= UINT64_MAX / h->dim &&
+      fits(h->values_offset, h->rows * h->dim, sizeof(float), size);
+  if (!valid) {
+    error = "corrupt feature table header";
+    return nullptr;
+  }
+
+  table->header_ = h;
+  table->index_ = reinterpret_cast<const FeatureIndexSlot*>(base + h->index_offset);
+  table->keys_ = reinterpret_cast<const FeatureKeyRef*>(base + h->keys_offset);
+  table->key_bytes_ = base + h->key_bytes_offset;
+  table->key_bytes_size_ = size - h->key_bytes_offset;
+  table->values_ = reinterpret_cast<const float*>(base + h->values_offset);
+  return table;
+}
+
+FeatureTable::~FeatureTable() {
+  if (data_) ::munmap(const_cast<void*>(data_), size_);
+}
+
+const float* FeatureTable::find(std::string_view key) const {
+  const uint64_t hash = fnv1a(key);
+  const uint64_t mask = header_->buckets - 1;
+  for (uint64_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+    const FeatureIndexSlot& slot = index_[i];
+    if (slot.row_plus_one == 0) return nullptr;
+    if (slot.hash != hash) continue;
+    // Checked against the key itself: hashes collide, and the file is only
+    // trusted as far as the header checks went
+    const uint64_t row = slot.row_plus_one - 1;
+    if (row >= header_->rows) continue;
+    const FeatureKeyRef& ref = keys_[row];
+    if (ref.length == key.size() && fits(ref.offset, ref.length, 1, key_bytes_size_) &&
+        std::memcmp(key_bytes_ + ref.offset, key.data(), key.size()) == 0) {
+      return values_ + row * header_->dim;
+    }
+  }
+  return nullptr;
+}
+
+bool write_feature_table(const std::string& path, uint32_t dim,
+                         const std::vector<std::pair<std::string, std::vector<float>>>& rows,
+                         std::string& error) {
+  if (dim == 0) {
+    error = "dim must be positive";
+    return false;
+  }
+  std::unordered_set<std::string_view> seen;
+  uint64_t key_bytes = 0;
+  for (const auto& [key, values] : rows) {
+    if (values.size() != dim) {
+      error = "row '" + key + "' has " + std::to_string(values.size()) + " values, expected " +
+              std::to_string(dim);
+      return false;
+    }
+    if (!seen.insert(key).second) {
+      error = "duplicate key '" + key + "'";
+      return false;
+    }
+    key_bytes += key.size();
+  }
+
+  // Load factor at most 1/2, so probe chains stay short
+  uint64_t buckets = 16;
+  while (buckets < 2 * rows.size()) buckets <<= 1;
+
+  FeatureFileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof kMagic);
+  header.version = kVersion;
+  header.dim = dim;
+  header.rows = rows.size();
+  header.buckets = buckets;
+  header.index_offset = sizeof(FeatureFileHeader);
+  header.keys_offset = header.index_offset + buckets * sizeof(FeatureIndexSlot);
+  header.key_bytes_offset = header.keys_offset + rows.size() * sizeof(FeatureKeyRef);
+  header.values_offset = align_up(header.key_bytes_offset + key_bytes, kValuesAlign);
+
+  std::vector<FeatureIndexSlot> index(buckets, FeatureIndexSlot{0, 0});
+  std::vector<FeatureKeyRef> refs;
+  refs.reserve(rows.size());
+  uint64_t offset = 0;
+  for (size_t r = 0; r < rows.size(); r++) {
+    const std::string& key = rows[r].first;
+    uint64_t hash = fnv1a(key);
+    uint64_t i = hash & (buckets - 1);
+    while (index[i].row_plus_one != 0) i = (i + 1) & (buckets - 1);
+    index[i] = FeatureIndexSlot{hash, r + 1};
+    refs.push_back(FeatureKeyRef{offset, key.size()});
+    offset += key.size();
+  }
+
+  const std::string tmp = path + ".tmp." + std::to_string(::getpid());
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof header);
+    out.write(reinterpret_cast<const char*>(index.data()),
+              static_cast<std::streamsize>(index.size() * sizeof(FeatureIndexSlot)));
+    out.write(reinterpret_cast<const char*>(refs.data()),
+              static_cast<std::streamsize>(refs.size() * sizeof(FeatureKeyRef)));
+    for (const auto& row : rows) {
+      out.write(row.first.data(), static_cast<std::streamsize>(row.first.size()));
+    }
+    const std::string pad(header.values_offset - header.key_bytes_offset - key_bytes, '\0');
+    out.write(pad.data(), static_cast<std::streamsize>(pad.size()));
+    for (const auto& row : rows) {
+      out.write(reinterpret_cast<const char*>(row.second.data()),
+                static_cast<std::streamsize>(dim * sizeof(float)));
+    }
+    out.flush();
+    if (!out) {
+      error = "cannot write " + tmp;
+      std::remove(tmp.c_str());
+      return false;
+    }
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    error = "cannot rename to " + path + ": " + std::strerror(errno);
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+FeatureTableConfig FeatureTableConfig::from_env() {
+  FeatureTableConfig c;
+  if (const char* v = std::getenv("FEATURE_TABLE")) c.path = v;
+  // Each check is a stat(); a tiny interval would only make it spin
+  c.reload_interval = std::max(std::chrono::milliseconds(100),
+                               std::chrono::milliseconds(env_long("FEATURE_TABLE_RELOAD_MS", 1000)));
+  return c;
+}
+
+FeatureStore::FeatureStore(const FeatureTableConfig& config, metrics::Registry& registry)
+    : config_(config),
+      hits_(registry.counter("ia_features_lookups_total{result=\"hit\"}",
+                             "Entity key lookups in the feature table")),
+      misses_(registry.counter("ia_features_lookups_total{result=\"miss\"}",
+                               "Entity key lookups in the feature table")),
+      loads_ok_(registry.counter("ia_features_loads_total{result=\"ok\"}",
+                                 "Feature table (re)loads")),
+      loads_failed_(registry.counter("ia_features_loads_total{result=\"failed\"}",
+                                     "Feature table (re)loads")),
+      rows_gauge_(registry.gauge("ia_features_rows", "Rows in the feature table in use")),
+      dim_gauge_(registry.gauge("ia_features_dim", "Values per row in the feature table in use")),
+      bytes_gauge_(registry.gauge("ia_features_bytes", "Size of the feature table in use")),
+      loaded_at_gauge_(registry.gauge("ia_features_loaded_timestamp_seconds",
+                                      "When the feature table in use was loaded (Unix time)")) {
+  reload_if_changed();
+  watcher_ = std::thread([this] { watch(); });
+}
+
+FeatureStore::~FeatureStore() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  if (watcher_.joinable()) watcher_.join();
+}
+
+bool FeatureStore::reload_if_changed() {
+  struct stat st;
+  if (::stat(config_.path.c_str(), &st) != 0) {
+    // Logged once per disappearance; the table in use stays
+    if (!missing_) {
+      std::cerr << "[warn] Feature table " << config_.path << ": " << std::strerror(errno)
+                << std::endl;
+      missing_ = true;
+    }
+    seen_ = FileId{};
+    return false;
+  }
+  missing_ = false;
+  FileId id{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+            static_cast<uint64_t>(st.st_size),
+            static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+  if (id == seen_) return false;
+  seen_ = id;
+
+  std::string error;
+  auto loaded = FeatureTable::open(config_.path, error);
+  if (!loaded) {
+    loads_failed_.inc();
+    std::cerr << "[warn] Feature table " << config_.path << " not loaded: " << error
+              << (table() ? " (keeping the previous one)" : "") << std::endl;
+    return false;
+  }
+  std::atomic_store(&table_, loaded);
+  loads_ok_.inc();
+  rows_gauge_.set(static_cast<double>(loaded->rows()));
+  dim_gauge_.set(loaded->dim());
+  bytes_gauge_.set(static_cast<double>(loaded->bytes()));
+  loaded_at_gauge_.set(std::chrono::duration<double>(
+                           std::chrono::system_clock::now().time_since_epoch()).count());
+  std::cout << "[info] Feature table " << config_.path << ": " << loaded->rows()
+            << " rows x " << loaded->dim() << " values" << std::endl;
+  return true;
+}
+
+void FeatureStore::watch() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!wake_.wait_for(lock, config_.reload_interval, [this] { return stop_; })) {
+    lock.unlock();
+    reload_if_changed();
+    lock.lock();
+  }
+}
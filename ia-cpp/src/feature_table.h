@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+
+// Precomputed feature rows looked up by entity key (FEATURE_TABLE).
+//
+// Clients can send {"key": "..."} to /predict instead of the features; the
+// row comes from a read-only file that is mmap'ed, so a lookup is a hash
+// probe and a pointer into the page cache, and the row is handed to ORT as
+// the input tensor as it is (no copy, no JSON). Forked workers map the same
+// file and share its pages.
+//
+// File layout (native endianness, built by ia-feature-build):
+//
+//   header     FeatureFileHeader, 64 bytes
+//   index      `buckets` FeatureIndexSlot, open addressing with linear
+//              probing on the key's FNV-1a hash; row_plus_one 0 = empty
+//   keys       `rows` FeatureKeyRef into the key bytes, checked on every hit
+//   key bytes
+//   values     `rows` x `dim` floats, 64-byte aligned
+//
+// A table is immutable. To update it, write a new file and rename() it over
+// the old path: every FEATURE_TABLE_RELOAD_MS each worker notices the new
+// file, validates and maps it, and swaps it in atomically. Requests already
+// holding the old table finish on it; it is unmapped after the last one.
+struct FeatureFileHeader {
+  char magic[8];  // "IAFEAT01"
+  uint32_t version;
+  uint32_t dim;
+  uint64_t rows;
+  uint64_t buckets;  // power of two
+  uint64_t index_offset;
+  uint64_t keys_offset;
+  uint64_t key_bytes_offset;
+  uint64_t values_offset;
+};
+static_assert(sizeof(FeatureFileHeader) == 64, "feature file header is 64 bytes");
+
+struct FeatureIndexSlot {
+  uint64_t hash;
+  uint64_t row_plus_one;
+};
+
+struct FeatureKeyRef {
+  uint64_t offset;  // from key_bytes_offset
+  uint64_t length;
+};
+
+class FeatureTable {
+public:
+  // Maps and validates `path`; null with `error` set when it is not a
+  // well-formed feature file
+  static std::shared_ptr<const FeatureTable> open(const std::string& path, std::string& error);
+  ~FeatureTable();
+
+  FeatureTable(const FeatureTable&) = delete;
+  FeatureTable& operator=(const FeatureTable&) = delete;
+
+  // `dim` floats inside the mapping, or null for an unknown key
+  const float* find(std::string_view key) const;
+
+  uint32_t dim() const { return header_->dim; }
+  uint64_t rows() const { return header_->rows; }
+  size_t bytes() const { return size_; }
+
+private:
+  FeatureTable() = default;
+
+  const void* data_ = nullptr;
+  size_t size_ = 0;
+  const FeatureFileHeader* header_ = nullptr;
+  const FeatureIndexSlot* index_ = nullptr;
+  const FeatureKeyRef* keys_ = nullptr;
+  const char* key_bytes_ = nullptr;
+  uint64_t key_bytes_size_ = 0;
+  const float* values_ = nullptr;
+};
+
+// Writes a feature file to `path` (through a temporary file and rename, so
+// a serving process never sees it half written). Every row needs `dim`
+// values; keys must be unique.
+bool write_feature_table(const std::string& path, uint32_t dim,
+                         const std::vector<std::pair<std::string, std::vector<float>>>& rows,
+                         std::string& error);
+
+struct FeatureTableConfig {
+  std::string path;                                 // FEATURE_TABLE; empty = off
+  std::chrono::milliseconds reload_interval{1000};  // FEATURE_TABLE_RELOAD_MS, >= 100
+
+  bool enabled() const { return !path.empty(); }
+
+  static FeatureTableConfig from_env();
+};
+
+// The table in use for one worker, and the watcher that reloads it
+class FeatureStore {
+public:
+  // Loads the table (a missing or bad file only logs: lookups miss until a
+  // good one appears) and starts the watcher
+  FeatureStore(const FeatureTableConfig& config,
+               metrics::Registry& registry = metrics::registry());
+  ~FeatureStore();
+
+  FeatureStore(const FeatureStore&) = delete;
+  FeatureStore& operator=(const FeatureStore&) = delete;
+
+  // Hold on to the result for as long as a row from it is in use
+  std::shared_ptr<const FeatureTable> table() const { return std::atomic_load(&table_); }
+
+  // Counts a lookup for ia_features_lookups_total
+  void count_lookup(bool hit) { (hit ? hits_ : misses_).inc(); }
+
+private:
+  // Loads the file if it changed since the last load; true on a swap
+  bool reload_if_changed();
+  void watch();
+
+  const FeatureTableConfig config_;
+  std::shared_ptr<const FeatureTable> table_;
+
+  // File identity of the loaded table (or of the last bad one, so it is
+  // not retried until it changes)
+  struct FileId {
+    uint64_t dev = 0, ino = 0, size = 0;
+    int64_t mtime_ns = 0;
+    bool operator==(const FileId& o) const {
+      return dev == o.dev && ino == o.ino && size == o.size && mtime_ns == o.mtime_ns;
+    }
+  };
+  FileId seen_;
+  bool missing_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  std::thread watcher_;
+
+  metrics::Counter& hits_;
+  metrics::Counter& misses_;
+  metrics::Counter& loads_ok_;
+  metrics::Counter& loads_failed_;
+  metrics::Gauge& rows_gauge_;
+  metrics::Gauge& dim_gauge_;
+  metrics::Gauge& bytes_gauge_;
+  metrics::Gauge& loaded_at_gauge_;
+};
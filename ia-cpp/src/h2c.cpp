@@ -0,0 +1,403 @@
+#include "h2c.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "metrics.h"
+
+namespace {
+
+using json = nlohmann::json;
+
+struct H2cMetrics {
+  metrics::Counter& connections;
+  metrics::Counter& rejected;
+  metrics::Counter& streams;
+  metrics::Gauge& open_connections;
+};
+
+H2cMetrics& h2c_metrics() {
+  auto& r = metrics::registry();
+  static H2cMetrics m{
+      r.counter("ia_h2c_connections_total", "Accepted h2c connections"),
+      r.counter("ia_h2c_rejected_connections_total",
+                "h2c connections closed at accept (H2C_MAX_CONNECTIONS reached)"),
+      r.counter("ia_h2c_streams_total", "h2c requests (streams) handled"),
+      r.gauge("ia_h2c_open_connections", "Currently open h2c connections"),
+  };
+  return m;
+}
+
+struct Response {
+  int32_t stream_id;
+  int status;
+  std::string body;
+};
+
+// Results handed back by the batcher thread. Shared with the pending
+// callbacks so that results arriving after the connection closed are dropped.
+struct Completions {
+  std::mutex mutex;
+  std::vector<Response> ready;
+  int event_fd = -1;
+  bool closed = false;
+
+  void push(Response r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) return;
+    ready.push_back(std::move(r));
+    if (ready.size() == 1) {
+      uint64_t one = 1;
+      (void)!::write(event_fd, &one, sizeof(one));
+    }
+  }
+};
+
+class Connection {
+public:
+  Connection(int fd, const H2cOptions& options, InferenceBatcher& batcher)
+      : fd_(fd), options_(options), batcher_(batcher),
+        completions_(std::make_shared<Completions>()) {
+    completions_->event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    nghttp2_session_callbacks* cbs = nullptr;
+    nghttp2_session_callbacks_new(&cbs);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(cbs, on_begin_headers);
+    nghttp2_session_callbacks_set_on_header_callback(cbs, on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs, on_data_chunk);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(cbs, on_stream_close);
+    nghttp2_session_server_new(&session_, cbs, this);
+    nghttp2_session_callbacks_del(cbs);
+  }
+
+  ~Connection() {
+    {
+      std::lock_guard<std::mutex> lock(completions_->mutex);
+      completions_->closed = true;
+      ::close(completions_->event_fd);
+    }
+    nghttp2_session_del(session_);
+    ::shutdown(fd_, SHUT_RDWR);
+    ::close(fd_);
+  }
+
+  void serve() {
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
+         static_cast<uint32_t>(options_.max_concurrent_streams)},
+    };
+    nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings, 1);
+
+    char buf[16384];
+    std::vector<Response> ready;
+    while (nghttp2_session_want_read(session_) ||
+           nghttp2_session_want_write(session_)) {
+      if (!flush()) return;
+
+      pollfd fds[2] = {{fd_, POLLIN, 0}, {completions_->event_fd, POLLIN, 0}};
+      // Only time out when no request is waiting on the batcher
+      int timeout = streams_.empty() ? options_.idle_timeout_sec * 1000 : -1;
+      int rc = ::poll(fds, 2, timeout);
+      if (rc < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      if (rc == 0) {
+        nghttp2_session_terminate_session(session_, NGHTTP2_NO_ERROR);
+        flush();
+        return;
+      }
+
+      if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        (void)!::read(completions_->event_fd, &count, sizeof(count));
+        {
+          std::lock_guard<std::mutex> lock(completions_->mutex);
+          ready.swap(completions_->ready);
+        }
+        for (auto& r : ready) {
+          // The client may have reset the stream while it was queued
+          if (streams_.count(r.stream_id)) {
+            respond(r.stream_id, r.status, std::move(r.body), "application/json");
+          }
+        }
+        ready.clear();
+      }
+
+      if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        if (nghttp2_session_mem_recv(session_, reinterpret_cast<uint8_t*>(buf),
+                                     static_cast<size_t>(n)) < 0) {
+          return;
+        }
+      }
+    }
+  }
+
+private:
+  struct Stream {
+    std::string method;
+    std::string path;
+    std::string body;
+    bool too_large = false;
+    std::string response;
+    size_t sent = 0;
+  };
+
+  // Serializes every pending frame (often several responses finished by one
+  // batch) and writes them with a single send().
+  bool flush() {
+    out_.clear();
+    for (;;) {
+      const uint8_t* data = nullptr;
+      ssize_t n = nghttp2_session_mem_send(session_, &data);
+      if (n < 0) return false;
+      if (n == 0) break;
+      out_.append(reinterpret_cast<const char*>(data), static_cast<size_t>(n));
+    }
+    size_t off = 0;
+    while (off < out_.size()) {
+      ssize_t n = ::send(fd_, out_.data() + off, out_.size() - off, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      off += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  void respond(int32_t stream_id, int status, std::string body,
+               const char* content_type) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) return;
+    auto& s = it->second;
+    s.response = std::move(body);
+    s.sent = 0;
+
+    const auto status_str = std::to_string(status);
+    const auto length = std::to_string(s.response.size());
+    auto nv = [](const char* name, const std::string& value) {
+      return nghttp2_nv{
+          reinterpret_cast<uint8_t*>(const_cast<char*>(name)),
+          reinterpret_cast<uint8_t*>(const_cast<char*>(value.data())),
+          std::strlen(name), value.size(), NGHTTP2_NV_FLAG_NONE};
+    };
+    const std::string type(content_type);
+    nghttp2_nv headers[] = {nv(":status", status_str), nv("content-type", type),
+                            nv("content-length", length)};
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = &s;
+    provider.read_callback = read_body;
+    nghttp2_submit_response(session_, stream_id, headers, 3, &provider);
+  }
+
+  void respond_error(int32_t stream_id, int status, const std::string& message) {
+    json error_response;
+    error_response["error"] = message;
+    respond(stream_id, status, error_response.dump(), "application/json");
+  }
+
+  void handle(int32_t stream_id) {
+    auto& s = streams_[stream_id];
+    h2c_metrics().streams.inc();
+
+    if (s.path == "/health") {
+      if (s.method == "GET") return respond(stream_id, 200, "ok", "text/plain");
+      return respond_error(stream_id, 405, "Method not allowed");
+    }
+    if (s.path != "/predict") return respond_error(stream_id, 404, "Not found");
+    if (s.method != "POST") return respond_error(stream_id, 405, "Method not allowed");
+    if (s.too_large) return respond_error(stream_id, 413, "Payload too large");
+
+    float x = 0.0f;
+    try {
+      json body = json::parse(s.body);
+      // Feature tables are only wired into the HTTP/1.1 handler
+      if (body.is_object() && body.contains("key")) {
+        return respond_error(stream_id, 400, "key lookups not supported on this transport");
+      }
+      if (!body.contains("x") || !body["x"].is_number()) {
+        return respond_error(stream_id, 400, "x must be a number");
+      }
+      x = body["x"].get<float>();
+    } catch (const json::parse_error& e) {
+      return respond_error(stream_id, 400, "Invalid JSON: " + std::string(e.what()));
+    }
+
+    auto completions = completions_;
+    bool queued = batcher_.submit(x, [completions, stream_id](json result) {
+      int status = result.contains("error") ? 500 : 200;
+      completions->push(Response{stream_id, status, result.dump()});
+    });
+    if (!queued) respond_error(stream_id, 503, "Server busy");
+  }
+
+  static ssize_t read_body(nghttp2_session*, int32_t, uint8_t* buf,
+                           size_t length, uint32_t* flags,
+                           nghttp2_data_source* source, void*) {
+    auto* s = static_cast<Stream*>(source->ptr);
+    size_t n = std::min(length, s->response.size() - s->sent);
+    std::memcpy(buf, s->response.data() + s->sent, n);
+    s->sent += n;
+    if (s->sent == s->response.size()) *flags |= NGHTTP2_DATA_FLAG_EOF;
+    return static_cast<ssize_t>(n);
+  }
+
+  static int on_begin_headers(nghttp2_session*, const nghttp2_frame* frame,
+                              void* user_data) {
+    if (frame->hd.type == NGHTTP2_HEADERS &&
+        frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+      static_cast<Connection*>(user_data)->streams_.emplace(frame->hd.stream_id,
+                                                            Stream{});
+    }
+    return 0;
+  }
+
+  static int on_header(nghttp2_session*, const nghttp2_frame* frame,
+                       const uint8_t* name, size_t namelen,
+                       const uint8_t* value, size_t valuelen, uint8_t,
+                       void* user_data) {
+    auto* c = static_cast<Connection*>(user_data);
+    auto it = c->streams_.find(frame->hd.stream_id);
+    if (it == c->streams_.end()) return 0;
+    std::string key(reinterpret_cast<const char*>(name), namelen);
+    std::string val(reinterpret_cast<const char*>(value), valuelen);
+    if (key == ":method") {
+      it->second.method = std::move(val);
+    } else if (key == ":path") {
+      it->second.path = val.substr(0, val.find('?'));
+    }
+    return 0;
+  }
+
+  static int on_data_chunk(nghttp2_session*, uint8_t, int32_t stream_id,
+                           const uint8_t* data, size_t len, void* user_data) {
+    auto* c = static_cast<Connection*>(user_data);
+    auto it = c->streams_.find(stream_id);
+    if (it == c->streams_.end()) return 0;
+    auto& s = it->second;
+    if (s.too_large || s.body.size() + len > c->options_.max_body_bytes) {
+      s.too_large = true;
+      s.body.clear();
+    } else {
+      s.body.append(reinterpret_cast<const char*>(data), len);
+    }
+    return 0;
+  }
+
+  static int on_frame_recv(nghttp2_session*, const nghttp2_frame* frame,
+                           void* user_data) {
+    auto* c = static_cast<Connection*>(user_data);
+    if ((frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA) &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) &&
+        c->streams_.count(frame->hd.stream_id)) {
+      c->handle(frame->hd.stream_id);
+    }
+    return 0;
+  }
+
+  static int on_stream_close(nghttp2_session*, int32_t stream_id, uint32_t,
+                             void* user_data) {
+    static_cast<Connection*>(user_data)->streams_.erase(stream_id);
+    return 0;
+  }
+
+  int fd_;
+  const H2cOptions options_;
+  InferenceBatcher& batcher_;
+  std::shared_ptr<Completions> completions_;
+  nghttp2_session* session_ = nullptr;
+  // Node-based, so Stream pointers given to nghttp2 stay valid
+  std::unordered_map<int32_t, Stream> streams_;
+  std::string out_;
+};
+
+} // namespace
+
+bool start_h2c_server(const H2cOptions& options, InferenceBatcher& batcher) {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (fd >= 0) {
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Prefork workers each bind their own listener on the same port
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(options.port));
+  if (fd < 0 ||
+      ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    std::cerr << "[error] h2c listener on port " << options.port << ": "
+              << std::strerror(errno) << std::endl;
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+
+  h2c_metrics();
+  std::thread([fd, options, &batcher] {
+    static std::atomic<size_t> open{0};
+    auto& m = h2c_metrics();
+    for (;;) {
+      int conn = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (conn < 0) {
+        // Out of descriptors: back off instead of spinning on accept
+        if (errno == EMFILE || errno == ENFILE) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        continue;
+      }
+      // One thread per connection: the cap bounds threads and their buffers
+      if (options.max_connections > 0 && open.load() >= options.max_connections) {
+        m.rejected.inc();
+        ::close(conn);
+        continue;
+      }
+      int nodelay = 1;
+      ::setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+      // flush() blocks in send(); a client that stops reading must not
+      // hold the thread forever
+      timeval send_timeout{options.send_timeout_sec, 0};
+      ::setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+      // Only this thread increments, so the check above cannot overshoot
+      m.connections.inc();
+      m.open_connections.set(static_cast<double>(++open));
+      std::thread([conn, options, &batcher] {
+        {
+          Connection c(conn, options, batcher);
+          c.serve();
+        }
+        h2c_metrics().open_connections.set(static_cast<double>(--open));
+      }).detach();
+    }
+  }).detach();
+
+  std::cout << "[info] h2c (HTTP/2 prior knowledge) listening on port "
+            << options.port << " max_streams=" << options.max_concurrent_streams
+            << " max_connections=" << options.max_connections << std::endl;
+  return true;
+}
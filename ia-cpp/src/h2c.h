@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "batcher.h"
+
+// HTTP/2 cleartext (h2c, prior knowledge) listener for backend clients
+// (-DIA_H2C=ON, needs libnghttp2).
+//
+// With HTTP/1.1 a client needs one connection, and one httplib worker, per
+// in-flight request. Here one connection carries up to
+// `max_concurrent_streams` requests: each POST /predict stream is handed to
+// the inference batcher as soon as its body is complete, and responses are
+// written back as batches finish, in whatever order that happens. There is
+// one thread per connection, not per request, and HPACK compresses the
+// repeated request headers down to a few bytes.
+//
+// Routes: POST /predict ({"x": <number>}) and GET /health.
+//
+// Connections past `max_connections` are closed right after accept, and a
+// client that stops reading has its connection dropped once a send has been
+// blocked for `send_timeout_sec`.
+struct H2cOptions {
+  int port = 0;
+  size_t max_concurrent_streams = 256;
+  size_t max_body_bytes = 1 << 20;
+  size_t max_connections = 0;  // 0 = unlimited
+  int idle_timeout_sec = 60;
+  int send_timeout_sec = 10;
+};
+
+// Starts the accept loop on a background thread. Returns false if the port
+// cannot be bound.
+bool start_h2c_server(const H2cOptions& options, InferenceBatcher& batcher);
@@ -0,0 +1,257 @@
+#include "hugepages.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <gnu/libc-version.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "resources.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22  // Linux 5.14
+#endif
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4  // Linux 4.4
+#endif
+
+namespace {
+
+constexpr size_t kHugePage = 2 << 20;
+
+size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+HugePageConfig::Mode parse_mode(const char* name) {
+  const char* v = std::getenv(name);
+  if (!v || !*v || std::strcmp(v, "off") == 0 || std::strcmp(v, "0") == 0) {
+    return HugePageConfig::Mode::off;
+  }
+  if (std::strcmp(v, "thp") == 0 || std::strcmp(v, "1") == 0) {
+    return HugePageConfig::Mode::thp;
+  }
+  if (std::strcmp(v, "explicit") == 0) return HugePageConfig::Mode::explicit_pages;
+  std::cerr << "[warn] Unknown " << name << " '" << v << "' (off, thp or explicit)"
+            << std::endl;
+  return HugePageConfig::Mode::off;
+}
+
+bool glibc_has_hugetlb_tunable() {
+  int major = 0, minor = 0;
+  return std::sscanf(gnu_get_libc_version(), "%d.%d", &major, &minor) == 2 &&
+         (major > 2 || (major == 2 && minor >= 35));
+}
+
+// 2 MiB-aligned anonymous memory that THP may back; the reservation is one
+// huge page larger and trimmed on both sides
+void* map_thp(size_t len) {
+  void* raw = ::mmap(nullptr, len + kHugePage, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) return nullptr;
+  auto start = reinterpret_cast<uintptr_t>(raw);
+  auto aligned = round_up(start, kHugePage);
+  if (aligned > start) ::munmap(raw, aligned - start);
+  size_t tail = start + len + kHugePage - (aligned + len);
+  if (tail > 0) ::munmap(reinterpret_cast<void*>(aligned + len), tail);
+  ::madvise(reinterpret_cast<void*>(aligned), len, MADV_HUGEPAGE);
+  return reinterpret_cast<void*>(aligned);
+}
+
+bool read_all(int fd, char* out, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::pread(fd, out + done, std::min<size_t>(size - done, 1 << 30),
+                        static_cast<off_t>(done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void prefault(const void* addr, size_t size) {
+  if (::madvise(const_cast<void*>(addr), size, MADV_POPULATE_READ) == 0) return;
+  // Before 5.14: touch a byte per page
+  const long page = ::sysconf(_SC_PAGESIZE);
+  volatile const char* p = static_cast<const char*>(addr);
+  for (size_t off = 0; off < size; off += static_cast<size_t>(page)) (void)p[off];
+}
+
+} // namespace
+
+HugePageConfig HugePageConfig::from_env() {
+  HugePageConfig c;
+  c.model = parse_mode("MODEL_HUGEPAGES");
+  c.arena = parse_mode("ARENA_HUGEPAGES");
+  c.prefault = env_long("MODEL_PREFAULT", 0) != 0;
+  c.mlock = env_long("MODEL_MLOCK", 0) != 0;
+  return c;
+}
+
+void apply_arena_hugepages(const HugePageConfig& config, char** argv) {
+  if (config.arena == HugePageConfig::Mode::off) return;
+  const char* current = std::getenv("GLIBC_TUNABLES");
+  std::string tunables = current ? current : "";
+  auto set = tunables.find("glibc.malloc.hugetlb=");
+  if (set != std::string::npos) {
+    // Set by us before the re-exec, or by the operator
+    std::cout << "[info] ARENA_HUGEPAGES: " << tunables.substr(set, 22) << std::endl;
+    return;
+  }
+  if (!glibc_has_hugetlb_tunable()) {
+    std::cerr << "[warn] ARENA_HUGEPAGES needs glibc 2.35+ (have "
+              << gnu_get_libc_version() << "), ignored" << std::endl;
+    return;
+  }
+  // malloc reads its tunables once, at exec
+  tunables += std::string(tunables.empty() ? "" : ":") + "glibc.malloc.hugetlb=" +
+              (config.arena == HugePageConfig::Mode::thp ? "1" : "2");
+  ::setenv("GLIBC_TUNABLES", tunables.c_str(), 1);
+  ::execv("/proc/self/exe", argv);
+  std::cerr << "[warn] ARENA_HUGEPAGES: re-exec failed (" << std::strerror(errno)
+            << "), arenas keep normal pages" << std::endl;
+}
+
+ModelMapping map_model_file(const std::string& path, const HugePageConfig& config) {
+  ModelMapping mapping;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st{};
+  if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size <= 0) {
+    std::cerr << "[warn] Cannot open model " << path << std::endl;
+    if (fd >= 0) ::close(fd);
+    return mapping;
+  }
+  const auto size = static_cast<size_t>(st.st_size);
+
+  if (config.model == HugePageConfig::Mode::off) {
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "[warn] Cannot map model " << path << std::endl;
+      return mapping;
+    }
+    ::madvise(addr, size, MADV_WILLNEED);
+    if (config.prefault) prefault(addr, size);
+    mapping.data = addr;
+    mapping.size = size;
+    mapping.backing = "file";
+  } else {
+    const size_t len = round_up(size, kHugePage);
+    void* mem = nullptr;
+    mapping.backing = "thp";
+    if (config.model == HugePageConfig::Mode::explicit_pages) {
+      mem = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (mem == MAP_FAILED) {
+        std::cerr << "[warn] MODEL_HUGEPAGES=explicit: no " << len / kHugePage
+                  << " free 2 MiB pages (vm.nr_hugepages), using thp" << std::endl;
+        mem = nullptr;
+      } else {
+        mapping.backing = "hugetlb";
+      }
+    }
+    if (!mem) mem = map_thp(len);
+    // The copy faults every page in, so there is nothing left to prefault
+    if (!mem || !read_all(fd, static_cast<char*>(mem), size)) {
+      std::cerr << "[warn] Cannot load model " << path << " into "
+                << mapping.backing << " memory" << std::endl;
+      if (mem) ::munmap(mem, len);
+      ::close(fd);
+      return ModelMapping{};
+    }
+    ::close(fd);
+    ::mprotect(mem, len, PROT_READ);
+    mapping.data = mem;
+    mapping.size = size;
+  }
+
+  if (config.mlock && ::mlock(mapping.data, mapping.size) != 0) {
+    std::cerr << "[warn] MODEL_MLOCK: cannot lock the model (" << std::strerror(errno)
+              << "; raise RLIMIT_MEMLOCK)" << std::endl;
+  }
+  return mapping;
+}
+
+MemoryResidency measure_residency(const void* addr, size_t size) {
+  MemoryResidency r;
+  r.bytes = size;
+  if (!addr || size == 0) return r;
+
+  const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  const auto start = reinterpret_cast<uintptr_t>(addr) / page * page;
+  const auto end = reinterpret_cast<uintptr_t>(addr) + size;
+  std::vector<unsigned char> pages(round_up(end - start, page) / page);
+  if (::mincore(reinterpret_cast<void*>(start), end - start, pages.data()) == 0) {
+    r.resident = static_cast<size_t>(
+                     std::count_if(pages.begin(), pages.end(),
+                                   [](unsigned char p) { return p & 1; })) *
+                 page;
+    r.resident = std::min(r.resident, size);
+  }
+
+  // Huge-page backed bytes per VMA, prorated to the part of the VMA that
+  // overlaps the range (anonymous VMAs can merge with their neighbours)
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  uintptr_t vma_start = 0, vma_end = 0;
+  bool inside = false;
+  double huge = 0;
+  while (std::getline(smaps, line)) {
+    unsigned long long a = 0, b = 0;
+    if (std::sscanf(line.c_str(), "%llx-%llx ", &a, &b) == 2 && line.find(':') > line.find(' ')) {
+      vma_start = a;
+      vma_end = b;
+      inside = vma_start < end && vma_end > start;
+      continue;
+    }
+    if (!inside) continue;
+    for (const char* key : {"AnonHugePages:", "FilePmdMapped:", "ShmemPmdMapped:",
+                            "Private_Hugetlb:", "Shared_Hugetlb:"}) {
+      if (line.rfind(key, 0) == 0) {
+        double kb = std::strtod(line.c_str() + std::strlen(key), nullptr);
+        double overlap = static_cast<double>(std::min(vma_end, end) - std::max(vma_start, start));
+        huge += kb * 1024 * overlap / static_cast<double>(vma_end - vma_start);
+      }
+    }
+  }
+  r.huge = std::min(size, static_cast<size_t>(huge));
+  return r;
+}
+
+void report_model_residency(const ModelMapping& model) {
+  MemoryResidency r = measure_residency(model.data, model.size);
+  double resident = r.bytes ? static_cast<double>(r.resident) / r.bytes : 0;
+  double huge = r.bytes ? static_cast<double>(r.huge) / r.bytes : 0;
+  std::cout << "[info] Model memory: " << r.bytes / (1 << 20) << " MiB ("
+            << model.backing << "), " << static_cast<int>(resident * 100)
+            << "% resident, " << static_cast<int>(huge * 100) << "% in huge pages"
+            << std::endl;
+  auto& reg = metrics::registry();
+  reg.gauge("ia_model_memory_bytes", "Size of the loaded model file")
+      .set(static_cast<double>(r.bytes));
+  reg.gauge("ia_model_resident_ratio", "Fraction of the model in memory at startup")
+      .set(resident);
+  reg.gauge("ia_model_hugepage_ratio", "Fraction of the model backed by huge pages at startup")
+      .set(huge);
+}
+
+void lock_after_warmup(const HugePageConfig& config) {
+  if (!config.mlock) return;
+  if (::mlockall(MCL_CURRENT | MCL_ONFAULT) != 0) {
+    std::cerr << "[warn] MODEL_MLOCK: cannot lock the arenas (" << std::strerror(errno)
+              << "; raise RLIMIT_MEMLOCK)" << std::endl;
+    return;
+  }
+  std::cout << "[info] MODEL_MLOCK: resident memory locked after warm-up" << std::endl;
+}
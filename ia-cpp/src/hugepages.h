@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Huge-page backing and pre-faulting for the model and ORT's arenas.
+//
+// With 4 KiB pages a large model costs a page fault per page the first time
+// each weight is read (early p99) and a TLB entry per page afterwards (steady
+// state cycles). Here the model can be loaded into 2 MiB pages instead, and
+// everything can be faulted in, and optionally locked, before the service
+// reports ready.
+//
+//   MODEL_HUGEPAGES   off: map the file (page cache, as before)
+//                     thp: copy into anonymous memory with MADV_HUGEPAGE
+//                     explicit: copy into MAP_HUGETLB pages (vm.nr_hugepages),
+//                               falling back to thp when the pool is short
+//   ARENA_HUGEPAGES   off, thp or explicit for ORT's arena and everything
+//                     else malloc hands out: sets glibc's malloc.hugetlb
+//                     tunable (glibc 2.35+), which needs a re-exec at startup
+//   MODEL_PREFAULT    fault the whole model in at load, and warm every
+//                     session up (one single and one full batch) before
+//                     it is marked ready, so the arena has grown already
+//   MODEL_MLOCK       mlock the model; after warm-up, lock whatever else is
+//                     resident (arenas) with MCL_ONFAULT. Needs RLIMIT_MEMLOCK.
+//
+// The copies are private anonymous memory made before --workers forks, so
+// the workers still share the pages (copy-on-write, never written).
+struct HugePageConfig {
+  enum class Mode { off, thp, explicit_pages };
+
+  Mode model = Mode::off;
+  Mode arena = Mode::off;
+  bool prefault = false;
+  bool mlock = false;
+
+  static HugePageConfig from_env();
+};
+
+// Re-execs the process with GLIBC_TUNABLES=...:glibc.malloc.hugetlb=1|2 when
+// ARENA_HUGEPAGES asks for it and the tunable is not set yet. Call first
+// thing in main(), before any thread exists; returns if no re-exec happened.
+void apply_arena_hugepages(const HugePageConfig& config, char** argv);
+
+struct ModelMapping {
+  const void* data = nullptr;
+  size_t size = 0;
+  std::string backing;  // "file", "thp", "hugetlb"
+};
+
+// Loads the model file as configured; empty mapping (and a warning) on error
+ModelMapping map_model_file(const std::string& path, const HugePageConfig& config);
+
+struct MemoryResidency {
+  size_t bytes = 0;
+  size_t resident = 0;  // mincore
+  size_t huge = 0;      // backed by PMD-mapped THP or hugetlb pages (smaps)
+};
+
+MemoryResidency measure_residency(const void* addr, size_t size);
+
+// Logs the model's resident and huge-page fractions and exports them as
+// ia_model_memory_bytes, ia_model_resident_ratio and ia_model_hugepage_ratio
+void report_model_residency(const ModelMapping& model);
+
+// MODEL_MLOCK after warm-up: locks what is resident now (arenas included)
+// and what gets faulted later
+void lock_after_warmup(const HugePageConfig& config);
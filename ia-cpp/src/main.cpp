@@ -2,58 +2,300 @@
 #include <string>
 #include <memory>
 #include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <nlohmann/json.hpp>
+#include <unistd.h>
 
 // ONNX Runtime (optional)
 #ifdef WITH_ORT
 #include <onnxruntime_cxx_api.h>
 #include <optional>
 #include <array>
+#include <deque>
+#include <sys/resource.h>
+#include <mutex>
+#include <thread>
+#ifdef ORT_API_MANUAL_INIT
+#include <dlfcn.h>
+#endif
 #endif
 
 // HTTP server
 #include "httplib.h"
 
+#include "admin.h"
+#include "autotune.h"
+#include "batcher.h"
+#include "busy_poll.h"
+#include "cascade.h"
+#include "cors.h"
+#include "cpu_profiler.h"
+#include "ensemble.h"
+#include "feature_table.h"
+#include "hugepages.h"
+#include "metrics.h"
+#include "ort_profile.h"
+#include "prefork.h"
+#include "resources.h"
+#include "shm_server.h"
+#include "startup.h"
+#include "uring_server.h"
+#include "ws.h"
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+#include "tls.h"
+#endif
+#ifdef WITH_H2C
+#include "h2c.h"
+#endif
+
 using json = nlohmann::json;
 
+// Model served by default (MODEL_PATH overrides it). A minimal ORT build
+// (IA_ORT_MINIMAL) only reads ORT format, so it defaults to the .ort file.
+#ifndef IA_MODEL_PATH
+#define IA_MODEL_PATH "models/model.onnx"
+#endif
+
 // Inference result structure
 struct InferenceResult {
     json body;
     bool used_model = false;
 };
 
-// Global variables
-bool model_loaded = false;
+// Global variables. The model loads in the background after the listener
+// is up; handlers check model_loaded before touching ort_ctx.
+std::atomic<bool> model_loaded{false};
+
 #ifdef WITH_ORT
-std::optional<OrtContext> ort_ctx;
+// Memoria de ORT: arena de CPU y memory pattern. Con la estrategia por
+// defecto de ORT (potencia de dos) y lotes de tamano variable la arena crece
+// a saltos y la RSS no vuelve a bajar.
+struct OrtMemorySettings {
+  bool arena{true};               // ORT_ARENA=0: sin arena, malloc directo
+  int extendStrategy{1};          // 0 = potencia de dos, 1 = lo que se pide
+  int initialChunkBytes{-1};      // -1 = defecto de ORT
+  size_t maxBytes{0};             // 0 = sin limite
+  int maxDeadBytesPerChunk{-1};
+  bool memPattern{true};
+  size_t shrinkBatch{0};          // lotes >= N encogen la arena al terminar; 0 = nunca
+
+  static OrtMemorySettings fromEnv();
+};
+
+static bool envFlag(const char* name, bool def) {
+  const char* v = std::getenv(name);
+  if (!v || !*v) return def;
+  return !(std::strcmp(v, "0") == 0 || std::strcmp(v, "false") == 0);
+}
+
+OrtMemorySettings OrtMemorySettings::fromEnv() {
+  OrtMemorySettings m;
+  m.arena = envFlag("ORT_ARENA", true);
+  if (const char* v = std::getenv("ORT_ARENA_EXTEND_STRATEGY")) {
+    std::string strategy = v;
+    if (strategy == "next_power_of_two") {
+      m.extendStrategy = 0;
+    } else if (strategy != "same_as_requested" && !strategy.empty()) {
+      std::cerr << "[warn] Unknown ORT_ARENA_EXTEND_STRATEGY '" << strategy
+                << "', using same_as_requested" << std::endl;
+    }
+  }
+  m.initialChunkBytes = static_cast<int>(std::min<long>(
+      env_long("ORT_ARENA_INITIAL_CHUNK_BYTES", -1), INT32_MAX));
+  m.maxBytes = static_cast<size_t>(env_long("ORT_ARENA_MAX_BYTES", 0));
+  m.maxDeadBytesPerChunk = static_cast<int>(std::min<long>(
+      env_long("ORT_ARENA_MAX_DEAD_BYTES_PER_CHUNK", -1), INT32_MAX));
+  m.memPattern = envFlag("ORT_MEM_PATTERN", true);
+  m.shrinkBatch = static_cast<size_t>(env_long("ORT_ARENA_SHRINK_BATCH", 0));
+  return m;
+}
+
+// Version de la biblioteca cargada, para los logs
+static std::string ortVersion;
+
+#ifdef ORT_API_MANUAL_INIT
+// libonnxruntime.so no se enlaza: se abre con dlopen en el hilo de carga,
+// despues de que el listener ya escucha. Enlazarla hacia que el cargador
+// dinamico la mapeara y reubicara entera antes de main(), y eso era buena
+// parte del arranque en frio. ORT_LIBRARY cambia la ruta; por defecto se
+// busca con el RUNPATH del ejecutable y LD_LIBRARY_PATH.
+static bool loadOrtLibrary(std::string& error) {
+  static std::once_flag once;
+  static bool loaded = false;
+  static std::string loadError;
+  std::call_once(once, [] {
+    const char* path = std::getenv("ORT_LIBRARY");
+    if (!path || !*path) path = "libonnxruntime.so";
+    auto t0 = std::chrono::steady_clock::now();
+    void* handle = ::dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+      loadError = std::string("dlopen: ") + ::dlerror();
+      return;
+    }
+    using GetApiBase = const OrtApiBase* (*)();
+    auto getApiBase = reinterpret_cast<GetApiBase>(::dlsym(handle, "OrtGetApiBase"));
+    const OrtApiBase* base = getApiBase ? getApiBase() : nullptr;
+    if (!base) {
+      loadError = std::string(path) + " does not export OrtGetApiBase";
+      return;
+    }
+    // La biblioteca debe ser al menos tan nueva como las cabeceras
+    const OrtApi* api = base->GetApi(ORT_API_VERSION);
+    if (!api) {
+      loadError = std::string("ONNX Runtime ") + base->GetVersionString() +
+                  " does not provide API version " + std::to_string(ORT_API_VERSION);
+      return;
+    }
+    Ort::InitApi(api);
+    ortVersion = base->GetVersionString();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    metrics::registry()
+        .gauge("ia_ort_library_load_seconds", "Time to dlopen and relocate libonnxruntime")
+        .set(secs);
+    std::cerr << "[info] ONNX Runtime " << ortVersion << " loaded from " << path
+              << " in " << secs << " s" << std::endl;
+    loaded = true;
+  });
+  error = loadError;
+  return loaded;
+}
+#else
+static bool loadOrtLibrary(std::string&) {
+  if (ortVersion.empty()) ortVersion = OrtGetApiBase()->GetVersionString();
+  return true;
+}
 #endif
 
-#ifdef WITH_ORT
+// Un solo Env por proceso, con la arena de CPU registrada en el: todas las
+// sesiones la comparten (session.use_env_allocators) en vez de crear una
+// cada una
+static std::unique_ptr<Ort::Env> ortEnv;
+static std::mutex ortEnvMutex;  // las sesiones se crean en paralelo
+
+static Ort::Env& sharedOrtEnv(const OrtMemorySettings& mem) {
+  std::lock_guard<std::mutex> lock(ortEnvMutex);
+  if (ortEnv) return *ortEnv;
+  ortEnv = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "ia-cpp");
+  if (mem.arena) {
+    Ort::MemoryInfo info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    Ort::ArenaCfg cfg(mem.maxBytes, mem.extendStrategy, mem.initialChunkBytes,
+                      mem.maxDeadBytesPerChunk);
+    ortEnv->CreateAndRegisterAllocator(info, cfg);
+  }
+  return *ortEnv;
+}
+
 struct OrtContext {
-  std::unique_ptr<Ort::Env> env;
   std::unique_ptr<Ort::Session> session;
+  // Descriptor de CPU para envolver las entradas; se crea una vez, no por Run()
+  Ort::MemoryInfo inputMem{nullptr};
+  bool arena{false};
+  size_t shrinkBatch{0};
   std::string input_name{"input"};
   std::string output_name{"output"};
+  std::string aux_output_name;  // segunda salida, si la hay (incertidumbre de la cascada)
   std::string ort_version;
   size_t num_inputs{0};
   size_t num_outputs{0};
+  bool batched{false};  // primera dimension dinamica: admite lotes [N]
+};
+
+std::optional<OrtContext> ort_ctx;
+
+// Captura de /admin/profile: copia las entradas servidas mientras dura
+ProfileCapture profile_capture;
+
+// Fichero del modelo mapeado en memoria (o copiado a paginas grandes, ver
+// hugepages.h). Con --workers se carga una sola vez antes del fork y todos
+// los procesos leen las mismas paginas.
+struct ModelBytes {
+  const void* data{nullptr};
+  size_t size{0};
 };
 
+ModelBytes model_file;
+
+static ModelBytes mapModel(const std::string& modelPath, const HugePageConfig& pages) {
+  ModelMapping mapping = map_model_file(modelPath, pages);
+  if (mapping.data) report_model_residency(mapping);
+  return ModelBytes{mapping.data, mapping.size};
+}
+
 static void releaseOrtContext(OrtContext& ctx) {
   // (unique_ptr se encarga solo)
 }
 
-static std::optional<OrtContext> tryLoadOrt(const std::string& modelPath) {
+// Con profilePrefix se crea la sesion de perfilado de /admin/profile: un
+// solo hilo, arena propia y sin giro, para no competir con la de servicio
+static std::optional<OrtContext> tryLoadOrt(const ModelBytes& model,
+                                            const ResourceBudget& budget,
+                                            const BusyPollConfig& busy,
+                                            const char* profilePrefix = nullptr) {
+  if (!model.data) return std::nullopt;
+  const bool profiling = profilePrefix != nullptr;
+
+  std::string libraryError;
+  if (!loadOrtLibrary(libraryError)) {
+    std::cerr << "[warn] ONNX Runtime not loaded: " << libraryError << std::endl;
+    return std::nullopt;
+  }
+
+  const OrtMemorySettings mem = OrtMemorySettings::fromEnv();
+  Ort::Env& env = sharedOrtEnv(mem);
+
   OrtContext ctx;
-  ctx.env = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "ia-cpp");
-  ctx.ort_version = OrtGetApiBase()->GetVersionString();
+  ctx.ort_version = ortVersion;
+  ctx.inputMem = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
+  ctx.arena = mem.arena && !profiling;
+  ctx.shrinkBatch = ctx.arena ? mem.shrinkBatch : 0;
 
   Ort::SessionOptions opts;
-  // Config opcional, p.ej. threads:
-  // opts.SetIntraOpNumThreads(1);
+  if (profiling) {
+    opts.EnableProfiling(profilePrefix);
+    opts.EnableCpuMemArena();
+  } else if (mem.arena) {
+    opts.EnableCpuMemArena();
+    opts.AddConfigEntry("session.use_env_allocators", "1");
+  } else {
+    opts.DisableCpuMemArena();
+  }
+  // El memory pattern planifica los buffers para una forma de entrada fija;
+  // con lotes de tamano variable se replanifica en cada cambio
+  if (mem.memPattern) {
+    opts.EnableMemPattern();
+  } else {
+    opts.DisableMemPattern();
+  }
+  // Threads segun el presupuesto del cgroup, no los cores del host
+  opts.SetIntraOpNumThreads(profiling ? 1 : budget.ort_intra_threads);
+  opts.SetInterOpNumThreads(profiling ? 1 : budget.ort_inter_threads);
+  // Con un modelo en formato ORT los pesos se usan directamente desde el
+  // mapeo compartido en lugar de copiarse en cada proceso (ONNX los copia)
+  opts.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+  opts.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+  // Modo busy-poll: los hilos de ORT tambien giran en vez de dormir entre
+  // Run() y van fijados a los cores que siguen a los del pool HTTP y el
+  // batcher (la lista de afinidades cubre los hilos del pool, no el que
+  // llama a Run(); los ids de ORT empiezan en 1)
+  if (busy.enabled && !profiling) {
+    opts.AddConfigEntry("session.intra_op.allow_spinning", "1");
+    opts.AddConfigEntry("session.inter_op.allow_spinning", "1");
+    if (budget.ort_intra_threads > 1 && !busy.cpus.empty()) {
+      std::string affinities;
+      for (int i = 0; i + 1 < budget.ort_intra_threads; i++) {
+        if (i > 0) affinities += ';';
+        affinities += std::to_string(busy.cpu(budget.http_threads + 1 + i) + 1);
+      }
+      opts.AddConfigEntry("session.intra_op_thread_affinities", affinities.c_str());
+    }
+  }
 
   try {
-    ctx.session = std::make_unique<Ort::Session>(*ctx.env, modelPath.c_str(), opts);
+    ctx.session = std::make_unique<Ort::Session>(env, model.data, model.size, opts);
   } catch (const Ort::Exception& e) {
     std::cerr << "[warn] ORT failed to create session: " << e.what() << std::endl;
     return std::nullopt;
@@ -77,26 +319,52 @@ static std::optional<OrtContext> tryLoadOrt(const std::string& modelPath) {
       if (name) ctx.output_name = name.get();
     } catch (...) {}
   }
+  if (ctx.num_outputs > 1) {
+    try {
+      auto name = ctx.session->GetOutputNameAllocated(1, allocator);
+      if (name) ctx.aux_output_name = name.get();
+    } catch (...) {}
+  }
+
+  // Si la primera dimension de la entrada es dinamica, el batcher puede
+  // ejecutar N entradas en un solo Run()
+  if (ctx.num_inputs > 0) {
+    try {
+      auto shape = ctx.session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+      ctx.batched = !shape.empty() && shape[0] < 0;
+    } catch (...) {}
+  }
+
+  if (profiling) return ctx;
 
   // Log informativo
   std::cerr << "[info] ONNX Runtime session created. Inputs(" << ctx.num_inputs
             << ") name0=" << ctx.input_name
             << " | Outputs(" << ctx.num_outputs
-            << ") name0=" << ctx.output_name << std::endl;
+            << ") name0=" << ctx.output_name
+            << " | batched=" << (ctx.batched ? "yes" : "no") << std::endl;
+  std::cerr << "[info] ORT memory: arena=" << (mem.arena ? "shared" : "off");
+  if (mem.arena) {
+    std::cerr << " extend=" << (mem.extendStrategy == 0 ? "next_power_of_two" : "same_as_requested")
+              << " max=" << (mem.maxBytes ? std::to_string(mem.maxBytes) : "unlimited")
+              << " shrink_batch=" << mem.shrinkBatch;
+  }
+  std::cerr << " mem_pattern=" << (mem.memPattern ? "on" : "off") << std::endl;
 
   return ctx;
 }
 
-static InferenceResult runOrt(OrtContext& ctx, float x_val) {
+// Una entrada: x como tensor [1], o una fila de dim valores de la tabla de
+// features como tensor [1, dim], leida directamente del mapeo sin copiarla
+static InferenceResult runOrt(OrtContext& ctx, const float* row, size_t dim) {
   InferenceResult res;
   res.used_model = true;
+  const float x_val = row[0];
 
   try {
-    // Entrada: tensor float [1]
-    Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-    std::array<int64_t, 1> shape{1};
-    auto input_tensor = Ort::Value::CreateTensor<float>(mem, &x_val, /*value_count*/ 1,
-                                                        shape.data(), shape.size());
+    std::array<int64_t, 2> shape{1, static_cast<int64_t>(dim)};
+    auto input_tensor = Ort::Value::CreateTensor<float>(ctx.inputMem, const_cast<float*>(row), dim,
+                                                        shape.data(), dim > 1 ? 2 : 1);
 
     const char* in_names[]  = { ctx.input_name.c_str()  };
     const char* out_names[] = { ctx.output_name.c_str() };
@@ -128,35 +396,351 @@ static InferenceResult runOrt(OrtContext& ctx, float x_val) {
   res.body = json{{"y", y}, {"note", "dummy: ORT run failed"}};
   return res;
 }
-#endif
 
-// CORS helper function
-void add_cors_headers(httplib::Response& res, const std::string& allow_origin) {
-    if (!allow_origin.empty()) {
-        res.set_header("Access-Control-Allow-Origin", allow_origin);
+static InferenceResult runOrt(OrtContext& ctx, float x_val) {
+  return runOrt(ctx, &x_val, 1);
+}
+
+// Un Run() con entrada [n] y n salidas en ys (y, con aux, n de la segunda
+// salida); false si el modelo no tiene esas salidas con la forma esperada.
+// Los errores de ORT salen como Ort::Exception.
+static bool runOrtTensor(OrtContext& ctx, const float* xs, size_t n, float* ys,
+                         float* aux = nullptr) {
+  if (aux && ctx.aux_output_name.empty()) return false;
+  std::array<int64_t, 1> shape{static_cast<int64_t>(n)};
+  auto input_tensor = Ort::Value::CreateTensor<float>(
+      ctx.inputMem, const_cast<float*>(xs), n, shape.data(), shape.size());
+
+  // Un lote grande deja la arena crecida; al terminar este Run() se
+  // devuelven al sistema las regiones que hayan quedado libres
+  Ort::RunOptions runOpts;
+  if (ctx.shrinkBatch > 0 && n >= ctx.shrinkBatch) {
+    runOpts.AddConfigEntry("memory.enable_memory_arena_shrinkage", "cpu:0");
+    static metrics::Counter& shrinks = metrics::registry().counter(
+        "ia_ort_arena_shrink_runs_total", "Batch runs that shrank the ORT arena afterwards");
+    shrinks.inc();
+  }
+
+  const char* in_names[]  = { ctx.input_name.c_str()  };
+  const char* out_names[] = { ctx.output_name.c_str(), ctx.aux_output_name.c_str() };
+  const size_t numOut = aux ? 2 : 1;
+  auto outputs = ctx.session->Run(runOpts,
+                                  in_names,  &input_tensor, 1,
+                                  out_names, numOut);
+
+  if (outputs.size() < numOut) return false;
+  float* dest[] = { ys, aux };
+  for (size_t o = 0; o < numOut; o++) {
+    if (!outputs[o].IsTensor() ||
+        outputs[o].GetTensorTypeAndShapeInfo().GetElementCount() < n) {
+      return false;
+    }
+    const float* out_data = outputs[o].GetTensorData<float>();
+    std::copy(out_data, out_data + n, dest[o]);
+  }
+  return true;
+}
+
+// n entradas en un Run() si el modelo admite lotes; si no, una por Run()
+static bool runOrtValues(OrtContext& ctx, const float* xs, size_t n, float* ys,
+                         float* aux = nullptr) {
+  if (ctx.batched || n == 1) return runOrtTensor(ctx, xs, n, ys, aux);
+  for (size_t i = 0; i < n; i++) {
+    if (!runOrtTensor(ctx, xs + i, 1, ys + i, aux ? aux + i : nullptr)) return false;
+  }
+  return true;
+}
+
+// Lote del InferenceBatcher: un solo Run() con entrada [N] si el modelo lo
+// admite; si no (o si falla), una inferencia por elemento.
+static void runOrtBatch(OrtContext& ctx, const std::vector<float>& xs,
+                        std::vector<json>& out) {
+  if (ctx.batched && xs.size() > 1) {
+    try {
+      std::vector<float> ys(xs.size());
+      if (runOrtTensor(ctx, xs.data(), xs.size(), ys.data())) {
+        for (float y : ys) {
+          out.push_back(json{{"y", y}});
+        }
+        return;
+      }
+      std::cerr << "[warn] ORT batch output has unexpected shape (per-item fallback)" << std::endl;
+    } catch (const Ort::Exception& e) {
+      std::cerr << "[warn] ORT batch run failed: " << e.what() << " (per-item fallback)" << std::endl;
     }
-    res.set_header("Access-Control-Allow-Headers", "Content-Type");
-    res.set_header("Access-Control-Allow-Methods", "POST, OPTIONS");
+  }
+
+  for (float x : xs) {
+    out.push_back(runOrt(ctx, x).body);
+  }
 }
 
-// Get CORS origin from environment
-std::string get_cors_origin() {
-    const char* allow_origin = std::getenv("ALLOW_ORIGIN");
-    if (allow_origin && strlen(allow_origin) > 0) {
-        return std::string(allow_origin);
+// Estadisticas de la arena para /metrics. AllocatorGetStats existe desde la
+// API 23 (ORT 1.23); con versiones anteriores no se exporta nada.
+static void exportOrtArenaStats(OrtContext& ctx) {
+#if ORT_API_VERSION >= 23
+  if (!ctx.arena) return;
+  static const std::pair<const char*, const char*> kStats[] = {
+    {"Limit", "ia_ort_arena_limit_bytes"},
+    {"InUse", "ia_ort_arena_in_use_bytes"},
+    {"TotalAllocated", "ia_ort_arena_reserved_bytes"},
+    {"MaxInUse", "ia_ort_arena_max_in_use_bytes"},
+    {"MaxAllocSize", "ia_ort_arena_max_alloc_bytes"},
+    {"NumAllocs", "ia_ort_arena_allocs"},
+    {"NumReserves", "ia_ort_arena_reserves"},
+    {"NumArenaExtensions", "ia_ort_arena_extensions"},
+    {"NumArenaShrinkages", "ia_ort_arena_shrinkages"},
+  };
+  try {
+    Ort::MemoryInfo info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    Ort::Allocator allocator(*ctx.session, info);
+    OrtKeyValuePairs* stats = nullptr;
+    Ort::ThrowOnError(Ort::GetApi().AllocatorGetStats(allocator, &stats));
+    const char* const* keys = nullptr;
+    const char* const* values = nullptr;
+    size_t count = 0;
+    Ort::GetApi().GetKeyValuePairs(stats, &keys, &values, &count);
+    for (size_t i = 0; i < count; i++) {
+      for (const auto& stat : kStats) {
+        if (std::strcmp(keys[i], stat.first) == 0) {
+          metrics::registry()
+              .gauge(stat.second, "ORT CPU arena statistic (AllocatorGetStats)")
+              .set(std::strtod(values[i], nullptr));
+        }
+      }
     }
-    
-    // Check if running on Render
-    const char* render_env = std::getenv("RENDER");
-    if (render_env) {
-        // On Render, don't use wildcard by default
-        return "";
+    Ort::GetApi().ReleaseKeyValuePairs(stats);
+  } catch (const Ort::Exception& e) {
+    // /metrics se sirve desde varios hilos a la vez
+    static std::atomic<bool> warned{false};
+    if (!warned.exchange(true)) {
+      std::cerr << "[warn] ORT arena stats unavailable: " << e.what() << std::endl;
     }
-    
-    // In development, use wildcard
-    return "*";
+  }
+#else
+  (void)ctx;
+#endif
+}
+
+// MODEL_PREFAULT: una inferencia suelta y un lote completo antes de marcar
+// el modelo como listo, para que la arena ya haya crecido y los pesos que
+// ORT copia esten en memoria cuando llegue la primera peticion
+static void warmUpOrt(OrtContext& ctx, size_t maxBatch) {
+  runOrt(ctx, 0.0f);
+  if (ctx.batched && maxBatch > 1) {
+    std::vector<float> xs(maxBatch, 0.0f);
+    std::vector<json> out;
+    runOrtBatch(ctx, xs, out);
+  }
+}
+
+// AUTOTUNE: resultado guardado por modelo, cores y workers (autotune.h).
+// La clave exige leer el modelo entero, asi que se calcula una sola vez.
+struct AutotuneState {
+  AutotuneConfig config;
+  bool cached{false};         // el arranque uso un resultado guardado
+  std::atomic<bool> running{false};
+};
+AutotuneState autotune_state;
+
+static const std::string& autotuneKey(const ResourceBudget& budget) {
+  static std::once_flag once;
+  static std::string key;
+  std::call_once(once, [&] { key = tuning_key(model_file.data, model_file.size, budget); });
+  return key;
+}
+
+// Sesiones del autotuner, aparte de la de servicio, con el numero de hilos
+// intra-op de cada prueba
+static TuneTarget makeTuneTarget(ResourceBudget budget, const BusyPollConfig& busy,
+                                 int intraThreads) {
+  budget.ort_intra_threads = intraThreads;
+  auto ctx = tryLoadOrt(model_file, budget, busy);
+  if (!ctx) return {};
+  auto shared = std::make_shared<OrtContext>(std::move(*ctx));
+  TuneTarget target;
+  target.run_one = [shared](float x) { runOrt(*shared, x); };
+  target.run_batch = [shared](const std::vector<float>& xs, std::vector<json>& out) {
+    runOrtBatch(*shared, xs, out);
+  };
+  return target;
+}
+
+// Barrido completo y guardado del resultado para los siguientes arranques
+static TuneReport autotuneAndSave(const ResourceBudget& budget, const BusyPollConfig& busy) {
+  TuneReport report = run_autotune(autotune_state.config, budget, [&](int intra) {
+    return makeTuneTarget(budget, busy, intra);
+  });
+  if (!report.trials.empty() &&
+      save_tuning(autotune_state.config, autotuneKey(budget), report)) {
+    std::cout << "[info] Autotune result saved for " << autotuneKey(budget) << " in "
+              << autotune_state.config.dir << std::endl;
+  }
+  return report;
+}
+
+// Un modelo que se carga en segundo plano: su sesion se publica en `ctx` y
+// despues se marca `loaded`, que es lo que miran los handlers
+struct OrtModelSlot {
+  std::string name;
+  const ModelBytes* bytes;
+  std::optional<OrtContext>* ctx;
+  std::atomic<bool>* loaded;
+  // Opcional: se ejecuta con la sesion ya creada, antes del calentamiento y
+  // de publicarla (el autotuner puede sustituirla)
+  std::function<void(std::optional<OrtContext>&)> beforeReady;
+};
+
+// Carga ORT y construye las sesiones en hilos aparte, una por modelo y en
+// paralelo, mientras el servidor ya atiende. Con shouldFail un modelo que no
+// carga termina el proceso, como antes hacia el arranque sincrono.
+static void loadModelsAsync(std::vector<OrtModelSlot> slots, ResourceBudget budget,
+                            BusyPollConfig busy, bool shouldFail) {
+  for (const auto& slot : slots) model_readiness().expect(slot.name);
+  std::thread([slots = std::move(slots), budget, busy, shouldFail] {
+    const HugePageConfig pages = HugePageConfig::from_env();
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> builders;
+    for (const auto& slot : slots) {
+      builders.emplace_back([&, slot] {
+        auto t0 = std::chrono::steady_clock::now();
+        auto ctx = tryLoadOrt(*slot.bytes, budget, busy);
+        if (ctx && slot.beforeReady) slot.beforeReady(ctx);
+        if (ctx && pages.prefault) warmUpOrt(*ctx, budget.max_batch_size);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (ctx) {
+          *slot.ctx = std::move(ctx);
+          slot.loaded->store(true, std::memory_order_release);
+          model_readiness().settle(slot.name, ModelReadiness::State::ready, secs);
+        } else {
+          failed = true;
+          model_readiness().settle(slot.name, ModelReadiness::State::failed, secs,
+                                   "session creation failed (see log)");
+          std::cout << "[info] Running in dummy mode (model '" << slot.name
+                    << "' failed to load)" << std::endl;
+        }
+      });
+    }
+    for (auto& t : builders) t.join();
+    lock_after_warmup(pages);
+
+    if (failed && shouldFail) {
+      std::cerr << "[error] FAIL_ON_MISSING_MODEL is true but model failed to load" << std::endl;
+      std::cout.flush();
+      std::_Exit(1);
+    }
+  }).detach();
+}
+
+// ENSEMBLE_MODELS (ensemble.h): varios modelos por prediccion en lugar de
+// MODEL_PATH. Cada miembro tiene su mapeo, su sesion y su marca de cargado,
+// como el modelo unico; el Ensemble (y sus hilos) se crea en cada worker.
+struct EnsembleMember {
+  std::string name;
+  ModelBytes bytes;
+  std::optional<OrtContext> ctx;
+  std::atomic<bool> loaded{false};
+};
+EnsembleConfig ensemble_config;
+std::deque<EnsembleMember> ensemble_members;  // deque: los atomic no se mueven
+std::unique_ptr<Ensemble> ensemble;
+
+// Listo cuando todos los miembros lo estan: un ensemble al que le falta un
+// miembro daria otras predicciones sin avisar
+static bool ensembleLoaded() {
+  if (ensemble_members.empty()) return false;
+  for (const auto& member : ensemble_members) {
+    if (!member.loaded.load(std::memory_order_acquire)) return false;
+  }
+  return ensemble != nullptr;  // creado antes de empezar las cargas
+}
+
+static bool ensembleLoading() {
+  for (const auto& member : ensemble_members) {
+    if (model_readiness().state(member.name) == ModelReadiness::State::loading) return true;
+  }
+  return false;
+}
+
+static bool runEnsembleMember(size_t k, const float* xs, size_t n, float* ys) {
+  try {
+    return runOrtValues(*ensemble_members[k].ctx, xs, n, ys);
+  } catch (const Ort::Exception& e) {
+    std::cerr << "[warn] ORT run failed in ensemble member '" << ensemble_members[k].name
+              << "': " << e.what() << std::endl;
+    return false;
+  }
+}
+
+// Los miembros corren a la vez, asi que se reparten los hilos intra-op del
+// presupuesto en lugar de pedir cada uno todos
+static std::vector<OrtModelSlot> ensembleSlots(ResourceBudget& budget) {
+  budget.ort_intra_threads = std::max(1, budget.ort_intra_threads /
+                                             static_cast<int>(ensemble_members.size()));
+  std::vector<OrtModelSlot> slots;
+  for (auto& member : ensemble_members) {
+    slots.push_back(OrtModelSlot{member.name, &member.bytes, &member.ctx, &member.loaded, nullptr});
+  }
+  return slots;
+}
+
+// CASCADE_FAST_MODEL (cascade.h): un modelo barato delante del completo
+// (MODEL_PATH o el ensemble), que solo recibe las entradas dudosas
+CascadeConfig cascade_config;
+ModelBytes cascade_fast_file;
+std::optional<OrtContext> cascade_fast_ctx;
+std::atomic<bool> cascade_fast_loaded{false};
+std::unique_ptr<Cascade> cascade;
+
+static bool fullModelLoaded() {
+  return ensembleLoaded() || (model_loaded && ort_ctx.has_value());
+}
+
+// Si el modelo barato no carga se sirve solo el completo
+static bool cascadeLoaded() {
+  return cascade_fast_loaded.load(std::memory_order_acquire) && cascade && fullModelLoaded();
+}
+
+static bool runCascadeFast(const float* xs, size_t n, float* ys, float* us) {
+  try {
+    return runOrtValues(*cascade_fast_ctx, xs, n, ys, us);
+  } catch (const Ort::Exception& e) {
+    std::cerr << "[warn] ORT run failed in the cascade fast model: " << e.what() << std::endl;
+    return false;
+  }
+}
+
+static bool runCascadeFull(const float* xs, size_t n, float* ys) {
+  if (ensembleLoaded()) return ensemble->run(xs, n, ys);
+  profile_capture.mirror(xs, n);
+  try {
+    return runOrtValues(ort_ctx.value(), xs, n, ys);
+  } catch (const Ort::Exception& e) {
+    std::cerr << "[warn] ORT run failed in the cascade full model: " << e.what() << std::endl;
+    return false;
+  }
 }
 
+// El modelo barato se carga junto a los demas. Una regla de incertidumbre
+// necesita su segunda salida: sin ella la carga cuenta como fallida.
+static void addCascadeSlot(std::vector<OrtModelSlot>& slots) {
+  if (!cascade_config.enabled()) return;
+  cascade = std::make_unique<Cascade>(cascade_config, runCascadeFast, runCascadeFull);
+  OrtModelSlot slot{"fast", &cascade_fast_file, &cascade_fast_ctx, &cascade_fast_loaded, nullptr};
+  if (cascade_config.rule.needs_uncertainty()) {
+    slot.beforeReady = [](std::optional<OrtContext>& ctx) {
+      if (ctx->aux_output_name.empty()) {
+        std::cerr << "[warn] CASCADE_RULE=uncertainty needs a second output in "
+                  << cascade_config.fast_model << std::endl;
+        ctx.reset();
+      }
+    };
+  }
+  std::cout << "[info] Cascade: " << cascade_config.fast_model << " first, escalating on "
+            << cascade_config.rule.describe() << std::endl;
+  slots.push_back(std::move(slot));
+}
+#endif
 
 // Dummy inference
 json run_dummy_inference(float x) {
@@ -166,110 +750,679 @@ json run_dummy_inference(float x) {
     return response;
 }
 
-int main() {
-    // Get configuration from environment
-    const char* port_str = std::getenv("PORT");
-    int port = port_str ? std::atoi(port_str) : 10000;
+// FEATURE_TABLE: rows for {"key": ...} requests. One store per worker, so
+// each has its own reload watcher; the mapped pages are shared.
+std::unique_ptr<FeatureStore> feature_store;
+
+// Row of `key` into `row` (valid while `table` is held), or false with the
+// error response set
+static bool lookup_features(const json& key, std::shared_ptr<const FeatureTable>& table,
+                            const float*& row, httplib::Response& res) {
+    auto fail = [&res](int status, const std::string& error) {
+        res.status = status;
+        res.set_content(json{{"error", error}}.dump(), "application/json");
+        return false;
+    };
+    if (!feature_store) return fail(400, "key lookups need FEATURE_TABLE");
+    if (!key.is_string()) return fail(400, "key must be a string");
+    table = feature_store->table();
+    row = table ? table->find(key.get_ref<const std::string&>()) : nullptr;
+    feature_store->count_lookup(row != nullptr);
+    if (!row) return fail(404, "unknown key");
+#ifdef WITH_ORT
+    // The ensemble and the cascade take one value per input
+    if (table->dim() > 1 && (!ensemble_members.empty() || cascade_config.enabled())) {
+        return fail(400, "feature rows of " + std::to_string(table->dim()) +
+                             " values need a single model (no ensemble or cascade)");
+    }
+#endif
+    return true;
+}
+
+// One server process: inference pipeline, listeners and routes. Runs in
+// main() itself, or in each forked worker with --workers.
+static int run_worker(int worker, int port, [[maybe_unused]] bool should_fail,
+                      const CorsPolicy& cors, const ResourceBudget& budget,
+                      const BusyPollConfig& busy_all) {
+    metrics::registry()
+        .gauge("ia_worker_index", "Worker process that answered this scrape")
+        .set(worker);
     
-    const char* fail_on_missing_model = std::getenv("FAIL_ON_MISSING_MODEL");
-    bool should_fail = (fail_on_missing_model && 
-                       (std::string(fail_on_missing_model) == "true" || 
-                        std::string(fail_on_missing_model) == "1"));
+    // Busy-poll mode: this worker's share of the spinning cores
+    const BusyPollConfig busy = busy_all.for_worker(worker, budget.workers);
+    if (busy.enabled) {
+        std::cout << "[info] Busy-poll mode: " << busy.describe() << std::endl;
+    }
     
-    std::string cors_origin = get_cors_origin();
+    // Feature rows for entity-key requests, reloaded when the file changes
+    if (const FeatureTableConfig features = FeatureTableConfig::from_env(); features.enabled()) {
+        feature_store = std::make_unique<FeatureStore>(features);
+    }
     
-    // Try to load ONNX model
+    // Batching stage for the multiplexed frontends. Greedy by default: an
+    // idle service runs single inputs right away, a busy one batches up to
+    // MAX_BATCH_SIZE inputs per run.
+    InferenceBatcher batcher(
+        [](const std::vector<float>& xs, std::vector<json>& out) {
 #ifdef WITH_ORT
-    ort_ctx = tryLoadOrt("models/model.onnx");
-    model_loaded = ort_ctx.has_value();
-    if (!model_loaded && should_fail) {
-        std::cerr << "[error] FAIL_ON_MISSING_MODEL is true but model failed to load" << std::endl;
-        return 1;
+            if (cascadeLoaded()) {
+                std::vector<float> ys(xs.size());
+                std::vector<Cascade::Outcome> outcome(xs.size());
+                cascade->run(xs.data(), xs.size(), ys.data(), outcome.data());
+                for (size_t i = 0; i < xs.size(); i++) {
+                    if (outcome[i] == Cascade::Outcome::failed) {
+                        out.push_back(json{{"error", "cascade full model failed"}});
+                    } else {
+                        out.push_back(json{{"y", ys[i]},
+                                           {"escalated", outcome[i] == Cascade::Outcome::full}});
+                    }
+                }
+                return;
+            }
+            if (ensembleLoaded()) {
+                std::vector<float> ys(xs.size());
+                if (ensemble->run(xs.data(), xs.size(), ys.data())) {
+                    for (float y : ys) {
+                        out.push_back(json{{"y", y}});
+                    }
+                } else {
+                    for (size_t i = 0; i < xs.size(); i++) {
+                        out.push_back(json{{"error", "ensemble member failed"}});
+                    }
+                }
+                return;
+            }
+            if (model_loaded && ort_ctx.has_value()) {
+                profile_capture.mirror(xs.data(), xs.size());
+                runOrtBatch(ort_ctx.value(), xs, out);
+                return;
+            }
+            // Still loading: no dummy answers for a model that is coming
+            if (model_readiness().state("model") == ModelReadiness::State::loading ||
+                ensembleLoading()) {
+                for (size_t i = 0; i < xs.size(); i++) {
+                    out.push_back(json{{"error", "model loading"}});
+                }
+                return;
+            }
+#endif
+            for (float x : xs) {
+                out.push_back(run_dummy_inference(x));
+            }
+        },
+        budget.max_batch_size, budget.http_max_queued,
+        std::chrono::microseconds(budget.batch_max_delay_us),
+        busy.enabled ? busy.spin : std::chrono::microseconds(0),
+        busy.enabled ? busy.cpu(budget.http_threads) : -1);
+    
+    // BATCH_ADAPTIVE: batch size and wait follow the measured p99, with the
+    // limits above as ceilings
+    if (const AdaptiveBatchConfig adaptive = AdaptiveBatchConfig::from_env(); adaptive.enabled) {
+        batcher.enable_adaptive(adaptive);
+        std::cout << "[info] Adaptive batching: p99 target " << adaptive.p99_target.count()
+                  << " us, max_batch <= " << batcher.max_batch() << std::endl;
+    }
+    
+    // Load the ONNX model in the background: the listener binds first, so
+    // /health/live answers during a cold start and /health/ready once the
+    // session exists. Each worker builds its own session, allocators and
+    // thread pools from the shared mapping.
+#ifdef WITH_ORT
+    if (!ensemble_members.empty()) {
+        // Ensemble: every member loads in parallel; /predict fans out to
+        // them once all are ready
+        ResourceBudget member_budget = budget;
+        std::vector<OrtModelSlot> slots = ensembleSlots(member_budget);
+        ensemble = std::make_unique<Ensemble>(ensemble_config, runEnsembleMember);
+        addCascadeSlot(slots);
+        std::cout << "[info] Ensemble of " << ensemble->members() << " models, reducer "
+                  << reducer_name(ensemble->reducer()) << ", "
+                  << member_budget.ort_intra_threads << " intra-op threads each" << std::endl;
+        loadModelsAsync(std::move(slots), member_budget, busy, should_fail);
+    } else if (model_file.data) {
+        OrtModelSlot slot{"model", &model_file, &ort_ctx, &model_loaded, nullptr};
+        // AUTOTUNE without a saved result: worker 0 sweeps before the model
+        // is marked ready. The batch limits apply right away and the intra-op
+        // count through a rebuilt session; the HTTP pool size from the next
+        // boot, which finds the saved result.
+        if (autotune_state.config.enabled && !autotune_state.cached && worker == 0 &&
+            !autotune_state.running.exchange(true)) {
+            slot.beforeReady = [&batcher, budget, busy](std::optional<OrtContext>& ctx) {
+                TuneReport report = autotuneAndSave(budget, busy);
+                ResourceBudget tuned = budget;
+                apply_tuning(report.best, tuned);
+                batcher.set_limits(tuned.max_batch_size,
+                                   std::chrono::microseconds(tuned.batch_max_delay_us));
+                if (tuned.ort_intra_threads != budget.ort_intra_threads) {
+                    if (auto rebuilt = tryLoadOrt(model_file, tuned, busy)) ctx = std::move(rebuilt);
+                }
+                tuned.http_threads = budget.http_threads;  // not resized until restart
+                export_resource_budget(tuned);
+                autotune_state.running = false;
+            };
+        }
+        std::vector<OrtModelSlot> slots{slot};
+        addCascadeSlot(slots);
+        loadModelsAsync(std::move(slots), budget, busy, should_fail);
+    } else {
+        if (should_fail) {
+            std::cerr << "[error] FAIL_ON_MISSING_MODEL is true but model failed to load" << std::endl;
+            return 1;
+        }
+        model_readiness().settle("model", ModelReadiness::State::absent);
+        std::cout << "[info] Running in dummy mode (no ONNX model)" << std::endl;
     }
 #else
     std::cout << "[info] ONNX Runtime not available, using dummy mode" << std::endl;
+    model_readiness().settle("model", ModelReadiness::State::absent);
 #endif
     
-    if (!model_loaded) {
-        std::cout << "[info] Running in dummy mode (no ONNX model)" << std::endl;
+#ifdef WITH_H2C
+    // HTTP/2 cleartext listener for backend clients
+    if (long h2c_port = env_long("H2C_PORT", 0)) {
+        H2cOptions h2c;
+        h2c.port = static_cast<int>(h2c_port);
+        h2c.max_concurrent_streams = env_long("H2C_MAX_STREAMS", 256);
+        h2c.max_body_bytes = budget.payload_max_bytes;
+        // A thread per connection, so bounded like the HTTP accept queue
+        h2c.max_connections = env_long("H2C_MAX_CONNECTIONS",
+                                       static_cast<long>(budget.http_max_queued));
+        if (!start_h2c_server(h2c, batcher)) {
+            return 1;
+        }
     }
+#endif
     
-    // Create HTTP server
-    httplib::Server svr;
+    // Shared-memory transport for clients on the same host. A segment has a
+    // single consumer, so with --workers only worker 0 serves it.
+    const char* shm_name = std::getenv("SHM_NAME");
+    if (worker == 0 && shm_name && *shm_name &&
+        !start_shm_server(shm_name, batcher)) {
+        return 1;
+    }
     
-    // Health endpoint
-    svr.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+    // Create HTTP server (HTTPS when built with IA_TLS and a certificate is set)
+    std::unique_ptr<httplib::Server> server;
+    bool tls_enabled = false;
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+    TlsConfig tls;
+    if (TlsConfig::from_env(tls)) {
+        tls_enabled = true;
+        server = make_tls_server(tls);
+        if (!server) {
+            std::cerr << "[error] Failed to set up TLS" << std::endl;
+            return 1;
+        }
+    }
+#endif
+    if (!server) {
+        server = std::make_unique<httplib::Server>();
+    }
+    httplib::Server& svr = *server;
+    svr.new_task_queue = [&budget, &busy]() -> httplib::TaskQueue* {
+        if (busy.enabled) {
+            return new SpinThreadPool(budget.http_threads, budget.http_max_queued, busy);
+        }
+        return new httplib::ThreadPool(budget.http_threads, budget.http_max_queued);
+    };
+    if (busy.enabled) {
+        svr.set_keep_alive_spin(busy.spin.count());
+        svr.set_socket_options([&busy](socket_t sock) {
+            httplib::default_socket_options(sock);
+            if (!set_socket_busy_poll(sock, busy.socket_busy_poll_us)) {
+                std::cerr << "[warn] SO_BUSY_POLL not set (" << std::strerror(errno)
+                          << "; needs CAP_NET_ADMIN)" << std::endl;
+            }
+        });
+    }
+    svr.set_payload_max_length(budget.payload_max_bytes);
+    svr.set_static_headers(cors.static_headers());
+    svr.set_post_routing_handler([&cors](const httplib::Request& req, httplib::Response& res) {
+        cors.apply(req, res);
+    });
+    
+    // Health endpoints. /health and /health/live answer as soon as the port
+    // is open; /health/ready is 503 until every model has settled.
+    auto live = [](const httplib::Request&, httplib::Response& res) {
         res.set_content("ok", "text/plain");
+    };
+    svr.Get("/health", live);
+    svr.Get("/health/live", live);
+    svr.Get("/health/ready", [](const httplib::Request&, httplib::Response& res) {
+        json body = model_readiness().describe();
+        if (!body["ready"].get<bool>()) res.status = 503;
+        res.set_content(body.dump(), "application/json");
+    });
+    
+    // Prometheus metrics
+    svr.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        export_memory_usage();
+#ifdef WITH_ORT
+        if (model_loaded && ort_ctx.has_value()) {
+            exportOrtArenaStats(ort_ctx.value());
+        }
+#endif
+        res.set_content(metrics::registry().renderPrometheus(),
+                        "text/plain; version=0.0.4");
+    });
+    
+    // ORT profiling capture (ADMIN_TOKEN): profiles a separate session fed
+    // with copies of the live inputs, for `runs` runs or `seconds`, and
+    // answers with the trace path and a per-operator summary. Blocks this
+    // pool thread for the capture; the serving session is not touched.
+    const AdminAuth admin = AdminAuth::from_env();
+#ifdef WITH_ORT
+    svr.Post("/admin/profile", [&admin, &budget, &busy](const httplib::Request& req,
+                                                        httplib::Response& res) {
+        if (!admin.check(req, res)) return;
+        auto param = [&req](const char* name, long def, long max) {
+            long v = req.has_param(name) ? std::atol(req.get_param_value(name).c_str()) : def;
+            return std::min(std::max(v, 1L), max);
+        };
+        size_t runs = static_cast<size_t>(param("runs", 100, 10000));
+        long seconds = param("seconds", 10, 120);
+        size_t top = static_cast<size_t>(param("top", 10, 100));
+        
+        if (ensemble_config.enabled()) {
+            res.status = 409;
+            res.set_content(json{{"error", "not supported with ENSEMBLE_MODELS"}}.dump(),
+                            "application/json");
+            return;
+        }
+        if (!model_loaded || !model_file.data) {
+            res.status = 409;
+            res.set_content(json{{"error", "no ONNX model loaded"}}.dump(), "application/json");
+            return;
+        }
+        if (!profile_capture.begin()) {
+            res.status = 409;
+            res.set_content(json{{"error", "a profiling capture is already running"}}.dump(),
+                            "application/json");
+            return;
+        }
+        
+        const char* dir = std::getenv("PROFILE_DIR");
+        std::string prefix = std::string(dir && *dir ? dir : "/tmp") +
+                             "/ia-cpp-profile-" + std::to_string(::getpid());
+        json body;
+        std::cout << "[info] ORT profiling capture: up to " << runs << " runs / "
+                  << seconds << " s" << std::endl;
+        
+        // Own thread at the lowest priority, so serving threads come first
+        std::thread capture([&] {
+            ::setpriority(PRIO_PROCESS, 0, 19);  // per thread on Linux
+            auto prof = tryLoadOrt(model_file, budget, busy, prefix.c_str());
+            if (!prof) {
+                body = json{{"error", "cannot create the profiling session"}};
+                return;
+            }
+            std::vector<json> out;
+            size_t done = profile_capture.replay(
+                runs, std::chrono::seconds(seconds),
+                [&](const std::vector<float>& xs) {
+                    out.clear();
+                    runOrtBatch(*prof, xs, out);
+                });
+            
+            Ort::AllocatorWithDefaultOptions allocator;
+            std::string trace;
+            try {
+                auto path = prof->session->EndProfilingAllocated(allocator);
+                if (path) trace = path.get();
+            } catch (const Ort::Exception& e) {
+                body = json{{"error", std::string("EndProfiling failed: ") + e.what()}};
+                return;
+            }
+            
+            json summary;
+            std::string error;
+            body = json{{"trace", trace}, {"runs", done}, {"window_s", seconds}};
+            if (done == 0) body["note"] = "no inference traffic during the window";
+            if (summarize_ort_profile(trace, top, summary, error)) {
+                body["summary"] = std::move(summary);
+            } else {
+                body["summary_error"] = error;
+            }
+        });
+        capture.join();
+        profile_capture.end();
+        
+        if (body.contains("error")) res.status = 500;
+        res.set_content(body.dump(), "application/json");
+    });
+#else
+    svr.Post("/admin/profile", [&admin](const httplib::Request& req, httplib::Response& res) {
+        if (!admin.check(req, res)) return;
+        res.status = 501;
+        res.set_content(json{{"error", "built without ONNX Runtime"}}.dump(), "application/json");
+    });
+#endif
+
+    // Autotune sweep on demand (ADMIN_TOKEN): same sweep as AUTOTUNE=1 at
+    // startup, on this pool thread and next to live traffic, which skews it
+    // (run it off-peak). The batch limits apply at once; thread counts are
+    // saved for the next boot with AUTOTUNE=1.
+#ifdef WITH_ORT
+    svr.Post("/admin/autotune", [&admin, &budget, &busy, &batcher](const httplib::Request& req,
+                                                                   httplib::Response& res) {
+        if (!admin.check(req, res)) return;
+        if (ensemble_config.enabled()) {
+            res.status = 409;
+            res.set_content(json{{"error", "not supported with ENSEMBLE_MODELS"}}.dump(),
+                            "application/json");
+            return;
+        }
+        if (!model_loaded || !model_file.data) {
+            res.status = 409;
+            res.set_content(json{{"error", "no ONNX model loaded"}}.dump(), "application/json");
+            return;
+        }
+        if (autotune_state.running.exchange(true)) {
+            res.status = 409;
+            res.set_content(json{{"error", "an autotune sweep is already running"}}.dump(),
+                            "application/json");
+            return;
+        }
+        
+        // Sweep from the limits in force, which may differ from the budget
+        ResourceBudget running = budget;
+        running.max_batch_size = batcher.max_batch();
+        running.batch_max_delay_us = static_cast<long>(batcher.max_delay().count());
+        TuneReport report = autotuneAndSave(running, busy);
+        ResourceBudget tuned = running;
+        apply_tuning(report.best, tuned);
+        batcher.set_limits(tuned.max_batch_size,
+                           std::chrono::microseconds(tuned.batch_max_delay_us));
+        autotune_state.running = false;
+        
+        json body = report.to_json();
+        body["key"] = autotuneKey(budget);
+        body["applied"] = {{"max_batch_size", tuned.max_batch_size},
+                           {"batch_max_delay_us", tuned.batch_max_delay_us}};
+        body["next_boot"] = {{"http_threads", tuned.http_threads},
+                             {"ort_intra_threads", tuned.ort_intra_threads}};
+        if (report.trials.empty()) res.status = 500;
+        res.set_content(body.dump(), "application/json");
+    });
+#else
+    svr.Post("/admin/autotune", [&admin](const httplib::Request& req, httplib::Response& res) {
+        if (!admin.check(req, res)) return;
+        res.status = 501;
+        res.set_content(json{{"error", "built without ONNX Runtime"}}.dump(), "application/json");
+    });
+#endif
+
+    // Sampling CPU profile of the whole process (ADMIN_TOKEN): collapsed
+    // stacks for flamegraph.pl, or pprof with format=pprof
+    svr.Get("/debug/profile", [&admin](const httplib::Request& req, httplib::Response& res) {
+        if (!admin.check(req, res)) return;
+        auto param = [&req](const char* name, long def, long max) {
+            long v = req.has_param(name) ? std::atol(req.get_param_value(name).c_str()) : def;
+            return std::min(std::max(v, 1L), max);
+        };
+        CpuProfileOptions options;
+        options.duration = std::chrono::seconds(param("seconds", 10, 120));
+        options.hz = static_cast<int>(param("hz", 99, 1000));
+        options.pprof = req.get_param_value("format") == "pprof";
+
+        CpuProfile profile;
+        std::string error;
+        if (!capture_cpu_profile(options, profile, error)) {
+            res.status = 409;
+            res.set_content(json{{"error", error}}.dump(), "application/json");
+            return;
+        }
+        res.set_header("X-Profile-Samples", std::to_string(profile.samples));
+        res.set_header("X-Profile-Dropped", std::to_string(profile.dropped));
+        res.set_content(std::move(profile.body), profile.content_type);
+    });
+
+    // WebSocket channel for the frontend. Each session keeps a worker
+    // thread, so by default at most half of the pool can be taken by them.
+    WsOptions ws_options;
+    ws_options.max_sessions = env_long("WS_MAX_SESSIONS",
+                                       static_cast<long>(std::max<size_t>(1, budget.http_threads / 2)));
+    ws_options.max_message_bytes = budget.payload_max_bytes;
+    WsEndpoint ws(batcher, cors, ws_options);
+    svr.Get("/predict/ws", [&ws](const httplib::Request& req, httplib::Response& res) {
+        ws.handle(req, res);
     });
     
     // OPTIONS /predict for CORS
-    svr.Options("/predict", [&cors_origin](const httplib::Request&, httplib::Response& res) {
-        res.status = 204;
-        add_cors_headers(res, cors_origin);
+    svr.Options("/predict", [&cors](const httplib::Request& req, httplib::Response& res) {
+        cors.preflight(req, res);
     });
     
     // POST /predict endpoint
-    svr.Post("/predict", [&cors_origin](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/predict", [](const httplib::Request& req, httplib::Response& res) {
         try {
-            // Debug logging
-            std::cerr << "[debug] POST /predict - body length: " << req.body.length() << std::endl;
-            std::cerr << "[debug] POST /predict - body content: '" << req.body << "'" << std::endl;
-            std::cerr << "[debug] POST /predict - Content-Type: " << req.get_header_value("Content-Type") << std::endl;
-            
-            // Parse JSON
+            // Parse JSON. The Content-Type is not checked on purpose: browsers
+            // send the body as text/plain to avoid the CORS preflight.
             json body = json::parse(req.body);
             
-            // Validate input
-            if (!body.contains("x") || !body["x"].is_number()) {
+            // Entity key: the features come from FEATURE_TABLE and go to
+            // ORT straight from the mapping, held until the run is done
+            float x = 0;
+            const float* row = &x;
+            size_t dim = 1;
+            std::shared_ptr<const FeatureTable> table;
+            if (body.contains("key")) {
+                if (!lookup_features(body["key"], table, row, res)) return;
+                dim = table->dim();
+                x = row[0];
+            } else if (!body.contains("x") || !body["x"].is_number()) {
+                // Validate input
                 res.status = 400;
                 json error_response;
                 error_response["error"] = "x must be a number";
                 res.set_content(error_response.dump(), "application/json");
-                add_cors_headers(res, cors_origin);
                 return;
+            } else {
+                x = body["x"].get<float>();
             }
-            
-            float x = body["x"].get<float>();
+            // Only a single MODEL_PATH model takes a whole row (lookup_features
+            // already refuses them with an ensemble or a cascade); the dummy
+            // is scalar and must not answer from row[0]
+            auto scalar_only = [&res, dim] {
+                if (dim == 1) return false;
+                res.status = 400;
+                res.set_content(json{{"error", "feature rows of " + std::to_string(dim) +
+                                                   " values need a MODEL_PATH model"}}.dump(),
+                                "application/json");
+                return true;
+            };
             json response;
             
             // Try ONNX inference if model is loaded
 #ifdef WITH_ORT
-            if (model_loaded && ort_ctx.has_value()) {
-                InferenceResult result = runOrt(ort_ctx.value(), x);
+            if (cascadeLoaded()) {
+                float y = 0;
+                Cascade::Outcome outcome = Cascade::Outcome::fast;
+                if (!cascade->run(&x, 1, &y, &outcome)) {
+                    res.status = 500;
+                    res.set_content(json{{"error", "cascade full model failed"}}.dump(),
+                                    "application/json");
+                    return;
+                }
+                response = json{{"y", y}, {"escalated", outcome == Cascade::Outcome::full}};
+            } else if (ensembleLoaded()) {
+                float y = 0;
+                if (!ensemble->run(&x, 1, &y)) {
+                    res.status = 500;
+                    res.set_content(json{{"error", "ensemble member failed"}}.dump(),
+                                    "application/json");
+                    return;
+                }
+                response = json{{"y", y}};
+            } else if (model_loaded && ort_ctx.has_value()) {
+                if (dim == 1) profile_capture.mirror(&x, 1);
+                InferenceResult result = runOrt(ort_ctx.value(), row, dim);
                 response = result.body;
+            } else if (model_readiness().state("model") == ModelReadiness::State::loading ||
+                       ensembleLoading()) {
+                res.status = 503;
+                res.set_header("Retry-After", "1");
+                res.set_content(json{{"error", "model loading"}}.dump(), "application/json");
+                return;
             } else {
+                if (scalar_only()) return;
                 response = run_dummy_inference(x);
             }
 #else
+            if (scalar_only()) return;
             response = run_dummy_inference(x);
 #endif
             
             res.set_content(response.dump(), "application/json");
-            add_cors_headers(res, cors_origin);
             
         } catch (const json::parse_error& e) {
             res.status = 400;
             json error_response;
             error_response["error"] = "Invalid JSON: " + std::string(e.what());
             res.set_content(error_response.dump(), "application/json");
-            add_cors_headers(res, cors_origin);
         } catch (const std::exception& e) {
             res.status = 500;
             json error_response;
             error_response["error"] = "Internal server error";
             res.set_content(error_response.dump(), "application/json");
-            add_cors_headers(res, cors_origin);
         }
     });
     
     // Start server
-    std::cout << "[info] CORS allowed origin: " << (cors_origin.empty() ? "none" : cors_origin) << std::endl;
-    std::cout << "[info] Starting server on port " << port << std::endl;
+    std::cout << "[info] CORS allowed origins: " << cors.describe() << std::endl;
+    
+    // io_uring transport (HTTP_IO_URING=1) for plain HTTP, when the kernel
+    // supports it; otherwise the thread-pool listener below
+    if (env_long("HTTP_IO_URING", 0) && !tls_enabled) {
+        std::string why;
+        if (uring_available(why)) {
+            UringOptions uring;
+            uring.port = port;
+            uring.rings = budget.http_threads;
+            uring.max_request_bytes = budget.payload_max_bytes + (64 << 10);
+            uring.listening = record_port_open;
+            // Handlers that run for seconds must not stall a ring
+            uring.threaded_paths = {"/debug/profile", "/admin/profile", "/admin/autotune"};
+            std::cout << "[info] Starting server on port " << port
+                      << " (io_uring, " << uring.rings << " rings)" << std::endl;
+            return listen_uring(svr, uring) ? 0 : 1;
+        }
+        std::cout << "[info] io_uring unavailable (" << why
+                  << "), using the thread pool" << std::endl;
+    }
+    
+    std::cout << "[info] Starting server on port " << port;
+    if (budget.workers > 1) {
+        std::cout << " (worker " << worker << ", pid " << ::getpid() << ")";
+    }
+    std::cout << std::endl;
     
-    if (!svr.listen("0.0.0.0", port)) {
+    // httplib binds with SO_REUSEPORT, so every worker gets its own listener
+    // on the same port and the kernel balances connections between them
+    if (!svr.bind_to_port("0.0.0.0", port)) {
+        std::cerr << "[error] Failed to start server on port " << port << std::endl;
+        return 1;
+    }
+    record_port_open();
+    if (!svr.listen_after_bind()) {
         std::cerr << "[error] Failed to start server on port " << port << std::endl;
         return 1;
     }
     
     return 0;
+}
+
+int main(int argc, char** argv) {
+    // Before anything allocates: may re-exec with glibc's hugetlb tunable
+    const HugePageConfig pages = HugePageConfig::from_env();
+    apply_arena_hugepages(pages, argv);
+    mark_process_start();
+    
+    // Prefork mode: --workers N (or WORKERS)
+    long workers = env_long("WORKERS", 1);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) {
+            workers = std::atol(argv[++i]);
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            workers = std::atol(arg.c_str() + 10);
+        } else {
+            std::cerr << "[error] Unknown argument: " << arg << "\n"
+                      << "usage: ia-cpp [--workers N]" << std::endl;
+            return 2;
+        }
+    }
+    if (workers < 1 || workers > 256) {
+        std::cerr << "[error] --workers must be between 1 and 256" << std::endl;
+        return 2;
+    }
+    
+    // Get configuration from environment
+    const char* port_str = std::getenv("PORT");
+    int port = port_str ? std::atoi(port_str) : 10000;
+    
+    const char* fail_on_missing_model = std::getenv("FAIL_ON_MISSING_MODEL");
+    bool should_fail = (fail_on_missing_model && 
+                       (std::string(fail_on_missing_model) == "true" || 
+                        std::string(fail_on_missing_model) == "1"));
+    
+    const CorsPolicy cors = CorsPolicy::from_env();
+    const BusyPollConfig busy = BusyPollConfig::from_env();
+    
+#ifdef WITH_ORT
+    // Map the model once; forked workers share the pages. ENSEMBLE_MODELS
+    // replaces MODEL_PATH with one mapping per member.
+    ensemble_config = EnsembleConfig::from_env();
+    if (ensemble_config.enabled()) {
+        std::vector<std::string> names = ensemble_config.member_names();
+        for (size_t k = 0; k < ensemble_config.models.size(); k++) {
+            EnsembleMember& member = ensemble_members.emplace_back();
+            member.name = names[k];
+            member.bytes = mapModel(ensemble_config.models[k], pages);
+        }
+    } else {
+        const char* model_path = std::getenv("MODEL_PATH");
+        model_file = mapModel(model_path && *model_path ? model_path : IA_MODEL_PATH, pages);
+    }
+    cascade_config = CascadeConfig::from_env();
+    if (cascade_config.enabled()) {
+        cascade_fast_file = mapModel(cascade_config.fast_model, pages);
+    }
+#endif
+    
+    // Size every pool from the container's cgroup limits
+    ResourceBudget budget = detect_resource_budget(static_cast<unsigned>(workers));
+#ifdef WITH_ORT
+    // AUTOTUNE: a saved result for this model and core count replaces the
+    // derived sizes; without one, worker 0 sweeps once the model is loaded
+    autotune_state.config = AutotuneConfig::from_env();
+    if (autotune_state.config.enabled && ensemble_config.enabled()) {
+        // The sweep and its saved result are per model file
+        std::cerr << "[warn] AUTOTUNE is not supported with ENSEMBLE_MODELS, ignored"
+                  << std::endl;
+    }
+    if (autotune_state.config.enabled && model_file.data) {
+        TunedParams tuned;
+        if (load_tuning(autotune_state.config, autotuneKey(budget), tuned)) {
+            apply_tuning(tuned, budget);
+            autotune_state.cached = true;
+            std::cout << "[info] Autotune: using the saved result for "
+                      << autotuneKey(budget) << std::endl;
+        } else {
+            std::cout << "[info] Autotune: no saved result for " << autotuneKey(budget)
+                      << ", sweeping once the model is loaded" << std::endl;
+        }
+    }
+#endif
+    apply_busy_poll(busy.for_worker(0, budget.workers), budget);
+    log_resource_budget(budget);
+    export_resource_budget(budget);
+    
+    auto serve = [&](int worker) {
+        return run_worker(worker, port, should_fail, cors, budget, busy);
+    };
+    if (workers == 1) {
+        return serve(0);
+    }
+    return run_prefork(static_cast<int>(workers), serve);
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace metrics {
+
+namespace {
+
+std::string baseName(const std::string& series) {
+  auto pos = series.find('{');
+  return pos == std::string::npos ? series : series.substr(0, pos);
+}
+
+// Integral gauges (byte counts, thread counts) are printed exactly instead of
+// in the stream's default 6-digit scientific notation.
+void writeValue(std::ostringstream& out, double v) {
+  if (std::isfinite(v) && v == std::floor(v) && std::fabs(v) < 9.0e15) {
+    out << static_cast<long long>(v);
+  } else {
+    out << std::setprecision(10) << v;
+  }
+}
+
+} // namespace
+
+Counter& Registry::counter(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& e = entries_[{baseName(name), name}];
+  if (!e.counter) {
+    e.help = help;
+    e.counter = std::make_unique<Counter>();
+  }
+  return *e.counter;
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& e = entries_[{baseName(name), name}];
+  if (!e.gauge) {
+    e.help = help;
+    e.gauge = std::make_unique<Gauge>();
+  }
+  return *e.gauge;
+}
+
+std::string Registry::renderPrometheus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  std::string last_base;
+  for (const auto& kv : entries_) {
+    const auto& base = kv.first.first;
+    if (base != last_base) {
+      out << "# HELP " << base << ' ' << kv.second.help << '\n';
+      out << "# TYPE " << base << ' '
+          << (kv.second.counter ? "counter" : "gauge") << '\n';
+      last_base = base;
+    }
+    out << kv.first.second << ' ';
+    if (kv.second.counter) {
+      out << kv.second.counter->value();
+    } else {
+      writeValue(out, kv.second.gauge->value());
+    }
+    out << '\n';
+  }
+  return out.str();
+}
+
+Registry& registry() {
+  static Registry instance;
+  return instance;
+}
+
+} // namespace metrics
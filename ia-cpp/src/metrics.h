@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Minimal Prometheus-style metrics registry served on GET /metrics.
+//
+// Series names may carry labels ("ia_model_ready{model=\"a\"}"); HELP/TYPE
+// lines are emitted once per base name. Counters and gauges are lock-free to
+// update; the registry mutex is only taken on registration and rendering.
+namespace metrics {
+
+class Counter {
+public:
+  void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// Weight of the newest sample in the moving averages below
+constexpr double kEwmaAlpha = 0.2;
+
+// Exponentially weighted moving average; a `prev` of 0 (no sample yet)
+// takes `v` as it is
+inline double ewma(double prev, double v, double alpha = kEwmaAlpha) {
+  return prev == 0 ? v : (1 - alpha) * prev + alpha * v;
+}
+
+class Gauge {
+public:
+  void set(double v) { value_.store(v, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+  // Folds `v` into the gauge as an EWMA. A racy read-modify-write across
+  // callers: good enough for a gauge
+  void ewma(double v, double alpha = kEwmaAlpha) { set(metrics::ewma(value(), v, alpha)); }
+
+private:
+  std::atomic<double> value_{0.0};
+};
+
+class Registry {
+public:
+  // Returns the existing series when the name is already registered, so
+  // callers can look metrics up lazily without keeping references around.
+  Counter& counter(const std::string& name, const std::string& help);
+  Gauge& gauge(const std::string& name, const std::string& help);
+
+  std::string renderPrometheus() const;
+
+private:
+  struct Entry {
+    std::string help;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+  };
+
+  // Keyed on (base name, full series) so labelled series stay grouped under
+  // their HELP/TYPE header.
+  mutable std::mutex mutex_;
+  std::map<std::pair<std::string, std::string>, Entry> entries_;
+};
+
+Registry& registry();
+
+} // namespace metrics
@@ -0,0 +1,193 @@
+#include "ort_profile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+namespace {
+
+// Sizes come as strings in the trace ("output_size": "4096")
+int64_t arg_bytes(const nlohmann::json& args, const char* key) {
+  auto it = args.find(key);
+  if (it == args.end()) return 0;
+  if (it->is_number_integer()) return it->get<int64_t>();
+  if (it->is_string()) return std::strtoll(it->get<std::string>().c_str(), nullptr, 10);
+  return 0;
+}
+
+struct Totals {
+  std::string op;
+  uint64_t calls = 0;
+  uint64_t total_us = 0;
+  int64_t output_bytes = 0;
+  int64_t activation_bytes = 0;
+  int64_t parameter_bytes = 0;
+  // Allocator counters, reported by newer ORT releases (0 otherwise)
+  int64_t allocated_bytes = 0;    // largest mem_in_use_delta of one call
+  int64_t arena_growth_bytes = 0; // mem_arena_held_delta
+};
+
+nlohmann::json top_entries(const std::vector<Totals>& entries, size_t top,
+                           uint64_t kernel_us, bool with_sizes,
+                           const char* name_key,
+                           const std::vector<std::string>& names) {
+  std::vector<size_t> order(entries.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return entries[a].total_us > entries[b].total_us;
+  });
+  if (order.size() > top) order.resize(top);
+
+  auto out = nlohmann::json::array();
+  for (size_t i : order) {
+    const auto& t = entries[i];
+    nlohmann::json e{{name_key, names[i]},
+                     {"calls", t.calls},
+                     {"total_us", t.total_us},
+                     {"avg_us", t.calls ? static_cast<double>(t.total_us) / t.calls : 0.0},
+                     {"share", kernel_us ? static_cast<double>(t.total_us) / kernel_us : 0.0}};
+    if (with_sizes) {
+      // Per call: the sizes are the same on every run of a node
+      e["op"] = t.op;
+      e["output_bytes"] = t.calls ? t.output_bytes / t.calls : 0;
+      e["activation_bytes"] = t.calls ? t.activation_bytes / t.calls : 0;
+      e["parameter_bytes"] = t.calls ? t.parameter_bytes / t.calls : 0;
+      e["allocated_bytes"] = t.allocated_bytes;
+      e["arena_growth_bytes"] = t.arena_growth_bytes;  // whole capture
+    }
+    out.push_back(std::move(e));
+  }
+  return out;
+}
+
+} // namespace
+
+void ProfileCapture::mirror(const float* xs, size_t n) {
+  if (!active_.load(std::memory_order_relaxed)) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!active_ || queue_.size() >= kMaxQueued) return;
+    queue_.emplace_back(xs, xs + n);
+  }
+  cond_.notify_one();
+}
+
+bool ProfileCapture::begin() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (claimed_) return false;
+  claimed_ = true;
+  queue_.clear();
+  return true;
+}
+
+size_t ProfileCapture::replay(size_t runs, std::chrono::milliseconds window,
+                              const RunFn& run) {
+  active_.store(true, std::memory_order_relaxed);
+  auto deadline = std::chrono::steady_clock::now() + window;
+  size_t done = 0;
+  while (done < runs) {
+    std::vector<float> xs;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!cond_.wait_until(lock, deadline, [this] { return !queue_.empty(); })) {
+        break;
+      }
+      xs = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    run(xs);
+    done++;
+  }
+  active_.store(false, std::memory_order_relaxed);
+  return done;
+}
+
+void ProfileCapture::end() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  active_ = false;
+  queue_.clear();
+  claimed_ = false;
+}
+
+bool summarize_ort_profile(const std::string& path, size_t top,
+                           nlohmann::json& summary, std::string& error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "cannot open " + path;
+    return false;
+  }
+  nlohmann::json trace;
+  try {
+    in >> trace;
+  } catch (const nlohmann::json::exception& e) {
+    error = std::string("malformed trace: ") + e.what();
+    return false;
+  }
+  if (!trace.is_array()) {
+    error = "malformed trace: not an array";
+    return false;
+  }
+
+  // Node events come as "<node>_fence_before", "<node>_kernel_time" and
+  // "<node>_fence_after"; only the kernel time is the operator's own work
+  const std::string kernel_suffix = "_kernel_time";
+  std::map<std::string, size_t> op_index, node_index;
+  std::vector<Totals> ops, nodes;
+  std::vector<std::string> op_names, node_names;
+  uint64_t kernel_us = 0, run_us = 0, run_count = 0;
+
+  for (const auto& ev : trace) {
+    if (!ev.is_object()) continue;
+    const std::string cat = ev.value("cat", "");
+    const std::string name = ev.value("name", "");
+    const uint64_t dur = ev.value("dur", uint64_t(0));
+    if (cat == "Session" && name == "model_run") {
+      run_count++;
+      run_us += dur;
+      continue;
+    }
+    if (cat != "Node" || name.size() <= kernel_suffix.size() ||
+        name.compare(name.size() - kernel_suffix.size(), kernel_suffix.size(),
+                     kernel_suffix) != 0) {
+      continue;
+    }
+    static const nlohmann::json kNoArgs = nlohmann::json::object();
+    const auto& args = ev.contains("args") ? ev["args"] : kNoArgs;
+    const std::string op = args.value("op_name", "?");
+    const std::string node = name.substr(0, name.size() - kernel_suffix.size());
+
+    auto [oi, new_op] = op_index.emplace(op, ops.size());
+    if (new_op) {
+      ops.emplace_back();
+      op_names.push_back(op);
+    }
+    auto [ni, new_node] = node_index.emplace(node, nodes.size());
+    if (new_node) {
+      nodes.emplace_back();
+      nodes.back().op = op;
+      node_names.push_back(node);
+    }
+    for (Totals* t : {&ops[oi->second], &nodes[ni->second]}) {
+      t->calls++;
+      t->total_us += dur;
+    }
+    auto& n = nodes[ni->second];
+    n.output_bytes += arg_bytes(args, "output_size");
+    n.activation_bytes += arg_bytes(args, "activation_size");
+    n.parameter_bytes += arg_bytes(args, "parameter_size");
+    n.allocated_bytes = std::max(n.allocated_bytes, arg_bytes(args, "mem_in_use_delta"));
+    n.arena_growth_bytes += arg_bytes(args, "mem_arena_held_delta");
+    kernel_us += dur;
+  }
+
+  summary = {
+      {"model_runs", run_count},
+      {"model_run_total_us", run_us},
+      {"model_run_avg_us", run_count ? static_cast<double>(run_us) / run_count : 0.0},
+      {"kernel_total_us", kernel_us},
+      {"top_operators", top_entries(ops, top, kernel_us, false, "op", op_names)},
+      {"top_nodes", top_entries(nodes, top, kernel_us, true, "node", node_names)},
+  };
+  return true;
+}
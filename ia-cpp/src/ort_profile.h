@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// On-demand ORT profiling (POST /admin/profile).
+//
+// The serving session is never profiled: a capture builds a separate session
+// with profiling enabled and replays copies of the live inputs through it,
+// on a low-priority thread of its own. While no capture is active the only
+// cost on the serving path is one relaxed atomic load per run.
+class ProfileCapture {
+public:
+  using RunFn = std::function<void(const std::vector<float>& xs)>;
+
+  // Serving path: copies the inputs of one run when a capture is active.
+  // Drops them rather than wait when the capture falls behind.
+  void mirror(const float* xs, size_t n);
+
+  // Claims the capture; false if another one is already running
+  bool begin();
+
+  // Feeds mirrored runs to `run` until `runs` have been replayed or
+  // `window` has passed. Returns how many were replayed.
+  size_t replay(size_t runs, std::chrono::milliseconds window, const RunFn& run);
+
+  void end();
+
+private:
+  static constexpr size_t kMaxQueued = 256;
+
+  std::atomic<bool> active_{false};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::vector<float>> queue_;
+  bool claimed_ = false;
+};
+
+// Summary of an ORT profiling trace (the JSON array written by
+// EndProfiling): the `top` operator types by total kernel time and the
+// `top` nodes with their output/activation/parameter sizes, plus the
+// model_run count and time. False with `error` if the file is unreadable.
+bool summarize_ort_profile(const std::string& path, size_t top,
+                           nlohmann::json& summary, std::string& error);
@@ -0,0 +1,37 @@
+// Linked only into the instrumented build (IA_PGO=GENERATE).
+//
+// Profiles are written at exit(), but SIGTERM ends the server (or a prefork
+// worker) without one, and the training run stops it with SIGTERM. The
+// handlers installed here dump the counters first. A separate file so that
+// main.cpp is the same code in both PGO stages.
+
+#include <csignal>
+
+#include <unistd.h>
+
+#if defined(__clang__)
+extern "C" int __llvm_profile_write_file(void);
+#else
+extern "C" void __gcov_dump(void);
+#endif
+
+namespace {
+
+void dump_and_exit(int) {
+#if defined(__clang__)
+  __llvm_profile_write_file();
+#else
+  __gcov_dump();
+#endif
+  ::_exit(0);
+}
+
+// Before main(): the prefork supervisor blocks these signals for itself and
+// its workers restore the mask, so the handlers end up in every process
+const bool installed = [] {
+  std::signal(SIGTERM, dump_and_exit);
+  std::signal(SIGINT, dump_and_exit);
+  return true;
+}();
+
+} // namespace
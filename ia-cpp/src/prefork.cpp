@@ -0,0 +1,173 @@
+#include "prefork.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+// A worker that dies sooner than this after starting counts as crash-looping
+constexpr auto kStableAfter = std::chrono::seconds(5);
+constexpr auto kMaxBackoff = std::chrono::seconds(5);
+
+struct Worker {
+  pid_t pid = -1;
+  steady::time_point started;
+  steady::time_point restart_at;  // when pid == -1 and a restart is pending
+  bool restart_pending = false;
+  int quick_deaths = 0;
+};
+
+pid_t spawn(int index, const std::function<int(int)>& worker,
+            const sigset_t& child_mask) {
+  // Whatever is still buffered would be printed by both processes
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t supervisor = ::getpid();
+  pid_t pid = ::fork();
+  if (pid != 0) return pid;
+
+  ::pthread_sigmask(SIG_SETMASK, &child_mask, nullptr);
+  ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (::getppid() != supervisor) ::_exit(0);  // supervisor already gone
+
+  int rc = worker(index);
+  std::cout.flush();
+  std::cerr.flush();
+  ::_exit(rc);
+}
+
+} // namespace
+
+int run_prefork(int workers, const std::function<int(int index)>& worker) {
+  // Signals are taken synchronously with sigtimedwait, so none can slip in
+  // between checking for them and going to sleep
+  sigset_t supervised, previous;
+  sigemptyset(&supervised);
+  sigaddset(&supervised, SIGCHLD);
+  sigaddset(&supervised, SIGTERM);
+  sigaddset(&supervised, SIGINT);
+  ::pthread_sigmask(SIG_BLOCK, &supervised, &previous);
+
+  std::vector<Worker> pool(static_cast<size_t>(workers));
+  bool stopping = false;
+  int exit_code = 0;
+
+  auto stop_all = [&](int code) {
+    if (stopping) return;
+    stopping = true;
+    exit_code = code;
+    for (auto& w : pool) {
+      w.restart_pending = false;
+      if (w.pid > 0) ::kill(w.pid, SIGTERM);
+    }
+  };
+
+  for (int i = 0; i < workers; i++) {
+    pool[i].pid = spawn(i, worker, previous);
+    pool[i].started = steady::now();
+    if (pool[i].pid < 0) {
+      std::cerr << "[error] fork: " << std::strerror(errno) << std::endl;
+      stop_all(1);
+      break;
+    }
+  }
+  if (!stopping) {
+    std::cout << "[info] Supervisor " << ::getpid() << " started " << workers
+              << " workers" << std::endl;
+  }
+
+  for (;;) {
+    // Reap everything that exited
+    int status;
+    pid_t pid;
+    while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+      auto it = std::find_if(pool.begin(), pool.end(),
+                             [pid](const Worker& w) { return w.pid == pid; });
+      if (it == pool.end()) continue;
+      int index = static_cast<int>(it - pool.begin());
+      it->pid = -1;
+      if (stopping) continue;
+
+      if (WIFEXITED(status)) {
+        std::cerr << "[error] Worker " << index << " (pid " << pid
+                  << ") exited with status " << WEXITSTATUS(status)
+                  << ", stopping all workers" << std::endl;
+        stop_all(WEXITSTATUS(status));
+        continue;
+      }
+
+      auto now = steady::now();
+      it->quick_deaths = now - it->started < kStableAfter ? it->quick_deaths + 1 : 0;
+      auto backoff = std::chrono::milliseconds(0);
+      if (it->quick_deaths > 0) {
+        backoff = std::min<std::chrono::milliseconds>(
+            std::chrono::milliseconds(100 << std::min(it->quick_deaths - 1, 6)),
+            kMaxBackoff);
+      }
+      std::cerr << "[warn] Worker " << index << " (pid " << pid
+                << ") killed by signal " << WTERMSIG(status) << " ("
+                << ::strsignal(WTERMSIG(status)) << "), restarting in "
+                << backoff.count() << " ms" << std::endl;
+      it->restart_pending = true;
+      it->restart_at = now + backoff;
+    }
+
+    // Restarts that are due
+    auto now = steady::now();
+    auto next_restart = steady::time_point::max();
+    for (size_t i = 0; i < pool.size(); i++) {
+      auto& w = pool[i];
+      if (!w.restart_pending) continue;
+      if (w.restart_at <= now) {
+        w.restart_pending = false;
+        w.pid = spawn(static_cast<int>(i), worker, previous);
+        w.started = now;
+        if (w.pid < 0) {
+          std::cerr << "[error] fork: " << std::strerror(errno) << std::endl;
+          stop_all(1);
+          break;
+        }
+        std::cout << "[info] Worker " << i << " restarted as pid " << w.pid
+                  << std::endl;
+      } else {
+        next_restart = std::min(next_restart, w.restart_at);
+      }
+    }
+
+    bool alive = std::any_of(pool.begin(), pool.end(), [](const Worker& w) {
+      return w.pid > 0 || w.restart_pending;
+    });
+    if (!alive) break;
+
+    timespec timeout{1, 0};
+    if (next_restart != steady::time_point::max()) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    next_restart - steady::now())
+                    .count();
+      ns = std::max<long long>(ns, 0);
+      timeout = {static_cast<time_t>(ns / 1000000000),
+                 static_cast<long>(ns % 1000000000)};
+    }
+    int sig = ::sigtimedwait(&supervised, nullptr, &timeout);
+    if ((sig == SIGTERM || sig == SIGINT) && !stopping) {
+      std::cout << "[info] Supervisor received " << ::strsignal(sig)
+                << ", stopping workers" << std::endl;
+      stop_all(0);
+    }
+  }
+
+  ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  return exit_code;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+
+// Prefork multi-process mode (--workers N).
+//
+// The calling process becomes a supervisor: it forks `workers` children that
+// each run `worker(index)` and serve on their own SO_REUSEPORT listener, so
+// the kernel spreads connections across them. Everything set up before the
+// call (configuration, the mapped model file) is shared copy-on-write; each
+// worker builds its own sessions, allocators and thread pools after the fork.
+//
+// Workers killed by a signal (crash, OOM killer) are restarted, with backoff
+// when they keep dying right after start. A worker that returns an exit code
+// is treated as a startup/configuration error: the supervisor stops the rest
+// and returns that code. SIGTERM/SIGINT are forwarded to all workers and the
+// supervisor returns 0 once they have exited.
+//
+// Must be called before any thread is started.
+int run_prefork(int workers, const std::function<int(int index)>& worker);
@@ -0,0 +1,239 @@
+#include "resources.h"
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint64_t kUnlimitedMemory = uint64_t(1) << 60;
+
+bool read_first_line(const std::string& path, std::string& line) {
+  std::ifstream in(path);
+  return in && std::getline(in, line);
+}
+
+// Path of our cgroup relative to the mount point, from /proc/self/cgroup.
+// For v2 the entry is "0::/path"; for v1 we look for the controller name.
+std::string cgroup_path(const std::string& controller) {
+  std::ifstream in("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(in, line)) {
+    auto first = line.find(':');
+    auto second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) continue;
+    auto controllers = line.substr(first + 1, second - first - 1);
+    auto path = line.substr(second + 1);
+    bool match = controller.empty() && controllers.empty();
+    std::istringstream names(controllers);
+    std::string name;
+    while (!match && !controller.empty() && std::getline(names, name, ',')) {
+      match = (name == controller);
+    }
+    if (match) return path == "/" ? "" : path;
+  }
+  return "";
+}
+
+// Tries <mount>/<our cgroup>/<file> first and falls back to <mount>/<file>,
+// which is what containers with a private cgroup namespace expose.
+bool read_cgroup_file(const std::string& mount, const std::string& rel,
+                      const std::string& file, std::string& line) {
+  if (!rel.empty() && read_first_line(mount + rel + "/" + file, line)) {
+    return true;
+  }
+  return read_first_line(mount + "/" + file, line);
+}
+
+bool read_cgroup2(ResourceBudget& b) {
+  const std::string mount = "/sys/fs/cgroup";
+  std::string line;
+  if (!read_first_line(mount + "/cgroup.controllers", line)) return false;
+  auto rel = cgroup_path("");
+
+  if (read_cgroup_file(mount, rel, "cpu.max", line)) {
+    std::istringstream ss(line);
+    std::string quota;
+    double period = 0;
+    ss >> quota >> period;
+    if (quota != "max" && period > 0) {
+      b.cpu_quota = std::strtod(quota.c_str(), nullptr) / period;
+    }
+  }
+  if (read_cgroup_file(mount, rel, "memory.max", line) && line != "max") {
+    b.memory_limit_bytes = std::strtoull(line.c_str(), nullptr, 10);
+  }
+  b.source = "cgroup2";
+  return true;
+}
+
+bool read_cgroup1(ResourceBudget& b) {
+  bool found = false;
+  std::string line;
+
+  auto cpu_rel = cgroup_path("cpu");
+  for (const char* mount : {"/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu"}) {
+    std::string quota_line, period_line;
+    if (read_cgroup_file(mount, cpu_rel, "cpu.cfs_quota_us", quota_line) &&
+        read_cgroup_file(mount, cpu_rel, "cpu.cfs_period_us", period_line)) {
+      found = true;
+      double quota = std::strtod(quota_line.c_str(), nullptr);
+      double period = std::strtod(period_line.c_str(), nullptr);
+      if (quota > 0 && period > 0) b.cpu_quota = quota / period;
+      break;
+    }
+  }
+
+  if (read_cgroup_file("/sys/fs/cgroup/memory", cgroup_path("memory"),
+                       "memory.limit_in_bytes", line)) {
+    found = true;
+    uint64_t limit = std::strtoull(line.c_str(), nullptr, 10);
+    // v1 reports "no limit" as a huge page-aligned number
+    if (limit > 0 && limit < kUnlimitedMemory) b.memory_limit_bytes = limit;
+  }
+
+  if (found) b.source = "cgroup1";
+  return found;
+}
+
+unsigned affinity_cpu_count(unsigned fallback) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    int n = CPU_COUNT(&set);
+    if (n > 0) return static_cast<unsigned>(n);
+  }
+#endif
+  return fallback;
+}
+
+} // namespace
+
+long env_long(const char* name, long def) {
+  const char* v = std::getenv(name);
+  if (!v || !*v) return def;
+  char* end = nullptr;
+  long n = std::strtol(v, &end, 10);
+  return (end && *end == '\0' && n > 0) ? n : def;
+}
+
+ResourceBudget detect_resource_budget(unsigned workers) {
+  ResourceBudget b;
+  b.workers = std::max(1u, workers);
+  b.host_cpus = std::max(1u, std::thread::hardware_concurrency());
+  b.affinity_cpus = affinity_cpu_count(b.host_cpus);
+
+  if (!read_cgroup2(b)) read_cgroup1(b);
+
+  double usable = b.affinity_cpus;
+  if (b.cpu_quota > 0) usable = std::min(usable, b.cpu_quota);
+  b.cpus = std::max(1u, static_cast<unsigned>(std::ceil(usable)));
+  unsigned share = std::max(1u, b.cpus / b.workers);  // cores per process
+
+  // HTTP workers mostly sit in keep-alive reads, so allow some
+  // oversubscription, but nowhere near one thread per host core.
+  b.http_threads = std::max<size_t>(4, 2 * share);
+  b.http_threads = std::min<size_t>(b.http_threads, 64);
+  b.http_max_queued = b.http_threads * 64;
+
+  // One intra-op thread per usable core; inter-op parallelism only pays off
+  // with parallel execution mode and several cores to spare.
+  b.ort_intra_threads = static_cast<int>(share);
+  b.ort_inter_threads = 1;
+
+  b.max_batch_size = std::min<size_t>(256, std::max<size_t>(8, 16 * share));
+  b.payload_max_bytes = size_t(64) << 20;
+
+  if (b.memory_limit_bytes > 0) {
+    // Keep request buffers and queued connections to a small slice of the
+    // memory limit so a burst cannot push the container into the OOM killer.
+    auto mem = static_cast<size_t>(b.memory_limit_bytes) / b.workers;
+    b.payload_max_bytes =
+        std::min(b.payload_max_bytes, std::max<size_t>(mem / 64, 1u << 20));
+    b.http_max_queued =
+        std::min(b.http_max_queued, std::max<size_t>(mem / (256u << 10), 16));
+    b.max_batch_size =
+        std::min(b.max_batch_size, std::max<size_t>(mem / (4u << 20), 1));
+  }
+
+  b.http_threads = env_long("HTTP_THREADS", static_cast<long>(b.http_threads));
+  b.ort_intra_threads = static_cast<int>(
+      env_long("ORT_INTRA_OP_THREADS", b.ort_intra_threads));
+  b.ort_inter_threads = static_cast<int>(
+      env_long("ORT_INTER_OP_THREADS", b.ort_inter_threads));
+  b.max_batch_size =
+      env_long("MAX_BATCH_SIZE", static_cast<long>(b.max_batch_size));
+  b.batch_max_delay_us = env_long("BATCH_MAX_DELAY_US", 0);
+
+  return b;
+}
+
+void log_resource_budget(const ResourceBudget& b) {
+  std::cout << "[info] Resource budget (" << b.source << "): host_cpus="
+            << b.host_cpus << " affinity_cpus=" << b.affinity_cpus
+            << " cpu_quota="
+            << (b.cpu_quota > 0 ? std::to_string(b.cpu_quota) : "max")
+            << " memory_limit="
+            << (b.memory_limit_bytes > 0 ? std::to_string(b.memory_limit_bytes)
+                                         : "max")
+            << std::endl;
+  std::cout << "[info] Derived sizes: cpus=" << b.cpus
+            << (b.workers > 1 ? " per_worker(" + std::to_string(b.workers) + "):"
+                              : std::string())
+            << " http_threads=" << b.http_threads
+            << " http_max_queued=" << b.http_max_queued
+            << " ort_intra=" << b.ort_intra_threads
+            << " ort_inter=" << b.ort_inter_threads
+            << " max_batch=" << b.max_batch_size
+            << " batch_delay_us=" << b.batch_max_delay_us
+            << " payload_max=" << b.payload_max_bytes << std::endl;
+}
+
+void export_resource_budget(const ResourceBudget& b) {
+  auto& r = metrics::registry();
+  r.gauge("ia_budget_host_cpus", "Cores reported by the host").set(b.host_cpus);
+  r.gauge("ia_budget_cpu_quota", "cgroup CPU quota in cores (0 = unlimited)")
+      .set(b.cpu_quota);
+  r.gauge("ia_budget_memory_limit_bytes",
+          "cgroup memory limit in bytes (0 = unlimited)")
+      .set(static_cast<double>(b.memory_limit_bytes));
+  r.gauge("ia_budget_cpus", "Usable cores after quota and affinity").set(b.cpus);
+  r.gauge("ia_budget_workers", "Server processes sharing the budget")
+      .set(b.workers);
+  r.gauge("ia_budget_http_threads", "HTTP worker threads")
+      .set(static_cast<double>(b.http_threads));
+  r.gauge("ia_budget_ort_intra_threads", "ORT intra-op threads")
+      .set(b.ort_intra_threads);
+  r.gauge("ia_budget_ort_inter_threads", "ORT inter-op threads")
+      .set(b.ort_inter_threads);
+  r.gauge("ia_budget_max_batch_size", "Maximum inference batch size")
+      .set(static_cast<double>(b.max_batch_size));
+  r.gauge("ia_budget_batch_max_delay_us", "Batcher wait for a fuller batch (us)")
+      .set(static_cast<double>(b.batch_max_delay_us));
+  r.gauge("ia_budget_payload_max_bytes", "Maximum request body size")
+      .set(static_cast<double>(b.payload_max_bytes));
+}
+
+void export_memory_usage() {
+#ifdef __linux__
+  static metrics::Gauge& resident = metrics::registry().gauge(
+      "ia_process_resident_bytes", "Resident set size of this process");
+  std::ifstream in("/proc/self/statm");
+  uint64_t size = 0, pages = 0;
+  if (in >> size >> pages) {
+    resident.set(static_cast<double>(pages) * sysconf(_SC_PAGESIZE));
+  }
+#endif
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// CPU/memory budget of the container we run in.
+//
+// std::thread::hardware_concurrency() reports host cores, so on Render or a
+// Kubernetes node with a 0.5-2 vCPU quota we used to start dozens of HTTP
+// threads plus ORT's per-core defaults. The budget below is derived from the
+// cgroup (v2 cpu.max/memory.max, or the v1 equivalents) and the affinity mask,
+// and every pool size in the process should come from it.
+struct ResourceBudget {
+  // Raw limits as detected
+  unsigned host_cpus = 1;
+  unsigned affinity_cpus = 1;
+  double cpu_quota = 0.0;           // cores; 0 = unlimited
+  uint64_t memory_limit_bytes = 0;  // 0 = unlimited
+  std::string source{"host"};      // "cgroup2", "cgroup1" or "host"
+
+  // Derived sizes
+  unsigned cpus = 1;                // usable cores, rounded up
+  unsigned workers = 1;             // processes sharing the budget
+  size_t http_threads = 4;
+  size_t http_max_queued = 0;       // 0 = unbounded
+  int ort_intra_threads = 1;
+  int ort_inter_threads = 1;
+  size_t max_batch_size = 32;
+  long batch_max_delay_us = 0;      // batcher wait for a fuller batch
+  size_t payload_max_bytes = 0;
+};
+
+// Reads the cgroup limits and derives pool sizes. Environment variables
+// HTTP_THREADS, ORT_INTRA_OP_THREADS, ORT_INTER_OP_THREADS, MAX_BATCH_SIZE and
+// BATCH_MAX_DELAY_US override the derived values.
+//
+// With `workers` > 1 (prefork mode) the derived sizes are per process, so the
+// container's cores and memory are split between them; the environment
+// overrides are taken as per-process values.
+ResourceBudget detect_resource_budget(unsigned workers = 1);
+
+void log_resource_budget(const ResourceBudget& budget);
+void export_resource_budget(const ResourceBudget& budget);
+
+// Refreshes ia_process_resident_bytes from /proc/self/statm; called on each
+// /metrics scrape so allocator growth (or the lack of shrinkage) shows up.
+void export_memory_usage();
+
+// Integer environment variable, or `def` when unset or not a positive number.
+long env_long(const char* name, long def);
@@ -0,0 +1,133 @@
+#pragma once
+
+// Layout of the shared-memory transport segment, shared by the server
+// (src/shm_server.cpp) and the client library (client/shm_client.cpp).
+//
+// The segment holds kSlots request slots and an MPSC ring of slot indices.
+// A client claims a free slot, writes its input, pushes the slot index and
+// rings the doorbell; the server pops indices, runs the inputs through the
+// inference batcher and marks each slot done. Both sides only make a futex
+// syscall when the other side is actually parked, so a busy pipeline runs
+// without any syscalls at all.
+//
+// Everything in here must stay address-independent (no pointers) and use
+// only lock-free atomics, since the segment is mapped by several processes.
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace shm {
+
+constexpr uint32_t kMagic = 0x49414331;  // "IAC1"
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kSlots = 256;         // power of two (ring indexing)
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "");
+
+enum SlotState : uint32_t {
+  kFree = 0,
+  kClaimed,    // client is filling it in
+  kPending,    // queued for / running on the server
+  kDone,       // result ready for the client
+  kAbandoned,  // client timed out; the server frees it on completion
+};
+
+struct alignas(64) Slot {
+  std::atomic<uint32_t> state;           // also the client's futex word
+  std::atomic<uint32_t> client_waiting;
+  std::atomic<int32_t> owner_pid;        // 0 whenever the slot is free
+  int32_t status;                        // 200, or 500 on inference error
+  float x;
+  float y;
+};
+
+struct alignas(64) Cell {
+  std::atomic<uint64_t> seq;
+  uint32_t slot;
+};
+
+struct Segment {
+  std::atomic<uint32_t> magic;  // stored last by the server, once set up
+  uint32_t version;
+  uint32_t slots;
+  int32_t server_pid;
+
+  alignas(64) std::atomic<uint64_t> enqueue_pos;
+  alignas(64) std::atomic<uint64_t> dequeue_pos;
+  alignas(64) std::atomic<uint32_t> doorbell;  // server's futex word
+  std::atomic<uint32_t> server_waiting;
+
+  Cell cells[kSlots];
+  Slot slot[kSlots];
+};
+
+inline void init_segment(Segment& s) {
+  s.version = kVersion;
+  s.slots = kSlots;
+  s.server_pid = static_cast<int32_t>(::getpid());
+  s.enqueue_pos.store(0);
+  s.dequeue_pos.store(0);
+  s.doorbell.store(0);
+  s.server_waiting.store(0);
+  for (uint32_t i = 0; i < kSlots; i++) {
+    s.cells[i].seq.store(i);
+    s.slot[i].state.store(kFree);
+    s.slot[i].client_waiting.store(0);
+    s.slot[i].owner_pid.store(0);
+  }
+}
+
+// Bounded MPSC ring (Vyukov's sequence-numbered cells). It can never be full
+// when producers only push slots they own, since it has one cell per slot.
+inline bool ring_push(Segment& s, uint32_t slot) {
+  uint64_t pos = s.enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    Cell& cell = s.cells[pos & (kSlots - 1)];
+    uint64_t seq = cell.seq.load(std::memory_order_acquire);
+    auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+    if (diff == 0) {
+      if (s.enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+        cell.slot = slot;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = s.enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// Single consumer (the server thread)
+inline bool ring_pop(Segment& s, uint32_t& slot) {
+  uint64_t pos = s.dequeue_pos.load(std::memory_order_relaxed);
+  Cell& cell = s.cells[pos & (kSlots - 1)];
+  uint64_t seq = cell.seq.load(std::memory_order_acquire);
+  if (static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1) < 0) return false;
+  slot = cell.slot;
+  s.dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+  cell.seq.store(pos + kSlots, std::memory_order_release);
+  return true;
+}
+
+// Shared (not FUTEX_PRIVATE) futexes, since waiters live in other processes
+inline long futex_wait(std::atomic<uint32_t>& word, uint32_t expected,
+                       const timespec* timeout) {
+  return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+                   expected, timeout, nullptr, 0);
+}
+
+inline long futex_wake(std::atomic<uint32_t>& word, int count) {
+  return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE,
+                   count, nullptr, nullptr, 0);
+}
+
+} // namespace shm
@@ -0,0 +1,138 @@
+#include "shm_server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+#include "shm_layout.h"
+
+namespace {
+
+struct ShmMetrics {
+  metrics::Counter& requests;
+  metrics::Counter& wakeups;
+  metrics::Counter& reclaimed;
+};
+
+ShmMetrics& shm_metrics() {
+  auto& r = metrics::registry();
+  static ShmMetrics m{
+      r.counter("ia_shm_requests_total", "Requests received over shared memory"),
+      r.counter("ia_shm_server_wakeups_total",
+                "Times the shared-memory server was woken from its futex"),
+      r.counter("ia_shm_reclaimed_slots_total",
+                "Slots freed after their client process died"),
+  };
+  return m;
+}
+
+void complete(shm::Slot& slot, int status, float y) {
+  slot.status = status;
+  slot.y = y;
+  uint32_t expected = shm::kPending;
+  if (slot.state.compare_exchange_strong(expected, shm::kDone)) {
+    if (slot.client_waiting.load()) shm::futex_wake(slot.state, 1);
+  } else {
+    // The client gave up waiting; nobody will read this result
+    slot.owner_pid.store(0);
+    slot.state.store(shm::kFree, std::memory_order_release);
+  }
+}
+
+// Slots held by clients that died without releasing them
+void reclaim_dead_slots(shm::Segment& seg) {
+  for (auto& slot : seg.slot) {
+    uint32_t state = slot.state.load();
+    if (state != shm::kClaimed && state != shm::kDone) continue;
+    // A slot that was just claimed has no owner yet
+    int32_t pid = slot.owner_pid.load();
+    if (pid <= 0 || ::kill(pid, 0) == 0 || errno != ESRCH) continue;
+    slot.owner_pid.store(0);
+    if (slot.state.compare_exchange_strong(state, shm::kFree)) {
+      shm_metrics().reclaimed.inc();
+    }
+  }
+}
+
+void serve(shm::Segment& seg, InferenceBatcher& batcher) {
+  auto& m = shm_metrics();
+  auto submit = [&](uint32_t index) {
+    auto& slot = seg.slot[index % shm::kSlots];
+    m.requests.inc();
+    bool queued = batcher.submit(slot.x, [&slot](InferenceBatcher::Result r) {
+      if (r.contains("error") || !r.contains("y")) {
+        complete(slot, 500, 0.0f);
+      } else {
+        complete(slot, 200, r["y"].get<float>());
+      }
+    });
+    if (!queued) complete(slot, 503, 0.0f);
+  };
+
+  const timespec idle_timeout{1, 0};
+  for (;;) {
+    uint32_t index;
+    if (shm::ring_pop(seg, index)) {
+      submit(index);
+      continue;
+    }
+
+    // Park on the doorbell. Clients bump it after every push and only make
+    // the wake syscall when server_waiting is set.
+    uint32_t bell = seg.doorbell.load();
+    seg.server_waiting.store(1);
+    if (shm::ring_pop(seg, index)) {
+      seg.server_waiting.store(0);
+      submit(index);
+      continue;
+    }
+    long rc = shm::futex_wait(seg.doorbell, bell, &idle_timeout);
+    seg.server_waiting.store(0);
+    if (rc == 0) {
+      m.wakeups.inc();
+    } else if (errno == ETIMEDOUT) {
+      reclaim_dead_slots(seg);
+    }
+  }
+}
+
+} // namespace
+
+bool start_shm_server(const std::string& name, InferenceBatcher& batcher) {
+  // Replace whatever a previous run left behind: its clients are stale too
+  ::shm_unlink(name.c_str());
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0660);
+  if (fd < 0 || ::ftruncate(fd, sizeof(shm::Segment)) != 0) {
+    std::cerr << "[error] shared memory segment " << name << ": "
+              << std::strerror(errno) << std::endl;
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+  void* addr = ::mmap(nullptr, sizeof(shm::Segment), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "[error] mmap of " << name << ": " << std::strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  auto* seg = static_cast<shm::Segment*>(addr);
+  shm::init_segment(*seg);
+  seg->magic.store(shm::kMagic, std::memory_order_release);
+
+  shm_metrics();
+  std::thread([seg, &batcher] { serve(*seg, batcher); }).detach();
+
+  std::cout << "[info] Shared-memory transport at /dev/shm" << name << " ("
+            << shm::kSlots << " slots, " << sizeof(shm::Segment) << " bytes)"
+            << std::endl;
+  return true;
+}
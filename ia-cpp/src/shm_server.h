@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include "batcher.h"
+
+// Shared-memory transport for callers on the same host (SHM_NAME=/ia-cpp).
+//
+// Creates the POSIX shared-memory segment described in shm_layout.h (under
+// /dev/shm) and starts the thread that drains its request ring into the
+// inference batcher. Clients use the library in client/shm_client.h; there
+// is no socket, HTTP parsing or JSON on this path.
+//
+// A stale segment left by a previous run under the same name is replaced.
+// Returns false if the segment cannot be created.
+bool start_shm_server(const std::string& name, InferenceBatcher& batcher);
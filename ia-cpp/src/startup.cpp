@@ -0,0 +1,154 @@
+#include "startup.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+steady::time_point g_start = steady::now();
+std::atomic<bool> g_port_open{false};
+std::atomic<bool> g_ready_reported{false};
+
+// Time between exec and now, from the process start time in /proc (clock
+// ticks since boot) and CLOCK_BOOTTIME; 0 if unavailable
+double seconds_since_exec() {
+  std::ifstream in("/proc/self/stat");
+  std::string stat((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  auto paren = stat.rfind(')');  // the command name may contain spaces
+  if (paren == std::string::npos) return 0;
+  std::istringstream fields(stat.substr(paren + 2));
+  std::string field;
+  unsigned long long start_ticks = 0;
+  // starttime is field 22; fields after ')' start at 3
+  for (int i = 3; i <= 22 && fields >> field; i++) {
+    if (i == 22) start_ticks = std::stoull(field);
+  }
+  timespec now{};
+  long hz = ::sysconf(_SC_CLK_TCK);
+  if (start_ticks == 0 || hz <= 0 || ::clock_gettime(CLOCK_BOOTTIME, &now) != 0) {
+    return 0;
+  }
+  double elapsed = now.tv_sec + now.tv_nsec / 1e9 - static_cast<double>(start_ticks) / hz;
+  return elapsed > 0 ? elapsed : 0;
+}
+
+const char* state_name(ModelReadiness::State state) {
+  switch (state) {
+    case ModelReadiness::State::loading: return "loading";
+    case ModelReadiness::State::ready:   return "ready";
+    case ModelReadiness::State::failed:  return "failed";
+    case ModelReadiness::State::absent:  return "absent";
+  }
+  return "unknown";
+}
+
+// Once the port is open and no model is loading
+void report_ready_if_settled() {
+  if (!g_port_open.load() || !model_readiness().ready()) return;
+  if (g_ready_reported.exchange(true)) return;
+  double t = seconds_since_start();
+  metrics::registry()
+      .gauge("ia_startup_time_to_ready_seconds",
+             "Seconds from exec until every model was loaded (or given up)")
+      .set(t);
+  std::cout << "[info] Ready " << t << " s after start" << std::endl;
+}
+
+} // namespace
+
+void mark_process_start() {
+  g_start = steady::now() -
+            std::chrono::duration_cast<steady::duration>(
+                std::chrono::duration<double>(seconds_since_exec()));
+}
+
+double seconds_since_start() {
+  return std::chrono::duration<double>(steady::now() - g_start).count();
+}
+
+void record_port_open() {
+  if (g_port_open.exchange(true)) return;
+  double t = seconds_since_start();
+  metrics::registry()
+      .gauge("ia_startup_time_to_port_seconds",
+             "Seconds from exec until the listener was bound")
+      .set(t);
+  std::cout << "[info] Listening " << t << " s after start" << std::endl;
+  report_ready_if_settled();
+}
+
+void ModelReadiness::expect(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  models_[name] = Entry{};
+  metrics::registry()
+      .gauge("ia_model_ready{model=\"" + name + "\"}", "1 when the model serves requests")
+      .set(0);
+}
+
+void ModelReadiness::settle(const std::string& name, State state, double load_seconds,
+                            const std::string& detail) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = models_[name];
+    entry.state = state;
+    entry.load_seconds = load_seconds;
+    entry.detail = detail;
+  }
+  metrics::registry()
+      .gauge("ia_model_ready{model=\"" + name + "\"}", "1 when the model serves requests")
+      .set(state == State::ready ? 1 : 0);
+  if (state == State::ready || state == State::failed) {
+    metrics::registry()
+        .gauge("ia_model_load_seconds{model=\"" + name + "\"}",
+               "Time spent building the model's session")
+        .set(load_seconds);
+  }
+  report_ready_if_settled();
+}
+
+bool ModelReadiness::ready() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& [name, entry] : models_) {
+    if (entry.state == State::loading) return false;
+  }
+  return true;
+}
+
+ModelReadiness::State ModelReadiness::state(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = models_.find(name);
+  return it == models_.end() ? State::absent : it->second.state;
+}
+
+nlohmann::json ModelReadiness::describe() const {
+  nlohmann::json models = nlohmann::json::object();
+  bool ready = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [name, entry] : models_) {
+      nlohmann::json m{{"state", state_name(entry.state)}};
+      if (entry.state == State::ready || entry.state == State::failed) {
+        m["load_s"] = entry.load_seconds;
+      }
+      if (!entry.detail.empty()) m["error"] = entry.detail;
+      models[name] = std::move(m);
+      ready = ready && entry.state != State::loading;
+    }
+  }
+  return {{"ready", ready}, {"uptime_s", seconds_since_start()}, {"models", std::move(models)}};
+}
+
+ModelReadiness& model_readiness() {
+  static ModelReadiness readiness;
+  return readiness;
+}
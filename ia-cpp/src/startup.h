@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+// Startup timeline and model readiness.
+//
+// The listener binds before ONNX Runtime is loaded: the library is opened
+// with dlopen and the sessions are built on background threads, so a cold
+// start answers /health/live as soon as the port is open and /health/ready
+// once every model has settled. Both points are exported as seconds since
+// the process was exec'd, dynamic linking included:
+//   ia_startup_time_to_port_seconds, ia_startup_time_to_ready_seconds.
+
+// Call first thing in main(). Forked workers inherit the start time.
+void mark_process_start();
+
+// Seconds since exec
+double seconds_since_start();
+
+// The listener is bound; only the first call counts
+void record_port_open();
+
+class ModelReadiness {
+public:
+  enum class State { loading, ready, failed, absent };
+
+  // A model that will be loaded in the background
+  void expect(const std::string& name);
+  // Final state; `detail` is the error for `failed`
+  void settle(const std::string& name, State state, double load_seconds = 0,
+              const std::string& detail = "");
+
+  // No model is still loading (failed and absent models count as settled:
+  // the service answers in dummy mode, as it did before lazy loading)
+  bool ready() const;
+  State state(const std::string& name) const;
+
+  // {"ready": bool, "models": {"name": {"state": ..., "load_s": ...}}}
+  nlohmann::json describe() const;
+
+private:
+  struct Entry {
+    State state = State::loading;
+    double load_seconds = 0;
+    std::string detail;
+  };
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> models_;
+};
+
+ModelReadiness& model_readiness();
@@ -0,0 +1,138 @@
+#include "tls.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "metrics.h"
+#include "resources.h"
+
+namespace {
+
+// Session cache entries are only valid for the context that issued them
+const unsigned char kSessionIdContext[] = "ia-cpp";
+
+struct TlsCounters {
+  metrics::Counter& full;
+  metrics::Counter& resumed;
+  metrics::Counter& ktls_tx;
+  metrics::Counter& ktls_rx;
+};
+
+TlsCounters& counters() {
+  auto& r = metrics::registry();
+  static TlsCounters c{
+      r.counter("ia_tls_handshakes_total{resumed=\"false\"}",
+                "Completed TLS handshakes"),
+      r.counter("ia_tls_handshakes_total{resumed=\"true\"}",
+                "Completed TLS handshakes"),
+      r.counter("ia_tls_ktls_connections_total{direction=\"tx\"}",
+                "TLS connections with kernel TLS offload enabled"),
+      r.counter("ia_tls_ktls_connections_total{direction=\"rx\"}",
+                "TLS connections with kernel TLS offload enabled"),
+  };
+  return c;
+}
+
+// TLS 1.3 reports HANDSHAKE_DONE again for post-handshake messages, so each
+// connection is marked the first time it is counted.
+int counted_index() {
+  static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+void on_tls_info(const SSL* ssl, int where, int /*ret*/) {
+  if (!(where & SSL_CB_HANDSHAKE_DONE)) return;
+  auto* s = const_cast<SSL*>(ssl);
+  if (SSL_get_ex_data(s, counted_index())) return;
+  SSL_set_ex_data(s, counted_index(), s);
+
+  auto& c = counters();
+  (SSL_session_reused(s) ? c.resumed : c.full).inc();
+#ifndef OPENSSL_NO_KTLS
+  if (BIO_get_ktls_send(SSL_get_wbio(s))) c.ktls_tx.inc();
+  if (BIO_get_ktls_recv(SSL_get_rbio(s))) c.ktls_rx.inc();
+#endif
+}
+
+std::string last_ssl_error() {
+  char buf[256];
+  ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+  return buf;
+}
+
+bool setup_context(SSL_CTX& ctx, const TlsConfig& config) {
+  SSL_CTX_set_min_proto_version(&ctx, TLS1_2_VERSION);
+
+  uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION |
+                     SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifndef OPENSSL_NO_KTLS
+  if (config.ktls) options |= SSL_OP_ENABLE_KTLS;
+#endif
+  SSL_CTX_set_options(&ctx, options);
+
+  if (SSL_CTX_use_certificate_chain_file(&ctx, config.cert_file.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(&ctx, config.key_file.c_str(),
+                                  SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(&ctx) != 1) {
+    std::cerr << "[error] TLS certificate/key: " << last_ssl_error() << std::endl;
+    return false;
+  }
+
+  // Resumption: stateless tickets (keys are generated per context, so they
+  // survive as long as the process) plus the server cache for clients that
+  // only offer a session ID. TLS 1.3 clients get `tls13_tickets` tickets
+  // after each handshake so parallel reconnects can each resume.
+  SSL_CTX_set_session_id_context(&ctx, kSessionIdContext,
+                                 sizeof(kSessionIdContext) - 1);
+  SSL_CTX_set_session_cache_mode(&ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(&ctx, config.session_cache_size);
+  SSL_CTX_set_timeout(&ctx, config.session_timeout_sec);
+  SSL_CTX_set_num_tickets(&ctx, static_cast<size_t>(config.tls13_tickets));
+
+  SSL_CTX_set_info_callback(&ctx, on_tls_info);
+  return true;
+}
+
+} // namespace
+
+bool TlsConfig::from_env(TlsConfig& out) {
+  const char* cert = std::getenv("TLS_CERT_FILE");
+  const char* key = std::getenv("TLS_KEY_FILE");
+  if (!cert || !*cert || !key || !*key) return false;
+
+  out.cert_file = cert;
+  out.key_file = key;
+  const char* ktls = std::getenv("TLS_KTLS");
+  if (ktls && (std::strcmp(ktls, "0") == 0 || std::strcmp(ktls, "false") == 0)) {
+    out.ktls = false;
+  }
+  out.session_timeout_sec =
+      env_long("TLS_SESSION_TIMEOUT", out.session_timeout_sec);
+  return true;
+}
+
+std::unique_ptr<httplib::Server> make_tls_server(const TlsConfig& config) {
+  counters();
+  auto server = std::make_unique<httplib::SSLServer>(
+      [&config](SSL_CTX& ctx) { return setup_context(ctx, config); });
+  if (!server->is_valid()) return nullptr;
+
+  // The handshake and the TLS 1.3 tickets go out as separate small writes;
+  // with Nagle the second one waits for the client's delayed ACK (~40 ms).
+  server->set_tcp_nodelay(true);
+
+  std::cout << "[info] TLS enabled: cert=" << config.cert_file
+            << " session_timeout=" << config.session_timeout_sec << "s"
+            << " tls13_tickets=" << config.tls13_tickets << " ktls="
+#ifndef OPENSSL_NO_KTLS
+            << (config.ktls ? "requested" : "off")
+#else
+            << "unsupported by OpenSSL build"
+#endif
+            << std::endl;
+  return server;
+}
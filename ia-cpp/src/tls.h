@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "httplib.h"
+
+// TLS termination for deployments without a fronting proxy (-DIA_TLS=ON).
+//
+// HTTPS is served when TLS_CERT_FILE and TLS_KEY_FILE (PEM) are both set.
+// Reconnecting clients resume their session, either through a stateless
+// ticket (TLS 1.2 and 1.3) or the server-side session cache, and skip the
+// certificate exchange and key agreement. With TLS_KTLS (default on) OpenSSL
+// hands record encryption to the kernel once the handshake is done, so
+// responses are encrypted in-kernel on the plain send path; without the
+// kernel `tls` module it silently stays in userspace.
+struct TlsConfig {
+  std::string cert_file;
+  std::string key_file;
+  bool ktls = true;
+  long session_timeout_sec = 7200;
+  long session_cache_size = 20480;
+  int tls13_tickets = 2;
+
+  // False when TLS_CERT_FILE/TLS_KEY_FILE are not both set
+  static bool from_env(TlsConfig& out);
+};
+
+// Returns nullptr (after logging the OpenSSL error) if the certificate or
+// key cannot be loaded.
+std::unique_ptr<httplib::Server> make_tls_server(const TlsConfig& config);
@@ -0,0 +1,841 @@
+#include "uring_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+struct UringMetrics {
+  metrics::Counter& enters;
+  metrics::Counter& requests;
+  metrics::Counter& connections;
+  metrics::Gauge& open_connections;
+};
+
+UringMetrics& uring_metrics() {
+  auto& r = metrics::registry();
+  static UringMetrics m{
+      r.counter("ia_uring_enter_total", "io_uring_enter syscalls"),
+      r.counter("ia_uring_requests_total", "HTTP requests served on io_uring"),
+      r.counter("ia_uring_connections_total", "Connections accepted on io_uring"),
+      r.gauge("ia_uring_open_connections", "Currently open io_uring connections"),
+  };
+  return m;
+}
+
+std::atomic<long> open_connections{0};
+std::atomic<size_t> threaded_requests{0};  // threaded_paths handlers in flight
+
+// --- Minimal ring (no liburing) ---------------------------------------------
+
+int sys_setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+              unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+int sys_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+class Ring {
+public:
+  ~Ring() {
+    if (sq_ptr_) ::munmap(sq_ptr_, sq_len_);
+    if (sqes_) ::munmap(sqes_, sqes_len_);
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  bool init(unsigned entries, std::string& error) {
+    io_uring_params p{};
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    fd_ = sys_setup(entries, &p);
+    if (fd_ < 0 && errno == EINVAL) {
+      p = io_uring_params{};
+      fd_ = sys_setup(entries, &p);
+    }
+    if (fd_ < 0) {
+      error = std::string("io_uring_setup: ") + std::strerror(errno);
+      return false;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+      error = "io_uring without IORING_FEAT_SINGLE_MMAP";
+      return false;
+    }
+
+    sq_len_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                       p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    sq_ptr_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ptr_ == MAP_FAILED || sqes == MAP_FAILED) {
+      if (sq_ptr_ == MAP_FAILED) sq_ptr_ = nullptr;
+      error = std::string("io_uring mmap: ") + std::strerror(errno);
+      return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* base = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    auto* array = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; i++) array[i] = i;
+    cq_head_ = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+    return true;
+  }
+
+  int fd() const { return fd_; }
+
+  // Zeroed SQE; submits what is queued when the SQ is full
+  io_uring_sqe* sqe() {
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      submit(0);
+    }
+    io_uring_sqe* e = &sqes_[tail_ & sq_mask_];
+    tail_++;
+    std::memset(e, 0, sizeof(*e));
+    return e;
+  }
+
+  int submit(unsigned wait_nr) {
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    unsigned to_submit = tail_ - submitted_;
+    submitted_ = tail_;
+    uring_metrics().enters.inc();
+    int rc = sys_enter(fd_, to_submit, wait_nr,
+                       wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return rc < 0 ? -errno : rc;
+  }
+
+  template <class F> void drain(F&& handle) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      io_uring_cqe cqe = cqes_[head & cq_mask_];
+      head++;
+      // Release the slot first: the handler may queue new work
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      handle(cqe);
+      tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+  }
+
+private:
+  int fd_ = -1;
+  void* sq_ptr_ = nullptr;
+  size_t sq_len_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_len_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned tail_ = 0;
+  unsigned submitted_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+// Provided buffer ring: the kernel picks a free buffer for every recv, so
+// idle connections hold no memory. The ring is addressed as a plain array of
+// io_uring_buf (the tail overlays bufs[0].resv): io_uring_buf_ring's flexible
+// array member comes out 8 bytes off when the header is compiled as C++.
+class BufferRing {
+public:
+  static constexpr uint16_t kGroup = 0;
+
+  ~BufferRing() {
+    if (ring_) ::munmap(ring_, ring_len_);
+  }
+
+  bool init(Ring& ring, unsigned entries, unsigned size, std::string& error) {
+    entries_ = entries;
+    size_ = size;
+    ring_len_ = entries * sizeof(io_uring_buf);
+    void* mem = ::mmap(nullptr, ring_len_, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mem == MAP_FAILED) {
+      error = std::string("buffer ring mmap: ") + std::strerror(errno);
+      return false;
+    }
+    ring_ = static_cast<io_uring_buf*>(mem);
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring_);
+    reg.ring_entries = entries;
+    reg.bgid = kGroup;
+    if (sys_register(ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+      error = std::string("IORING_REGISTER_PBUF_RING: ") + std::strerror(errno);
+      return false;
+    }
+    storage_.resize(static_cast<size_t>(entries) * size);
+    for (unsigned i = 0; i < entries; i++) recycle(static_cast<uint16_t>(i));
+    return true;
+  }
+
+  const char* data(uint16_t bid) const { return &storage_[size_t(bid) * size_]; }
+
+  void recycle(uint16_t bid) {
+    io_uring_buf& b = ring_[tail_ & (entries_ - 1)];
+    b.addr = reinterpret_cast<uint64_t>(data(bid));
+    b.len = size_;
+    b.bid = bid;
+    tail_++;
+    __atomic_store_n(&ring_[0].resv, tail_, __ATOMIC_RELEASE);
+  }
+
+private:
+  io_uring_buf* ring_ = nullptr;
+  size_t ring_len_ = 0;
+  unsigned entries_ = 0;
+  unsigned size_ = 0;
+  uint16_t tail_ = 0;
+  std::vector<char> storage_;
+};
+
+// --- HTTP framing -----------------------------------------------------------
+
+bool iequals_prefix(const char* line, size_t len, const char* name) {
+  size_t n = std::strlen(name);
+  if (len < n) return false;
+  for (size_t i = 0; i < n; i++) {
+    if (std::tolower(static_cast<unsigned char>(line[i])) != name[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr size_t kMalformed = std::string::npos;
+constexpr size_t kTooLarge = std::string::npos - 1;
+
+// Header value after `name_len` bytes of name and colon, without the
+// surrounding blanks, as httplib stores it
+std::string header_value(const char* line, size_t len, size_t name_len) {
+  size_t b = name_len, e = len;
+  while (b < e && (line[b] == ' ' || line[b] == '\t')) b++;
+  while (e > b && (line[e - 1] == ' ' || line[e - 1] == '\t')) e--;
+  return std::string(line + b, e - b);
+}
+
+bool iequals(const std::string& a, const char* b) {
+  return a.size() == std::strlen(b) && iequals_prefix(a.data(), a.size(), b);
+}
+
+// Length of the first complete request in `buf`: 0 while bytes are missing,
+// kMalformed if its framing cannot be parsed, kTooLarge if its body would
+// exceed `max_bytes`. httplib does the real parsing; this only has to know
+// where the request ends, and must agree with it on that, so anything
+// ambiguous (repeated or conflicting length headers, a Transfer-Encoding
+// other than "chunked", malformed chunks) is refused rather than guessed.
+size_t request_length(const std::string& buf, size_t max_bytes, bool& expect_continue) {
+  size_t head_end = buf.find("\r\n\r\n");
+  if (head_end == std::string::npos) return 0;
+  size_t body = head_end + 4;
+
+  unsigned long long content_length = 0;
+  bool has_length = false;
+  bool has_encoding = false;
+  bool chunked = false;
+  size_t pos = buf.find("\r\n") + 2;
+  while (pos < head_end + 2) {
+    size_t eol = buf.find("\r\n", pos);
+    const char* line = buf.data() + pos;
+    size_t len = eol - pos;
+    if (iequals_prefix(line, len, "content-length:")) {
+      std::string value = header_value(line, len, 15);
+      if (has_length || value.empty() ||
+          value.find_first_not_of("0123456789") != std::string::npos) {
+        return kMalformed;
+      }
+      has_length = true;
+      errno = 0;
+      content_length = std::strtoull(value.c_str(), nullptr, 10);
+      if (errno == ERANGE || content_length > max_bytes) return kTooLarge;
+    } else if (iequals_prefix(line, len, "transfer-encoding:")) {
+      // httplib only de-chunks an exact "chunked"; anything else it would
+      // frame differently from us
+      if (has_encoding || !iequals(header_value(line, len, 18), "chunked")) {
+        return kMalformed;
+      }
+      has_encoding = true;
+      chunked = true;
+    } else if (iequals_prefix(line, len, "expect:")) {
+      expect_continue = std::string(line, len).find("100-continue") !=
+                        std::string::npos;
+    }
+    pos = eol + 2;
+  }
+  if (has_length && has_encoding) return kMalformed;
+
+  if (!chunked) {
+    size_t total = body + static_cast<size_t>(content_length);
+    return buf.size() >= total ? total : 0;
+  }
+  for (pos = body;;) {
+    size_t eol = buf.find("\r\n", pos);
+    if (eol == std::string::npos) return 0;
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long size = std::strtoull(buf.c_str() + pos, &end, 16);
+    if (end == buf.c_str() + pos) return kMalformed;
+    if (errno == ERANGE || size > max_bytes) return kTooLarge;
+    pos = eol + 2;
+    if (size == 0) {
+      // Trailers, up to an empty line
+      for (;;) {
+        eol = buf.find("\r\n", pos);
+        if (eol == std::string::npos) return 0;
+        if (eol == pos) return eol + 2;
+        pos = eol + 2;
+      }
+    }
+    if (buf.size() < pos + size + 2) return 0;
+    if (buf.compare(pos + size, 2, "\r\n") != 0) return kMalformed;
+    pos += size + 2;
+  }
+}
+
+// Path of the request line at the start of `buf`, without the query
+std::string request_path(const std::string& buf) {
+  size_t start = buf.find(' ');
+  if (start == std::string::npos) return {};
+  size_t end = buf.find_first_of(" ?\r", ++start);
+  return end == std::string::npos ? std::string() : buf.substr(start, end - start);
+}
+
+// A request that has been read completely, as httplib's Stream
+class BufferedStream final : public httplib::Stream {
+public:
+  BufferedStream(const char* data, size_t size, std::string& out, int fd,
+                 int local_port)
+      : data_(data), size_(size), out_(out), fd_(fd), local_port_(local_port) {}
+
+  bool is_readable() const override { return pos_ < size_; }
+  bool wait_readable() const override { return true; }
+  bool wait_writable() const override { return true; }
+
+  ssize_t read(char* ptr, size_t size) override {
+    size_t n = std::min(size, size_ - pos_);
+    std::memcpy(ptr, data_ + pos_, n);
+    pos_ += n;
+    return static_cast<ssize_t>(n);
+  }
+
+  ssize_t write(const char* ptr, size_t size) override {
+    out_.append(ptr, size);
+    return static_cast<ssize_t>(size);
+  }
+
+  ssize_t write_gather(const char* ptr1, size_t size1, const char* ptr2,
+                       size_t size2) override {
+    out_.append(ptr1, size1);
+    out_.append(ptr2, size2);
+    return static_cast<ssize_t>(size1 + size2);
+  }
+
+  void get_remote_ip_and_port(std::string& ip, int& port) const override {
+    httplib::detail::get_remote_ip_and_port(fd_, ip, port);
+  }
+
+  void get_local_ip_and_port(std::string& ip, int& port) const override {
+    ip = "0.0.0.0";
+    port = local_port_;
+  }
+
+  socket_t socket() const override { return fd_; }
+  time_t duration() const override { return 0; }
+
+private:
+  const char* data_;
+  size_t size_;
+  size_t pos_ = 0;
+  std::string& out_;
+  int fd_;
+  int local_port_;
+};
+
+// --- Server -----------------------------------------------------------------
+
+enum Op : uint64_t { kAccept = 1, kTimer, kRecv, kSend, kShutdown, kCancel, kClose };
+constexpr int kOpShift = 56;
+constexpr uint64_t kIdMask = (uint64_t(1) << kOpShift) - 1;
+
+uint64_t user_data(Op op, uint64_t id) { return (uint64_t(op) << kOpShift) | id; }
+
+struct Conn {
+  uint64_t id = 0;
+  int fd = -1;
+  std::string remote_ip;
+  int remote_port = 0;
+  std::string in;
+  std::string out;     // being sent
+  size_t sent = 0;
+  std::string queued;  // responses produced while a send is in flight
+  steady::time_point last_active;
+  httplib::UpgradeHandler upgrade;
+  bool recv_armed = false;
+  bool sending = false;
+  bool closing = false;
+  bool handoff = false;  // upgraded: give the socket to its own thread
+  bool shutdown_issued = false;
+  bool cancel_issued = false;
+  bool continued = false;  // 100 Continue already sent for this request
+  bool released = false;
+};
+
+class RingServer {
+public:
+  RingServer(httplib::Server& svr, const UringOptions& options)
+      : svr_(svr), options_(options) {}
+
+  ~RingServer() {
+    if (listen_fd_ >= 0) ::close(listen_fd_);
+  }
+
+  bool init(std::string& error) {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (listen_fd_ >= 0) {
+      ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+      // Inherited by accepted sockets, so no setsockopt per connection
+      ::setsockopt(listen_fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(options_.port));
+    if (listen_fd_ < 0 ||
+        ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd_, SOMAXCONN) != 0) {
+      error = std::string("listen on port ") + std::to_string(options_.port) +
+              ": " + std::strerror(errno);
+      return false;
+    }
+    return ring_.init(1024, error) &&
+           buffers_.init(ring_, options_.buffers, options_.buffer_size, error);
+  }
+
+  void run() {
+    arm_accept();
+    arm_timer();
+    for (;;) {
+      int rc = ring_.submit(1);
+      if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+        std::cerr << "[error] io_uring_enter: " << std::strerror(-rc) << std::endl;
+        return;
+      }
+      ring_.drain([this](const io_uring_cqe& cqe) { handle(cqe); });
+    }
+  }
+
+private:
+  void handle(const io_uring_cqe& cqe) {
+    auto op = static_cast<Op>(cqe.user_data >> kOpShift);
+    uint64_t id = cqe.user_data & kIdMask;
+    switch (op) {
+      case kAccept: on_accept(cqe); return;
+      case kTimer: on_timer(); return;
+      case kRecv: break;
+      case kSend: break;
+      default: return;  // shutdown, cancel, close: nothing to do
+    }
+    auto it = conns_.find(id);
+    if (it == conns_.end()) {
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        buffers_.recycle(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+      }
+      return;
+    }
+    Conn& conn = *it->second;
+    if (op == kRecv) {
+      on_recv(conn, cqe);
+    } else {
+      on_send(conn, cqe.res);
+    }
+    if (conn.released) conns_.erase(it);
+  }
+
+  void arm_accept() {
+    io_uring_sqe* e = ring_.sqe();
+    e->opcode = IORING_OP_ACCEPT;
+    e->fd = listen_fd_;
+    e->ioprio = IORING_ACCEPT_MULTISHOT;
+    e->accept_flags = SOCK_CLOEXEC;
+    e->user_data = user_data(kAccept, 0);
+  }
+
+  void arm_timer() {
+    io_uring_sqe* e = ring_.sqe();
+    e->opcode = IORING_OP_TIMEOUT;
+    e->addr = reinterpret_cast<uint64_t>(&tick_);
+    e->len = 1;
+    e->user_data = user_data(kTimer, 0);
+  }
+
+  void arm_recv(Conn& conn) {
+    io_uring_sqe* e = ring_.sqe();
+    e->opcode = IORING_OP_RECV;
+    e->fd = conn.fd;
+    e->ioprio = IORING_RECV_MULTISHOT;
+    e->flags = IOSQE_BUFFER_SELECT;
+    e->buf_group = BufferRing::kGroup;
+    e->user_data = user_data(kRecv, conn.id);
+    conn.recv_armed = true;
+  }
+
+  void on_accept(const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) arm_accept();
+    if (cqe.res < 0) return;
+
+    auto conn = std::make_unique<Conn>();
+    conn->id = ++next_id_;
+    conn->fd = cqe.res;
+    conn->last_active = steady::now();
+    httplib::detail::get_remote_ip_and_port(conn->fd, conn->remote_ip,
+                                            conn->remote_port);
+    arm_recv(*conn);
+    conns_.emplace(conn->id, std::move(conn));
+
+    auto& m = uring_metrics();
+    m.connections.inc();
+    m.open_connections.set(static_cast<double>(++open_connections));
+  }
+
+  void on_timer() {
+    arm_timer();
+    auto idle = std::chrono::seconds(options_.idle_timeout_sec);
+    auto now = steady::now();
+    std::vector<Conn*> expired;
+    for (auto& entry : conns_) {
+      Conn& c = *entry.second;
+      if (!c.sending && !c.handoff && now - c.last_active > idle) {
+        expired.push_back(&c);
+      }
+    }
+    for (Conn* c : expired) begin_close(*c);
+    for (Conn* c : expired) {
+      if (c->released) conns_.erase(c->id);
+    }
+  }
+
+  void on_recv(Conn& conn, const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) conn.recv_armed = false;
+    bool reading = !conn.closing && !conn.handoff;
+
+    if (cqe.res > 0) {
+      auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      if (reading) conn.in.append(buffers_.data(bid), static_cast<size_t>(cqe.res));
+      buffers_.recycle(bid);
+      conn.last_active = steady::now();
+      if (reading) process(conn);
+    } else if (cqe.res == -ENOBUFS && reading) {
+      // Every buffer was in use; they have been recycled by now
+    } else if (!conn.handoff) {
+      conn.closing = true;  // peer closed, reset or cancelled
+    }
+
+    if (!conn.recv_armed) {
+      if (!conn.closing && !conn.handoff) {
+        arm_recv(conn);
+      } else {
+        finalize(conn);
+      }
+    }
+  }
+
+  void process(Conn& conn) {
+    auto& m = uring_metrics();
+    while (!conn.closing && !conn.handoff) {
+      bool expect_continue = false;
+      size_t n = request_length(conn.in, options_.max_request_bytes, expect_continue);
+      if (n == kMalformed || n == kTooLarge ||
+          (n == 0 && conn.in.size() > options_.max_request_bytes)) {
+        conn.queued += n == kMalformed
+                           ? "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
+                           : "HTTP/1.1 413 Payload Too Large\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        conn.closing = true;
+        break;
+      }
+      if (n == 0) {
+        if (expect_continue && !conn.continued) {
+          conn.queued += "HTTP/1.1 100 Continue\r\n\r\n";
+          conn.continued = true;
+        }
+        break;
+      }
+
+      if (threaded(conn.in)) {
+        m.requests.inc();
+        // Anyone can ask for these paths (auth is the handler's), so the
+        // threads they take are bounded
+        if (threaded_requests.fetch_add(1) >= options_.max_threaded) {
+          threaded_requests.fetch_sub(1);
+          conn.queued += "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n"
+                         "Content-Length: 0\r\n\r\n";
+          conn.in.erase(0, n);
+          conn.continued = false;
+          continue;
+        }
+        // Held by the handler, so the slot comes back whether it runs or
+        // is dropped with the connection
+        std::shared_ptr<void> slot(nullptr, [](void*) { threaded_requests.fetch_sub(1); });
+        // Runs on its own thread once the socket is handed off (see
+        // finalize); responses queued before it are written first
+        conn.upgrade = [this, slot, request = conn.in.substr(0, n), fd = conn.fd,
+                        ip = conn.remote_ip, port = conn.remote_port](httplib::Stream& strm) {
+          std::string out;
+          BufferedStream buffered(request.data(), request.size(), out, fd, options_.port);
+          bool connection_closed = false;
+          httplib::UpgradeHandler upgrade;
+          svr_.process_buffered_request(buffered, ip, port, connection_closed, upgrade,
+                                        true);
+          httplib::detail::write_data(strm, out.data(), out.size());
+        };
+        conn.handoff = true;
+        conn.in.clear();
+        break;
+      }
+
+      BufferedStream strm(conn.in.data(), n, conn.queued, conn.fd, options_.port);
+      bool connection_closed = false;
+      httplib::UpgradeHandler upgrade;
+      svr_.process_buffered_request(strm, conn.remote_ip, conn.remote_port,
+                                    connection_closed, upgrade);
+      m.requests.inc();
+      conn.in.erase(0, n);
+      conn.continued = false;
+      if (upgrade) {
+        conn.upgrade = std::move(upgrade);
+        conn.handoff = true;
+      } else if (connection_closed) {
+        conn.closing = true;
+      }
+    }
+    flush(conn);
+  }
+
+  bool threaded(const std::string& in) const {
+    if (options_.threaded_paths.empty()) return false;
+    const std::string path = request_path(in);
+    return std::find(options_.threaded_paths.begin(), options_.threaded_paths.end(), path) !=
+           options_.threaded_paths.end();
+  }
+
+  void flush(Conn& conn) {
+    if (conn.sending) return;
+    if (conn.handoff) {
+      // The socket changes hands once its multishot recv is gone, and the
+      // session thread sends the 101 itself: a frame the client sends right
+      // after it must not end up in one of our buffers
+      if (conn.recv_armed && !conn.cancel_issued) {
+        io_uring_sqe* e = ring_.sqe();
+        e->opcode = IORING_OP_ASYNC_CANCEL;
+        e->addr = user_data(kRecv, conn.id);
+        e->user_data = user_data(kCancel, conn.id);
+        conn.cancel_issued = true;
+      }
+      finalize(conn);
+      return;
+    }
+    if (conn.queued.empty()) {
+      if (conn.closing) begin_close(conn);
+      return;
+    }
+
+    conn.out.swap(conn.queued);
+    conn.queued.clear();
+    conn.sent = 0;
+    send(conn);
+  }
+
+  void send(Conn& conn) {
+    io_uring_sqe* e = ring_.sqe();
+    e->opcode = IORING_OP_SEND;
+    e->fd = conn.fd;
+    e->addr = reinterpret_cast<uint64_t>(conn.out.data() + conn.sent);
+    e->len = static_cast<uint32_t>(conn.out.size() - conn.sent);
+    e->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    e->user_data = user_data(kSend, conn.id);
+    conn.sending = true;
+
+    // Last response on this connection: the shutdown runs right after the
+    // send in the same submission, and ends the multishot recv
+    if (conn.closing && !conn.handoff && conn.recv_armed) {
+      e->flags |= IOSQE_IO_LINK;
+      io_uring_sqe* s = ring_.sqe();
+      s->opcode = IORING_OP_SHUTDOWN;
+      s->fd = conn.fd;
+      s->len = SHUT_RDWR;
+      s->user_data = user_data(kShutdown, conn.id);
+      conn.shutdown_issued = true;
+    }
+  }
+
+  void on_send(Conn& conn, int res) {
+    conn.sending = false;
+    if (res < 0) {
+      conn.handoff = false;
+      conn.queued.clear();
+      conn.shutdown_issued = false;  // a linked shutdown was cancelled
+      begin_close(conn);
+      return;
+    }
+    conn.sent += static_cast<size_t>(res);
+    conn.last_active = steady::now();
+    if (conn.sent < conn.out.size()) {
+      conn.shutdown_issued = false;
+      send(conn);
+      return;
+    }
+    conn.out.clear();
+    flush(conn);
+    if (!conn.sending) finalize(conn);
+  }
+
+  void begin_close(Conn& conn) {
+    conn.closing = true;
+    if (conn.recv_armed && !conn.shutdown_issued) {
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_SHUTDOWN;
+      e->fd = conn.fd;
+      e->len = SHUT_RDWR;
+      e->user_data = user_data(kShutdown, conn.id);
+      conn.shutdown_issued = true;
+    }
+    finalize(conn);
+  }
+
+  // Releases the socket once nothing is in flight for it; the caller drops
+  // the Conn when it sees `released`
+  void finalize(Conn& conn) {
+    if (conn.released || conn.recv_armed || conn.sending) return;
+    if (!conn.closing && !conn.handoff) return;
+
+    if (conn.handoff && !conn.closing) {
+      std::thread([fd = conn.fd, head = std::move(conn.queued),
+                   handler = std::move(conn.upgrade)] {
+        httplib::detail::SocketStream strm(
+            fd, CPPHTTPLIB_SERVER_READ_TIMEOUT_SECOND,
+            CPPHTTPLIB_SERVER_READ_TIMEOUT_USECOND,
+            CPPHTTPLIB_SERVER_WRITE_TIMEOUT_SECOND,
+            CPPHTTPLIB_SERVER_WRITE_TIMEOUT_USECOND);
+        if (httplib::detail::write_data(strm, head.data(), head.size())) {
+          handler(strm);
+        }
+        ::shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+      }).detach();
+    } else {
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_CLOSE;
+      e->fd = conn.fd;
+      e->user_data = user_data(kClose, conn.id);
+    }
+    uring_metrics().open_connections.set(static_cast<double>(--open_connections));
+    conn.released = true;
+  }
+
+  httplib::Server& svr_;
+  const UringOptions options_;
+  int listen_fd_ = -1;
+  Ring ring_;
+  BufferRing buffers_;
+  __kernel_timespec tick_{1, 0};
+  uint64_t next_id_ = 0;
+  std::unordered_map<uint64_t, std::unique_ptr<Conn>> conns_;
+};
+
+} // namespace
+
+bool uring_available(std::string& why) {
+  utsname u{};
+  int major = 0, minor = 0;
+  if (::uname(&u) != 0 || std::sscanf(u.release, "%d.%d", &major, &minor) != 2 ||
+      major < 6) {
+    why = "kernel older than 6.0 (multishot recv)";
+    return false;
+  }
+
+  Ring ring;
+  if (!ring.init(8, why)) return false;
+
+  std::vector<char> mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(mem.data());
+  if (sys_register(ring.fd(), IORING_REGISTER_PROBE, probe, 256) != 0) {
+    why = std::string("IORING_REGISTER_PROBE: ") + std::strerror(errno);
+    return false;
+  }
+  for (int op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                 IORING_OP_SHUTDOWN, IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT,
+                 IORING_OP_CLOSE}) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      why = "io_uring opcode " + std::to_string(op) + " not supported";
+      return false;
+    }
+  }
+
+  BufferRing buffers;
+  return buffers.init(ring, 8, 64, why);
+}
+
+bool listen_uring(httplib::Server& svr, const UringOptions& options) {
+  uring_metrics();
+  std::vector<std::unique_ptr<RingServer>> rings;
+  for (size_t i = 0; i < std::max<size_t>(1, options.rings); i++) {
+    auto ring = std::make_unique<RingServer>(svr, options);
+    std::string error;
+    if (!ring->init(error)) {
+      std::cerr << "[error] io_uring: " << error << std::endl;
+      return false;
+    }
+    rings.push_back(std::move(ring));
+  }
+  if (options.listening) options.listening();
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < rings.size(); i++) {
+    threads.emplace_back([&rings, i] { rings[i]->run(); });
+  }
+  rings[0]->run();
+  for (auto& t : threads) t.join();
+  return false;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "httplib.h"
+
+// io_uring transport for the HTTP/1.1 server (HTTP_IO_URING=1).
+//
+// httplib's listener costs a poll and a recv per request on a pool thread,
+// plus two setsockopt calls per accepted connection. Here each ring thread
+// owns a SO_REUSEPORT listener and an io_uring with a multishot accept, one
+// multishot recv per connection into a ring of provided buffers, and sends
+// that are linked to the shutdown when a response ends the connection. A
+// busy ring answers many requests per io_uring_enter.
+//
+// Requests still go through httplib's parsing, routing and handlers
+// (Server::process_buffered_request), so routes are registered as usual.
+// Handlers run on the ring thread: `rings` bounds the requests in progress
+// the way the pool size does. WebSocket upgrades get a thread of their own,
+// and so do requests for `threaded_paths` (handlers that take seconds, like
+// profiles or the autotuner, would stall every connection on their ring):
+// those connections are closed after the response. At most
+// `max_threaded` of them run at once across all rings; more get a 503.
+struct UringOptions {
+  int port = 10000;
+  size_t rings = 4;
+  size_t max_request_bytes = 1 << 20;  // head + body
+  int idle_timeout_sec = 5;            // keep-alive, as httplib's default
+  unsigned buffers = 256;              // provided recv buffers per ring (power of two)
+  unsigned buffer_size = 4096;
+  std::vector<std::string> threaded_paths;  // exact paths, query ignored
+  size_t max_threaded = 4;
+  std::function<void()> listening;     // called once every listener is bound
+};
+
+// False (with the reason) when the kernel lacks what the transport needs:
+// io_uring itself, multishot accept/recv and provided buffer rings (6.0+).
+bool uring_available(std::string& why);
+
+// Serves `svr` on io_uring; blocks like Server::listen. Returns false if the
+// listeners or rings cannot be set up.
+bool listen_uring(httplib::Server& svr, const UringOptions& options);
@@ -0,0 +1,481 @@
+#include "ws.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+using json = nlohmann::json;
+
+// RFC 6455 section 1.3
+const char kAcceptGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum Opcode : uint8_t {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xA,
+};
+
+enum CloseCode : uint16_t {
+  kNormal = 1000,
+  kGoingAway = 1001,
+  kProtocolError = 1002,
+  kTooBig = 1009,
+};
+
+// SHA-1, only for the handshake's Sec-WebSocket-Accept (RFC 3174)
+std::string sha1(const std::string& input) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  std::string msg = input;
+  uint64_t bit_len = static_cast<uint64_t>(input.size()) * 8;
+  msg += static_cast<char>(0x80);
+  while (msg.size() % 64 != 56) msg += '\0';
+  for (int i = 7; i >= 0; i--) msg += static_cast<char>((bit_len >> (i * 8)) & 0xFF);
+
+  auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+  for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const auto* p = reinterpret_cast<const unsigned char*>(msg.data() + chunk + i * 4);
+      w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+             (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::string digest;
+  for (uint32_t v : h) {
+    for (int i = 3; i >= 0; i--) digest += static_cast<char>((v >> (i * 8)) & 0xFF);
+  }
+  return digest;
+}
+
+bool header_has_token(const httplib::Request& req, const char* name,
+                      const char* token) {
+  auto value = req.get_header_value(name);
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return value.find(token) != std::string::npos;
+}
+
+std::string encode_frame(Opcode opcode, const char* data, size_t len) {
+  std::string frame;
+  frame.reserve(len + 10);
+  frame += static_cast<char>(0x80 | opcode);  // FIN, server frames unmasked
+  if (len < 126) {
+    frame += static_cast<char>(len);
+  } else if (len <= 0xFFFF) {
+    frame += static_cast<char>(126);
+    frame += static_cast<char>((len >> 8) & 0xFF);
+    frame += static_cast<char>(len & 0xFF);
+  } else {
+    frame += static_cast<char>(127);
+    for (int i = 7; i >= 0; i--) frame += static_cast<char>((uint64_t(len) >> (i * 8)) & 0xFF);
+  }
+  frame.append(data, len);
+  return frame;
+}
+
+std::string encode_text(const std::string& text) {
+  return encode_frame(kText, text.data(), text.size());
+}
+
+std::string encode_close(CloseCode code) {
+  char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)};
+  return encode_frame(kClose, payload, sizeof(payload));
+}
+
+std::string error_message(const json& id, const std::string& message) {
+  json error_response;
+  if (!id.is_null()) error_response["id"] = id;
+  error_response["error"] = message;
+  return encode_text(error_response.dump());
+}
+
+// Frames finished on the batcher thread, waiting for the session thread.
+// Shared with pending callbacks so late results after close are dropped.
+struct Outbox {
+  std::mutex mutex;
+  std::string frames;
+  int event_fd = -1;
+  bool closed = false;
+
+  void push(const std::string& frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) return;
+    bool was_empty = frames.empty();
+    frames += frame;
+    if (was_empty) {
+      uint64_t one = 1;
+      (void)!::write(event_fd, &one, sizeof(one));
+    }
+  }
+};
+
+struct WsMetrics {
+  metrics::Counter& text;
+  metrics::Counter& binary;
+};
+
+WsMetrics& ws_metrics() {
+  auto& r = metrics::registry();
+  static WsMetrics m{
+      r.counter("ia_ws_messages_total{type=\"text\"}",
+                "WebSocket messages received"),
+      r.counter("ia_ws_messages_total{type=\"binary\"}",
+                "WebSocket messages received"),
+  };
+  return m;
+}
+
+class Session {
+public:
+  Session(httplib::Stream& strm, InferenceBatcher& batcher,
+          const WsOptions& options)
+      : strm_(strm), batcher_(batcher), options_(options),
+        outbox_(std::make_shared<Outbox>()) {
+    outbox_->event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+
+  ~Session() {
+    std::lock_guard<std::mutex> lock(outbox_->mutex);
+    outbox_->closed = true;
+    ::close(outbox_->event_fd);
+  }
+
+  void run() {
+    using clock = std::chrono::steady_clock;
+    const auto interval = std::chrono::seconds(options_.ping_interval_sec);
+    auto last_seen = clock::now();
+
+    for (;;) {
+      // Data may already sit in the stream's buffer (or TLS layer)
+      if (!strm_.is_readable()) {
+        pollfd fds[2] = {{strm_.socket(), POLLIN, 0},
+                         {outbox_->event_fd, POLLIN, 0}};
+        int rc = ::poll(fds, 2, options_.ping_interval_sec * 1000);
+        if (rc < 0) {
+          if (errno == EINTR) continue;
+          return;
+        }
+        if ((fds[1].revents & POLLIN) && !flush_outbox()) return;
+        if (rc == 0) {
+          if (clock::now() - last_seen > 2 * interval) {
+            send(encode_close(kGoingAway));
+            return;
+          }
+          if (!send(encode_frame(kPing, nullptr, 0))) return;
+          continue;
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      }
+
+      if (!read_frame()) return;
+      last_seen = clock::now();
+      if (closing_) return;
+    }
+  }
+
+private:
+  bool read_exact(char* buf, size_t n) {
+    while (n > 0) {
+      auto r = strm_.read(buf, n);
+      if (r <= 0) return false;
+      buf += r;
+      n -= static_cast<size_t>(r);
+    }
+    return true;
+  }
+
+  bool send(const std::string& data) {
+    return httplib::detail::write_data(strm_, data.data(), data.size());
+  }
+
+  // Writes every frame finished so far with one write
+  bool flush_outbox() {
+    uint64_t count;
+    (void)!::read(outbox_->event_fd, &count, sizeof(count));
+    std::string frames;
+    {
+      std::lock_guard<std::mutex> lock(outbox_->mutex);
+      frames.swap(outbox_->frames);
+    }
+    return frames.empty() || send(frames);
+  }
+
+  bool fail(CloseCode code) {
+    send(encode_close(code));
+    return false;
+  }
+
+  bool read_frame() {
+    unsigned char hdr[2];
+    if (!read_exact(reinterpret_cast<char*>(hdr), 2)) return false;
+    const bool fin = hdr[0] & 0x80;
+    const auto opcode = static_cast<Opcode>(hdr[0] & 0x0F);
+    const bool masked = hdr[1] & 0x80;
+    uint64_t len = hdr[1] & 0x7F;
+
+    // No extensions are negotiated, and clients must mask (RFC 6455 5.1)
+    if ((hdr[0] & 0x70) || !masked) return fail(kProtocolError);
+
+    if (len >= 126) {
+      unsigned char ext[8];
+      size_t n = (len == 126) ? 2 : 8;
+      if (!read_exact(reinterpret_cast<char*>(ext), n)) return false;
+      len = 0;
+      for (size_t i = 0; i < n; i++) len = (len << 8) | ext[i];
+    }
+    const bool control = opcode & 0x8;
+    if (control && (!fin || len > 125)) return fail(kProtocolError);
+    if (message_.size() + len > options_.max_message_bytes) return fail(kTooBig);
+
+    unsigned char mask[4];
+    if (!read_exact(reinterpret_cast<char*>(mask), 4)) return false;
+    std::string payload(static_cast<size_t>(len), '\0');
+    if (len > 0 && !read_exact(&payload[0], payload.size())) return false;
+    for (size_t i = 0; i < payload.size(); i++) payload[i] ^= mask[i % 4];
+
+    switch (opcode) {
+    case kPing:
+      return send(encode_frame(kPong, payload.data(), payload.size()));
+    case kPong:
+      return true;
+    case kClose:
+      // Echo the status code back and end the session
+      send(encode_frame(kClose, payload.data(), std::min<size_t>(payload.size(), 2)));
+      closing_ = true;
+      return true;
+    case kText:
+    case kBinary:
+      if (!message_.empty() || message_opcode_ != kContinuation) {
+        return fail(kProtocolError);  // new message inside a fragmented one
+      }
+      message_opcode_ = opcode;
+      break;
+    case kContinuation:
+      if (message_opcode_ == kContinuation) return fail(kProtocolError);
+      break;
+    default:
+      return fail(kProtocolError);
+    }
+
+    message_ += payload;
+    if (fin) {
+      const auto type = message_opcode_;
+      message_opcode_ = kContinuation;
+      std::string message;
+      message.swap(message_);
+      if (type == kText) {
+        on_text(message);
+      } else {
+        on_binary(message);
+      }
+    }
+    return true;
+  }
+
+  void on_text(const std::string& message) {
+    ws_metrics().text.inc();
+    json body;
+    try {
+      body = json::parse(message);
+    } catch (const json::parse_error& e) {
+      send(error_message(nullptr, "Invalid JSON: " + std::string(e.what())));
+      return;
+    }
+    if (!body.is_object()) {
+      send(error_message(nullptr, "x must be a number"));
+      return;
+    }
+
+    const json id = body.contains("id") ? body["id"] : json();
+    // Feature tables are only wired into the HTTP/1.1 handler
+    if (body.contains("key")) {
+      send(error_message(id, "key lookups not supported on this transport"));
+      return;
+    }
+    std::vector<float> xs;
+    const bool is_array = body.contains("x") && body["x"].is_array();
+    if (is_array) {
+      for (const auto& v : body["x"]) {
+        if (!v.is_number()) break;
+        xs.push_back(v.get<float>());
+      }
+      if (xs.size() != body["x"].size()) xs.clear();
+    } else if (body.contains("x") && body["x"].is_number()) {
+      xs.push_back(body["x"].get<float>());
+    }
+    if (xs.empty()) {
+      send(error_message(id, "x must be a number"));
+      return;
+    }
+
+    auto outbox = outbox_;
+    bool queued = batcher_.submit_group(
+        xs, [outbox, id, is_array](std::vector<InferenceBatcher::Result> results) {
+          json reply;
+          for (const auto& r : results) {
+            if (r.contains("error")) {
+              outbox->push(error_message(id, "Internal server error"));
+              return;
+            }
+          }
+          if (is_array) {
+            reply["y"] = json::array();
+            for (auto& r : results) reply["y"].push_back(r["y"]);
+          } else {
+            reply = std::move(results[0]);
+          }
+          if (!id.is_null()) reply["id"] = id;
+          outbox->push(encode_text(reply.dump()));
+        });
+    if (!queued) send(error_message(id, "Server busy"));
+  }
+
+  void on_binary(const std::string& message) {
+    ws_metrics().binary.inc();
+    if (message.size() < 8 || message.size() % 4 != 0) {
+      send(error_message(nullptr,
+                         "binary messages are a uint32 id followed by float32 inputs"));
+      return;
+    }
+    uint32_t id;
+    std::memcpy(&id, message.data(), 4);
+    std::vector<float> xs((message.size() - 4) / 4);
+    std::memcpy(xs.data(), message.data() + 4, xs.size() * 4);
+
+    auto outbox = outbox_;
+    bool queued = batcher_.submit_group(
+        xs, [outbox, id](std::vector<InferenceBatcher::Result> results) {
+          std::string reply(4 + results.size() * 4, '\0');
+          std::memcpy(&reply[0], &id, 4);
+          for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].contains("error")) {
+              outbox->push(error_message(id, "Internal server error"));
+              return;
+            }
+            float y = results[i]["y"].get<float>();
+            std::memcpy(&reply[4 + i * 4], &y, 4);
+          }
+          outbox->push(encode_frame(kBinary, reply.data(), reply.size()));
+        });
+    if (!queued) send(error_message(id, "Server busy"));
+  }
+
+  httplib::Stream& strm_;
+  InferenceBatcher& batcher_;
+  const WsOptions& options_;
+  std::shared_ptr<Outbox> outbox_;
+  std::string message_;  // fragments of the message being received
+  Opcode message_opcode_ = kContinuation;
+  bool closing_ = false;
+};
+
+} // namespace
+
+WsEndpoint::WsEndpoint(InferenceBatcher& batcher, const CorsPolicy& cors,
+                       WsOptions options)
+    : batcher_(batcher), cors_(cors), options_(options),
+      sessions_(metrics::registry().counter("ia_ws_sessions_total",
+                                            "WebSocket sessions opened")),
+      refused_(metrics::registry().counter(
+          "ia_ws_refused_total", "WebSocket upgrades refused (session cap)")),
+      open_sessions_(metrics::registry().gauge("ia_ws_open_sessions",
+                                               "Open WebSocket sessions")) {
+  ws_metrics();
+}
+
+void WsEndpoint::handle(const httplib::Request& req, httplib::Response& res) {
+  auto error = [&res](int status, const std::string& message) {
+    json error_response;
+    error_response["error"] = message;
+    res.status = status;
+    res.set_content(error_response.dump(), "application/json");
+  };
+
+  if (!header_has_token(req, "Upgrade", "websocket") ||
+      !header_has_token(req, "Connection", "upgrade")) {
+    res.set_header("Upgrade", "websocket");
+    return error(426, "WebSocket upgrade required");
+  }
+  if (req.get_header_value("Sec-WebSocket-Version") != "13") {
+    res.set_header("Sec-WebSocket-Version", "13");
+    return error(426, "Unsupported WebSocket version");
+  }
+  const auto key = req.get_header_value("Sec-WebSocket-Key");
+  if (key.empty()) return error(400, "Missing Sec-WebSocket-Key");
+
+  // Browsers do not apply CORS to WebSockets, so check the origin here
+  if (req.has_header("Origin") && !cors_.is_allowed(req.get_header_value("Origin"))) {
+    return error(403, "Origin not allowed");
+  }
+  // The slot is taken here, not when the session starts, so concurrent
+  // upgrades cannot all pass the check. The handler owns it: it is given
+  // back when the session ends, or when the handler is dropped unrun.
+  size_t active = active_.load();
+  do {
+    if (options_.max_sessions > 0 && active >= options_.max_sessions) {
+      refused_.inc();
+      return error(503, "Too many WebSocket sessions");
+    }
+  } while (!active_.compare_exchange_weak(active, active + 1));
+  open_sessions_.set(static_cast<double>(active + 1));
+  std::shared_ptr<void> slot(nullptr, [this](void*) {
+    open_sessions_.set(static_cast<double>(--active_));
+  });
+
+  res.set_header("Upgrade", "websocket");
+  res.set_header("Connection", "Upgrade");
+  res.set_header("Sec-WebSocket-Accept",
+                 httplib::detail::base64_encode(sha1(key + kAcceptGuid)));
+  res.set_upgrade_handler([this, slot](httplib::Stream& strm) {
+    sessions_.inc();
+    Session session(strm, batcher_, options_);
+    session.run();
+  });
+}
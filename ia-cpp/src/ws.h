@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "batcher.h"
+#include "cors.h"
+#include "httplib.h"
+
+// WebSocket inference channel for the interactive frontend (GET /predict/ws).
+//
+// One upgraded connection per client replaces one HTTP request per
+// prediction, so there is no request parsing, header block or CORS check per
+// input. Messages:
+//
+//   text    {"id": <any>, "x": 2}        ->  {"id": ..., "y": 6.5, ...}
+//           {"id": <any>, "x": [1, 2]}   ->  {"id": ..., "y": [3.5, 6.5]}
+//   binary  uint32 id + N float32 x      ->  uint32 id + N float32 y
+//
+// (binary values are little endian). {"key": ...} is answered with an error:
+// feature table lookups are only served by HTTP/1.1 POST /predict. Every input goes through the inference
+// batcher: the inputs of one message are queued together, and messages that
+// arrive together share batches. Results are pushed as soon as they are
+// ready and may overtake earlier messages, hence the id.
+//
+// A session keeps its httplib worker thread for as long as it is open, so the
+// number of sessions is capped to leave workers for plain HTTP.
+struct WsOptions {
+  size_t max_sessions = 0;  // 0 = unlimited
+  size_t max_message_bytes = 1 << 20;
+  int ping_interval_sec = 30;  // idle sessions are closed after two intervals
+};
+
+class WsEndpoint {
+public:
+  WsEndpoint(InferenceBatcher& batcher, const CorsPolicy& cors,
+             WsOptions options);
+
+  // GET handler: upgrades the connection, or answers 400/403/426/503
+  void handle(const httplib::Request& req, httplib::Response& res);
+
+private:
+  InferenceBatcher& batcher_;
+  const CorsPolicy& cors_;
+  const WsOptions options_;
+  std::atomic<size_t> active_{0};
+
+  metrics::Counter& sessions_;
+  metrics::Counter& refused_;
+  metrics::Gauge& open_sessions_;
+};
@@ -0,0 +1,110 @@
+// CASCADE_RULE parsing, the escalation rules, and how a cascade run routes
+// inputs and reports a failed stage.
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "cascade.h"
+#include "check.h"
+
+namespace {
+
+using Outcome = Cascade::Outcome;
+
+void test_parse() {
+  CascadeRule rule;
+  std::string error;
+  CHECK(CascadeRule::parse("band:0.3:0.7", rule, error));
+  CHECK(rule.kind == CascadeRule::Kind::band && rule.lo == 0.3f && rule.hi == 0.7f);
+  CHECK(rule.describe() == "band:0.3:0.7");
+  CHECK(CascadeRule::parse("outside:-1:1", rule, error));
+  CHECK(rule.kind == CascadeRule::Kind::outside && rule.lo == -1 && rule.hi == 1);
+  CHECK(CascadeRule::parse("uncertainty:0.2", rule, error));
+  CHECK(rule.kind == CascadeRule::Kind::uncertainty && rule.hi == 0.2f);
+  CHECK(rule.needs_uncertainty());
+
+  // A failed parse leaves the rule as it was
+  for (const char* bad : {"", "band", "band:0.7:0.3", "band:0.3", "band:x:1", "band:0:1:2",
+                          "outside:0:inf", "uncertainty", "uncertainty:nan", "range:0:1"}) {
+    error.clear();
+    CHECK(!CascadeRule::parse(bad, rule, error));
+    CHECK(!error.empty());
+    CHECK(rule.kind == CascadeRule::Kind::uncertainty);
+  }
+}
+
+void test_escalate() {
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  CascadeRule band{CascadeRule::Kind::band, 0.3f, 0.7f};
+  CHECK(band.escalate(0.3f, 0) && band.escalate(0.5f, 0) && band.escalate(0.7f, 0));
+  CHECK(!band.escalate(0.1f, 0) && !band.escalate(0.9f, 0));
+  CHECK(band.escalate(nan, 0));
+
+  CascadeRule outside{CascadeRule::Kind::outside, -1, 1};
+  CHECK(outside.escalate(-2, 0) && outside.escalate(1.5f, 0));
+  CHECK(!outside.escalate(-1, 0) && !outside.escalate(0, 0) && !outside.escalate(1, 0));
+  CHECK(outside.escalate(nan, 0));
+
+  CascadeRule uncertainty{CascadeRule::Kind::uncertainty, 0, 0.2f};
+  CHECK(uncertainty.escalate(5, 0.3f));
+  CHECK(!uncertainty.escalate(5, 0.2f) && !uncertainty.escalate(5, 0));
+  CHECK(uncertainty.escalate(5, nan));
+}
+
+void test_run() {
+  CascadeConfig config;
+  config.fast_model = "fast.onnx";
+  config.rule = CascadeRule{CascadeRule::Kind::band, 0.3f, 0.7f};
+  metrics::Registry registry;
+
+  bool fast_ok = true;
+  bool full_ok = true;
+  size_t full_inputs = 0;
+  Cascade cascade(
+      config,
+      [&](const float* xs, size_t n, float* ys, float*) {
+        for (size_t i = 0; i < n; i++) ys[i] = xs[i];
+        return fast_ok;
+      },
+      [&](const float* xs, size_t n, float* ys) {
+        full_inputs = n;
+        for (size_t i = 0; i < n; i++) ys[i] = 10 + xs[i];
+        return full_ok;
+      },
+      registry);
+
+  const float xs[] = {0.1f, 0.5f, 0.9f, 0.6f};
+  float ys[4];
+  Outcome outcome[4];
+  CHECK(cascade.run(xs, 4, ys, outcome));
+  CHECK(full_inputs == 2);  // only the escalated inputs, in one run
+  CHECK(outcome[0] == Outcome::fast && ys[0] == 0.1f);
+  CHECK(outcome[1] == Outcome::full && ys[1] == 10.5f);
+  CHECK(outcome[2] == Outcome::fast && ys[2] == 0.9f);
+  CHECK(outcome[3] == Outcome::full && ys[3] == 10.6f);
+
+  // A failed full run fails the escalated inputs only
+  full_ok = false;
+  CHECK(!cascade.run(xs, 4, ys, outcome));
+  CHECK(outcome[0] == Outcome::fast && ys[0] == 0.1f);
+  CHECK(outcome[1] == Outcome::failed);
+  CHECK(outcome[2] == Outcome::fast && ys[2] == 0.9f);
+  CHECK(outcome[3] == Outcome::failed);
+
+  // A failed cheap run escalates everything
+  full_ok = true;
+  fast_ok = false;
+  CHECK(cascade.run(xs, 4, ys, outcome));
+  CHECK(full_inputs == 4);
+  for (size_t i = 0; i < 4; i++) CHECK(outcome[i] == Outcome::full && ys[i] == 10 + xs[i]);
+}
+
+} // namespace
+
+int main() {
+  test_parse();
+  test_escalate();
+  test_run();
+  return test_result();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal self-checking tests, run by ctest: CHECK reports the failed
+// expression and carries on, and main() returns test_result().
+inline int& test_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                \
+      test_failures()++;                                                  \
+    }                                                                     \
+  } while (0)
+
+inline int test_result() {
+  if (test_failures() > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", test_failures());
+    return 1;
+  }
+  return 0;
+}
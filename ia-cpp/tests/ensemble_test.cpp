@@ -0,0 +1,122 @@
+// Ensemble reducers against a scalar reference, including batches that do
+// not fill the last vector, and the fan-out's failure handling.
+
+#include <cmath>
+#include <vector>
+
+#include "check.h"
+#include "ensemble.h"
+
+namespace {
+
+// One slot past n, to catch writes beyond the batch from the padded tail
+constexpr float kSentinel = -12345.0f;
+
+std::vector<float> outputs(size_t members, size_t n) {
+  std::vector<float> outs(members * n);
+  for (size_t k = 0; k < members; k++) {
+    for (size_t i = 0; i < n; i++) outs[k * n + i] = 0.25f * static_cast<float>(k + 1) * (i + 1);
+  }
+  return outs;
+}
+
+bool near(float a, float b) { return std::fabs(a - b) <= 1e-5f * std::fmax(1.0f, std::fabs(b)); }
+
+void test_mean() {
+  for (size_t n : {1, 3, 4, 7, 9}) {
+    const size_t members = 3;
+    auto outs = outputs(members, n);
+    std::vector<float> ys(n + 1, kSentinel);
+    reduce_mean(outs.data(), members, n, ys.data());
+    for (size_t i = 0; i < n; i++) {
+      float sum = 0;
+      for (size_t k = 0; k < members; k++) sum += outs[k * n + i];
+      CHECK(near(ys[i], sum / members));
+    }
+    CHECK(ys[n] == kSentinel);
+  }
+}
+
+void test_weighted() {
+  for (size_t n : {2, 5, 8}) {
+    const size_t members = 3;
+    const float weights[] = {1.0f, 2.0f, 5.0f};
+    auto outs = outputs(members, n);
+    std::vector<float> ys(n + 1, kSentinel);
+    reduce_weighted(outs.data(), weights, members, n, ys.data());
+    for (size_t i = 0; i < n; i++) {
+      float sum = 0;
+      for (size_t k = 0; k < members; k++) sum += weights[k] * outs[k * n + i];
+      CHECK(near(ys[i], sum / 8.0f));
+    }
+    CHECK(ys[n] == kSentinel);
+  }
+}
+
+void test_vote() {
+  // Five inputs: a full vector and a padded tail of one
+  const size_t n = 5;
+  const float outs[] = {
+      0.9f, 2.0f, 1.0f, 3.2f, 0.4f,  // member 0
+      2.1f, 1.0f, 1.4f, 2.6f, 0.0f,  // member 1
+      1.2f, 2.0f, 0.0f, 2.0f, 1.0f,  // member 2
+  };
+  const float equal[] = {1, 1, 1};
+  float ys[n + 1];
+  ys[n] = kSentinel;
+  reduce_vote(outs, equal, 3, n, ys);
+  CHECK(ys[0] == 1);  // 1, 2, 1
+  CHECK(ys[1] == 2);  // 2, 1, 2
+  CHECK(ys[2] == 1);  // 1, 1, 0
+  CHECK(ys[3] == 3);  // 3, 3, 2
+  CHECK(ys[4] == 0);  // 0, 0, 1
+  CHECK(ys[n] == kSentinel);
+
+  // Ties go to the lowest label, whichever member voted for it
+  const float split[] = {
+      3.0f, 2.0f,  // member 0
+      2.0f, 3.0f,  // member 1
+  };
+  float y[2];
+  reduce_vote(split, equal, 2, 2, y);
+  CHECK(y[0] == 2);
+  CHECK(y[1] == 2);
+
+  // A heavier member outvotes two lighter ones
+  const float weighted[] = {3, 1, 1};
+  const float labels[] = {1.0f, 2.0f, 2.0f};
+  reduce_vote(labels, weighted, 3, 1, y);
+  CHECK(y[0] == 1);
+}
+
+void test_run() {
+  EnsembleConfig config;
+  config.models = {"a.onnx", "b.onnx", "c.onnx"};
+  metrics::Registry registry;
+  Ensemble ensemble(config, [](size_t k, const float* xs, size_t n, float* ys) {
+    for (size_t i = 0; i < n; i++) ys[i] = xs[i] * static_cast<float>(k + 1);
+    return true;
+  }, registry);
+  const float xs[] = {1, 2, 3, 4, 5, 6};
+  float ys[6];
+  CHECK(ensemble.run(xs, 6, ys));
+  for (size_t i = 0; i < 6; i++) CHECK(near(ys[i], xs[i] * 2));
+
+  Ensemble failing(config, [](size_t k, const float*, size_t n, float* ys) {
+    for (size_t i = 0; i < n; i++) ys[i] = 0;
+    return k != 2;
+  }, registry);
+  float untouched[2] = {kSentinel, kSentinel};
+  CHECK(!failing.run(xs, 2, untouched));
+  CHECK(untouched[0] == kSentinel && untouched[1] == kSentinel);
+}
+
+} // namespace
+
+int main() {
+  test_mean();
+  test_weighted();
+  test_vote();
+  test_run();
+  return test_result();
+}
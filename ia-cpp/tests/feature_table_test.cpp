@@ -0,0 +1,163 @@
+// Feature table files: write/open round trip, lookups through long probe
+// chains and hash collisions, and rejection of corrupt files.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.h"
+#include "feature_table.h"
+
+namespace {
+
+using Rows = std::vector<std::pair<std::string, std::vector<float>>>;
+
+const std::string kPath = "/tmp/ia-feature-table-test-" + std::to_string(::getpid());
+
+// Same hash as the table index
+uint64_t fnv1a(const std::string& key) {
+  uint64_t h = 1469598103934665603ull;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void write_file(const std::string& path, const std::string& bytes) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+FeatureFileHeader& header_of(std::string& bytes) {
+  return *reinterpret_cast<FeatureFileHeader*>(&bytes[0]);
+}
+
+FeatureIndexSlot* index_of(std::string& bytes) {
+  return reinterpret_cast<FeatureIndexSlot*>(&bytes[header_of(bytes).index_offset]);
+}
+
+std::shared_ptr<const FeatureTable> open_bytes(const std::string& bytes, std::string& error) {
+  write_file(kPath, bytes);
+  error.clear();
+  return FeatureTable::open(kPath, error);
+}
+
+void test_round_trip() {
+  Rows rows;
+  for (int i = 0; i < 1000; i++) {
+    const auto f = static_cast<float>(i);
+    rows.emplace_back("user-" + std::to_string(i), std::vector<float>{f, -f, f / 4});
+  }
+  std::string error;
+  CHECK(write_feature_table(kPath, 3, rows, error));
+  auto table = FeatureTable::open(kPath, error);
+  CHECK(table != nullptr);
+  if (!table) return;
+  CHECK(table->dim() == 3);
+  CHECK(table->rows() == rows.size());
+  // At half load many keys share a home bucket, so this walks probe chains
+  for (const auto& [key, values] : rows) {
+    const float* row = table->find(key);
+    CHECK(row != nullptr);
+    if (row) CHECK(std::memcmp(row, values.data(), 3 * sizeof(float)) == 0);
+  }
+  CHECK(table->find("user-1000") == nullptr);
+  CHECK(table->find("") == nullptr);
+  CHECK(table->find("user-1") != table->find("user-10"));
+
+  // Rejected rows: nothing written
+  std::remove(kPath.c_str());
+  CHECK(!write_feature_table(kPath, 0, {}, error));
+  CHECK(!write_feature_table(kPath, 2, {{"a", {1, 2}}, {"a", {3, 4}}}, error));
+  CHECK(error.find("duplicate") != std::string::npos);
+  CHECK(!write_feature_table(kPath, 2, {{"a", {1, 2}}, {"b", {3}}}, error));
+  CHECK(::access(kPath.c_str(), F_OK) != 0);
+}
+
+void test_hash_collision() {
+  std::string error;
+  CHECK(write_feature_table(kPath, 1, {{"a", {1}}, {"b", {2}}}, error));
+  std::string bytes = read_file(kPath);
+  FeatureFileHeader& h = header_of(bytes);
+  FeatureIndexSlot* index = index_of(bytes);
+  const uint64_t mask = h.buckets - 1;
+
+  // Rebuild the index so that "b" claims the same full hash as "a" and
+  // sits in a's home bucket, ahead of it: "a" is only found by comparing
+  // the stored key
+  for (uint64_t i = 0; i < h.buckets; i++) index[i] = FeatureIndexSlot{0, 0};
+  const uint64_t hash = fnv1a("a");
+  index[hash & mask] = FeatureIndexSlot{hash, 2};        // row 1: "b"
+  index[(hash + 1) & mask] = FeatureIndexSlot{hash, 1};  // row 0: "a"
+
+  auto table = open_bytes(bytes, error);
+  CHECK(table != nullptr);
+  if (!table) return;
+  const float* a = table->find("a");
+  CHECK(a != nullptr && *a == 1);
+
+  // A slot pointing past the last row is skipped, not followed
+  index[(hash + 1) & mask] = FeatureIndexSlot{hash, h.rows + 5};
+  table = open_bytes(bytes, error);
+  CHECK(table != nullptr);
+  if (table) CHECK(table->find("a") == nullptr);
+}
+
+void test_corrupt() {
+  std::string error;
+  CHECK(write_feature_table(kPath, 2, {{"a", {1, 2}}, {"b", {3, 4}}, {"c", {5, 6}}}, error));
+  const std::string good = read_file(kPath);
+  CHECK(open_bytes(good, error) != nullptr);
+
+  auto rejected = [&](std::string bytes) {
+    auto table = open_bytes(bytes, error);
+    return table == nullptr && !error.empty();
+  };
+  auto with = [&](auto mutate) {
+    std::string bytes = good;
+    mutate(header_of(bytes));
+    return rejected(bytes);
+  };
+
+  CHECK(rejected(good.substr(0, sizeof(FeatureFileHeader) - 1)));
+  CHECK(rejected(good.substr(0, good.size() - 1)));  // last value cut short
+  CHECK(with([](FeatureFileHeader& h) { h.magic[0] = 'X'; }));
+  CHECK(with([](FeatureFileHeader& h) { h.version = 2; }));
+  CHECK(with([](FeatureFileHeader& h) { h.dim = 0; }));
+  CHECK(with([](FeatureFileHeader& h) { h.buckets = 24; }));  // not a power of two
+  CHECK(with([](FeatureFileHeader& h) { h.buckets = h.rows; }));
+  CHECK(with([](FeatureFileHeader& h) { h.rows = UINT64_MAX; }));  // rows * dim overflows
+  CHECK(with([](FeatureFileHeader& h) { h.index_offset += 4; }));  // misaligned
+  CHECK(with([](FeatureFileHeader& h) { h.index_offset = UINT64_MAX - 7; }));
+  CHECK(with([](FeatureFileHeader& h) { h.keys_offset = 1ull << 40; }));
+  CHECK(with([](FeatureFileHeader& h) { h.key_bytes_offset = 1ull << 40; }));
+  CHECK(with([](FeatureFileHeader& h) { h.values_offset += 64; }));
+  CHECK(with([](FeatureFileHeader& h) { h.dim = 1u << 30; }));
+
+  std::remove(kPath.c_str());
+  CHECK(FeatureTable::open(kPath, error) == nullptr);
+  CHECK(!error.empty());
+}
+
+} // namespace
+
+int main() {
+  test_round_trip();
+  test_hash_collision();
+  test_corrupt();
+  std::remove(kPath.c_str());
+  return test_result();
+}
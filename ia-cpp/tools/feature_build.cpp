@@ -0,0 +1,83 @@
+// Builds a FEATURE_TABLE file (see src/feature_table.h) from CSV rows of
+// "key,value1,...,valueN". Every row needs the same number of values; a
+// first line whose values are not numbers is taken as a header, and lines
+// starting with '#' are skipped. Usage:
+//
+//   ia-feature-build INPUT.csv|- OUTPUT
+//
+// The output is written to a temporary file and renamed into place, so it
+// can target the path a running server has in FEATURE_TABLE: each worker
+// picks the new table up within FEATURE_TABLE_RELOAD_MS.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "feature_table.h"
+
+namespace {
+
+bool parse_row(const std::string& line, std::string& key, std::vector<float>& values) {
+  std::stringstream in(line);
+  std::string field;
+  if (!std::getline(in, key, ',') || key.empty()) return false;
+  values.clear();
+  while (std::getline(in, field, ',')) {
+    char* end = nullptr;
+    float v = std::strtof(field.c_str(), &end);
+    while (end && (*end == ' ' || *end == '\r')) end++;
+    if (field.empty() || *end) return false;
+    values.push_back(v);
+  }
+  return !values.empty();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "usage: ia-feature-build INPUT.csv|- OUTPUT" << std::endl;
+    return 2;
+  }
+  std::ifstream file;
+  std::istream* in = &std::cin;
+  if (std::string(argv[1]) != "-") {
+    file.open(argv[1]);
+    if (!file) {
+      std::cerr << "[error] Cannot open " << argv[1] << std::endl;
+      return 1;
+    }
+    in = &file;
+  }
+
+  std::vector<std::pair<std::string, std::vector<float>>> rows;
+  std::string line, key;
+  std::vector<float> values;
+  for (size_t n = 1; std::getline(*in, line); n++) {
+    if (line.empty() || line[0] == '#') continue;
+    if (!parse_row(line, key, values)) {
+      if (n == 1) continue;  // header
+      std::cerr << "[error] Line " << n << ": expected key,value1,...,valueN" << std::endl;
+      return 1;
+    }
+    rows.emplace_back(key, values);
+  }
+  if (rows.empty()) {
+    std::cerr << "[error] No rows in " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::string error;
+  const auto dim = static_cast<uint32_t>(rows.front().second.size());
+  if (!write_feature_table(argv[2], dim, rows, error)) {
+    std::cerr << "[error] " << error << std::endl;
+    return 1;
+  }
+  std::cout << "[info] " << argv[2] << ": " << rows.size() << " rows x " << dim << " values"
+            << std::endl;
+  return 0;
+}